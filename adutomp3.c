@@ -34,7 +34,8 @@ int main(int argc, char *argv[]) {
 
   int ret;
   for (;;) {
-    adu_t adu;
+    unsigned char raw[MP3_RAW_SIZE];
+    adu_t adu = { .raw = raw };
     unsigned char len[2];
     unsigned char *ptr = len;
 
@@ -62,7 +63,7 @@ int main(int argc, char *argv[]) {
       }
       ret = write(STDOUT_FILENO, frame->raw, frame->frame_size);
       assert(ret == frame->frame_size);
-      free(frame);
+      aq_release(&qin, frame);
     }
   }
   file_close(&infile);
@@ -5,6 +5,7 @@
 #include "conf.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -20,6 +21,9 @@
 
 #include "aq.h"
 
+static mp3_frame_t *aq_slot_new(aq_t *q, mp3_frame_t *frame,
+                                unsigned long size);
+static void aq_slots_free(dlist_head_t *list);
 static void aq_discard_top_frame(aq_t *q);
 static void aq_discard_top_adu(aq_t *q);
 static void aq_enqueue_frame(aq_t *q, mp3_frame_t *frame);
@@ -30,6 +34,39 @@ static void aq_insert_dummy_adus(aq_t *q);
 static int aq_need_adu(aq_t *q);
 static void aq_make_frame(aq_t *q);
 
+/*M
+  \emph{Slot holding a frame or an ADU of the queue.}
+
+  The payload of the frame follows the slot. Slots are only freed
+  when the queue is destroyed, and grow to the largest payload they
+  held.
+**/
+typedef struct aq_slot_s {
+  /*M
+    Link in the frames, ADUs or free list of the queue, its data is
+    the frame.
+  **/
+  dlist_t       link;
+  /*M
+    Room for the payload.
+  **/
+  unsigned long size;
+  mp3_frame_t   frame;
+} aq_slot_t;
+
+/*M
+  \emph{Get the slot of a frame.}
+**/
+#define AQ_SLOT(f) ((aq_slot_t *)((char *)(f) - offsetof(aq_slot_t, frame)))
+
+/*M
+  \emph{Granularity of the payload size of a slot.}
+
+  Slots are rounded up, so that slightly longer ADUs fit into a
+  reused slot.
+**/
+#define AQ_SLOT_ROUND 256
+
 /*S
   General ADU queue functions
 **/
@@ -42,23 +79,86 @@ void aq_init(aq_t *q) {
   
   dlist_init(&q->frames);
   dlist_init(&q->adus);
+  dlist_init(&q->free);
   q->size = 0;
 }
 
 /*M
   \emph{Destroy an ADU queue structure.}
+
+  Frees the queued and released frames. Frames which have not been
+  released are lost.
 **/
 void aq_destroy(aq_t *q) {
   assert(q != NULL);
   
-  dlist_destroy(&q->frames, free);
-  dlist_destroy(&q->adus, free);
+  aq_slots_free(&q->frames);
+  aq_slots_free(&q->adus);
+  aq_slots_free(&q->free);
+  q->size = 0;
+}
+
+/*M
+  \emph{Free the slots of a list.}
+**/
+static void aq_slots_free(dlist_head_t *list) {
+  dlist_t *dlist;
+  while ((dlist = dlist_getl_front(list)) != NULL)
+    free(AQ_SLOT(dlist->data));
+}
+
+/*M
+  \emph{Get a slot for a copy of \verb|frame| with room for
+  \verb|size| bytes of payload.}
+
+  The descriptor is copied from \verb|frame|, the payload is not
+  initialized. A released slot is reused, and only grown when it is
+  too short.
+**/
+static mp3_frame_t *aq_slot_new(aq_t *q, mp3_frame_t *frame,
+                                unsigned long size) {
+  assert(q != NULL);
+  assert(frame != NULL);
+  assert(size <= MP3_RAW_SIZE);
+
+  aq_slot_t *slot = NULL;
+  dlist_t *dlist = dlist_getl_front(&q->free);
+  if (dlist != NULL)
+    slot = AQ_SLOT(dlist->data);
+
+  if ((slot == NULL) || (slot->size < size)) {
+    unsigned long room = (size + AQ_SLOT_ROUND - 1) & ~(AQ_SLOT_ROUND - 1);
+    slot = realloc(slot, sizeof(aq_slot_t) + room);
+    assert(slot != NULL);
+    slot->size = room;
+  }
+
+  slot->frame = *frame;
+  slot->frame.raw = (unsigned char *)(slot + 1);
+  slot->frame.mapped = 0;
+  slot->link.data = &slot->frame;
+  slot->link.next = slot->link.prev = NULL;
+
+  return &slot->frame;
+}
+
+/*M
+  \emph{Hand a frame or an ADU back to the queue.}
+
+  \verb|frame| has been returned by \verb|aq_get_frame| or
+  \verb|aq_get_adu|, and must not be used afterwards.
+**/
+void aq_release(aq_t *q, mp3_frame_t *frame) {
+  assert(q != NULL);
+  assert(frame != NULL);
+
+  int ret = dlist_insl_front(&q->free, &AQ_SLOT(frame)->link);
+  assert(ret);
 }
 
 /*M
   \emph{Enqueue a new frame into the ADU queue.}
-  \verb|malloc| a new MP3 frame structure and initialize it by copying
-  the content of \verb|frame|. Append the new MP3 frame structure to
+  Append \verb|frame|, allocated with \verb|aq_slot_new|, to
   the frames linked list of the ADU queue.
   Add the size of \verb|frame|'s audio data
   ($\verb|frame size| - \verb|sideinfo size| - \verb|header size|$)
@@ -68,30 +168,22 @@ static void aq_enqueue_frame(aq_t *q, mp3_frame_t *frame) {
   assert(q != NULL);
   assert(frame != NULL);
 
-  mp3_frame_t *tmp_frame = malloc(sizeof(mp3_frame_t));
-  assert(tmp_frame != NULL);
-
-  memcpy(tmp_frame, frame, sizeof(mp3_frame_t));
-
-  dlist_t *dlist = dlist_ins_end(&q->frames, tmp_frame);
-  assert(dlist != NULL);
-  q->size += tmp_frame->frame_data_size;
+  int ret = dlist_insl_end(&q->frames, &AQ_SLOT(frame)->link);
+  assert(ret);
+  q->size += frame->frame_data_size;
 }
 
 /*M
   \emph{Enqueue a new ADU into the ADU queue.}
+
+  \verb|adu| is allocated with \verb|aq_slot_new|.
 **/
 static void aq_enqueue_adu(aq_t *q, adu_t *adu) {
   assert(q   != NULL);
   assert(adu != NULL);
 
-  adu_t *tmp_adu = malloc(sizeof(adu_t));
-  assert(tmp_adu != NULL);
-
-  memcpy(tmp_adu, adu, sizeof(adu_t));
-
-  dlist_t *dlist = dlist_ins_end(&q->adus, tmp_adu);
-  assert(dlist != NULL);
+  int ret = dlist_insl_end(&q->adus, &AQ_SLOT(adu)->link);
+  assert(ret);
 }
 
 /*M
@@ -132,20 +224,28 @@ dlist_t *aq_top_adu(aq_t *q) {
 
 /*M
   \emph{Pops the front ADU off the queue.}
+
+  The ADU is handed back with \verb|aq_release|.
 **/
 adu_t *aq_get_adu(aq_t *q) {
-  return dlist_get_front(&q->adus);
+  dlist_t *dlist = dlist_getl_front(&q->adus);
+
+  return dlist ? dlist->data : NULL;
 }
 
 /*M
   \emph{Pops the front MPEG Frame off the queue.}
 
-  Recalculates the total frame data size of the queue.
+  Recalculates the total frame data size of the queue. The frame is
+  handed back with \verb|aq_release|.
 **/
 mp3_frame_t *aq_get_frame(aq_t *q) {
-  mp3_frame_t *res = dlist_get_front(&q->frames);
-  if (res)
-    q->size -= res->frame_data_size;
+  dlist_t *dlist = dlist_getl_front(&q->frames);
+  if (dlist == NULL)
+    return NULL;
+
+  mp3_frame_t *res = dlist->data;
+  q->size -= res->frame_data_size;
   
   return res;
 }
@@ -156,21 +256,18 @@ mp3_frame_t *aq_get_frame(aq_t *q) {
   Recalculates the total frame data size of the queue.
 **/
 static void aq_discard_top_frame(aq_t *q) {
-  assert(q->frames.dlist != NULL);
-  mp3_frame_t *frame = dlist_get(&q->frames, q->frames.dlist);
+  mp3_frame_t *frame = aq_get_frame(q);
   assert(frame != NULL);
-  q->size -= frame->frame_data_size;
-  free(frame);
+  aq_release(q, frame);
 }
 
 /*M
   \emph{Discard the top ADU of the queue.}
 **/
 static void aq_discard_top_adu(aq_t *q) {
-  assert(q->adus.dlist != NULL);
-  adu_t *adu = dlist_get(&q->adus, q->adus.dlist);
+  adu_t *adu = aq_get_adu(q);
   assert(adu != NULL);
-  free(adu);
+  aq_release(q, adu);
 }
 
 /*M
@@ -248,8 +345,12 @@ static void aq_make_adu(aq_t *q) {
 
   unsigned int back_ptr = tail->si.main_data_end;
 
-  adu_t adu;
-  memcpy(&adu, tail, sizeof(adu_t));
+  /*M
+    The ADU gets the header and side information of the tail frame,
+    and room for its data only.
+  **/
+  adu_t *adu = aq_slot_new(q, tail, mp3_frame_size(tail));
+  memcpy(adu->raw, tail->raw, mp3_frame_hdr_size(tail));
 
   /* get first frame containing ADU data */
   int offset = 0;
@@ -273,7 +374,7 @@ static void aq_make_adu(aq_t *q) {
 
   /* fill adu data */
   int adu_size = tail->adu_size;
-  unsigned char *adu_ptr = mp3_frame_data_begin(&adu);
+  unsigned char *adu_ptr = mp3_frame_data_begin(adu);
   while (adu_size > 0) {
     assert(dlist != NULL);
     mp3_frame_t *f = dlist->data;
@@ -294,14 +395,15 @@ static void aq_make_adu(aq_t *q) {
     offset = 0;
   }
 
-  aq_enqueue_adu(q, &adu);
+  aq_enqueue_adu(q, adu);
 }
 
 /*M
   \emph{Add a MPEG frame to the queue and generate an ADU if possible.}
 
   Returns 0 if no ADU could be generated, 1 if an ADU could be
-  generated.
+  generated. The payload of a frame of a mapped file is not copied,
+  the file has to stay open while frames are added to the queue.
 **/
 int aq_add_frame(aq_t *q, mp3_frame_t *frame) {
   assert(q != NULL);
@@ -318,7 +420,20 @@ int aq_add_frame(aq_t *q, mp3_frame_t *frame) {
 
   assert(frame->adu_size <= (frame->frame_data_size + back_ptr));
   
-  aq_enqueue_frame(q, frame);
+  /*M
+    Frames of a mapped file stay in the mapping, the ADUs are gathered
+    from there.
+  **/
+  mp3_frame_t *copy;
+  if (frame->mapped) {
+    copy = aq_slot_new(q, frame, 0);
+    copy->raw = frame->raw;
+    copy->mapped = 1;
+  } else {
+    copy = aq_slot_new(q, frame, frame->frame_size);
+    memcpy(copy->raw, frame->raw, frame->frame_size);
+  }
+  aq_enqueue_frame(q, copy);
 
   if ((size_before < back_ptr) ||
       (q->size < frame->adu_size))
@@ -430,7 +545,7 @@ B:
 
   Inserts a dummy ADU by copying the frame header and sideinfo
   information of tail ADU and zeroing out \verb|main_data_end| and the length
-  fields.
+  fields. The dummy ADU has no data.
 **/
 static void aq_insert_dummy_adu(aq_t *q, unsigned int backptr) {
   assert(q != NULL);
@@ -444,11 +559,8 @@ static void aq_insert_dummy_adu(aq_t *q, unsigned int backptr) {
   adu_t *tail = dlist->data;
   assert(tail != NULL);
 
-  adu_t *dummy = malloc(sizeof(adu_t));
-  assert(dummy != NULL);
-
-  /* structure copy */
-  *dummy = *tail;
+  adu_t *dummy = aq_slot_new(q, tail, mp3_frame_hdr_size(tail));
+  memcpy(dummy->raw, tail->raw, mp3_frame_hdr_size(tail));
 
   /* zero out backpointer and sideinfo length information */
   dummy->si.main_data_end = backptr;
@@ -465,8 +577,8 @@ static void aq_insert_dummy_adu(aq_t *q, unsigned int backptr) {
 
   dummy->adu_size = dummy->adu_bitsize = 0;
 
-  dlist_t *new = dlist_ins_before(&q->adus, dlist, dummy);
-  assert(new != NULL);
+  int ret = dlist_insl_before(&q->adus, dlist, &AQ_SLOT(dummy)->link);
+  assert(ret);
 }
 
 /*M
@@ -521,9 +633,8 @@ static void aq_make_frame(aq_t *q) {
           top->adu_size, top->frame_data_size);
 #endif
   
-  mp3_frame_t frame;
-  memcpy(&frame, top, sizeof(adu_t));
-  memset(frame.raw, 0, MP3_RAW_SIZE);
+  mp3_frame_t *frame = aq_slot_new(q, top, top->frame_size);
+  memset(frame->raw, 0, frame->frame_size);
 
   unsigned int frames_offset = 0;
   int data_end = 0;
@@ -538,12 +649,12 @@ static void aq_make_frame(aq_t *q) {
 
     int data_start = frames_offset - adu->si.main_data_end;
 
-    if (data_start > (long)frame.frame_data_size)
+    if (data_start > (long)frame->frame_data_size)
       break;
 
-    assert(data_start <= (long)frame.frame_data_size);
+    assert(data_start <= (long)frame->frame_data_size);
     
-    data_end = MIN(data_start + adu->adu_size, (long)frame.frame_data_size);
+    data_end = MIN(data_start + adu->adu_size, (long)frame->frame_data_size);
 #ifdef DEBUG
     fprintf(stderr, "data_start: %d, data_end: %d\n", data_start, data_end);
 #endif
@@ -572,7 +683,7 @@ static void aq_make_frame(aq_t *q) {
               from_offset, from_offset + data_length,
               to_offset, to_offset + data_length);
 #endif
-      memcpy(mp3_frame_data_begin(&frame) + to_offset,
+      memcpy(mp3_frame_data_begin(frame) + to_offset,
              mp3_frame_data_begin(adu) + from_offset,
              data_length);
     }
@@ -580,10 +691,10 @@ static void aq_make_frame(aq_t *q) {
     frames_offset += adu->frame_data_size;
     
     dlist = dlist->next;
-  } while (data_end < (long)frame.frame_data_size);
+  } while (data_end < (long)frame->frame_data_size);
 
   aq_discard_top_adu(q);
-  aq_enqueue_frame(q, &frame);
+  aq_enqueue_frame(q, frame);
 }
 
 /*M
@@ -634,7 +745,9 @@ int aq_add_adu(aq_t *q, adu_t *adu) {
   assert(q != NULL);
   assert(adu != NULL);
 
-  aq_enqueue_adu(q, adu);
+  adu_t *copy = aq_slot_new(q, adu, mp3_frame_size(adu));
+  memcpy(copy->raw, adu->raw, mp3_frame_size(adu));
+  aq_enqueue_adu(q, copy);
   aq_insert_dummy_adus(q);
 
   if (aq_need_adu(q)) {
@@ -653,7 +766,8 @@ int aq_add_adu(aq_t *q, adu_t *adu) {
 
 int main(int argc, char *argv[]) {
   mp3_file_t  file;
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
   aq_t        qin;
 
   char *f;
@@ -724,7 +838,8 @@ int main(int argc, char *argv[]) {
   aq_init(&qin);
   aq_init(&qout);
 
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
   while (mp3_next_frame(&in, &frame) > 0) {
     static int cin = 0;
     printf("%d in frame_size %ld, backptr %d, adu_size %ld, cksum %ld\n",
@@ -741,7 +856,7 @@ int main(int argc, char *argv[]) {
         break;
 
       if ((count++ % 25) <= 10) {
-        free(adu);
+        aq_release(&qin, adu);
         continue;
       }
 
@@ -768,10 +883,10 @@ int main(int argc, char *argv[]) {
                frame_out->adu_size,
                cksum(frame_out->raw, frame_out->frame_size));
         
-        free(frame_out);
+        aq_release(&qout, frame_out);
       }
 
-      free(adu);
+      aq_release(&qin, adu);
     }
 
     //    fgetc(stdin); 
@@ -7,10 +7,17 @@
 
 /*M
   \emph{MPEG Frame and ADU queue structure.}
+
+  The frames and ADUs are held in slots owned by the queue, which are
+  linked through a node embedded in the slot. The frames and ADUs
+  returned by \verb|aq_get_frame| and \verb|aq_get_adu| are handed
+  back with \verb|aq_release|, their slots are then reused for the
+  next frames and ADUs.
 **/
 typedef struct {
   dlist_head_t  frames;
   dlist_head_t  adus;
+  dlist_head_t  free; /* released slots */
   unsigned long size; /* total size of data in queue */
 } aq_t;
 
@@ -24,6 +31,7 @@ int aq_add_frame(aq_t *q, mp3_frame_t *frame);
 int aq_add_adu(aq_t *q, adu_t *adu);
 mp3_frame_t *aq_get_frame(aq_t *q);
 adu_t *aq_get_adu(aq_t *q);
+void aq_release(aq_t *q, mp3_frame_t *frame);
 
 dlist_t *aq_top_frame(aq_t *q);
 dlist_t *aq_tail_frame(aq_t *q);
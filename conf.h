@@ -7,6 +7,11 @@
 
 #ifdef __linux__
 #define NEED_GETOPT_H__
+#define HAVE_RECVMMSG
+#define HAVE_SENDMMSG
+#define HAVE_SO_TXTIME
+#define HAVE_UDP_SEGMENT
+#define HAVE_POSIX_FADVISE
 #endif /* linux */
 
 #ifdef __APPLE__
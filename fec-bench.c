@@ -0,0 +1,455 @@
+/*C
+  (c) 2005 bl0rg.net
+**/
+
+#include "conf.h"
+
+#ifdef NEED_GETOPT_H__
+#include <getopt.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "galois.h"
+#include "matrix.h"
+#include "fec.h"
+
+/*M
+  \emph{FEC benchmark.}
+
+  Measures the throughput of the Galois field and FEC routines over a
+  grid of FEC parameters, packet lengths and loss patterns. The
+  results are printed as a table, or with \verb|-m| as tab separated
+  lines:
+
+  \verb|name scheme k n len pattern MB/s ns/op cycles/byte|
+
+  Throughput is given in source bytes processed per second.
+**/
+
+/*M
+  \emph{Default benchmark grid.}
+**/
+static unsigned int bench_kn[][2] = {
+  { 4, 8 }, { 8, 12 }, { 16, 20 }, { 20, 25 }, { 32, 40 }, { 64, 80 },
+  { 400, 500 }
+};
+static unsigned int bench_lens[] = { 256, 1024, 4096 };
+
+#define NUM(a) (sizeof(a) / sizeof((a)[0]))
+
+/*M
+  \emph{Minimal measurement time in nsecs.}
+**/
+static double bench_min_time = 200e6;
+
+static int machine = 0;
+
+/*M
+  \emph{Loss patterns used for decoding.}
+**/
+typedef enum bench_pattern_e {
+  /*M
+    All source packets received.
+  **/
+  BENCH_NONE = 0,
+  /*M
+    One source packet lost.
+  **/
+  BENCH_ONE,
+  /*M
+    As many source packets lost as can be recovered.
+  **/
+  BENCH_MAX,
+  /*M
+    Random $k$ out of $n$ packets received, changing every group.
+  **/
+  BENCH_RANDOM
+} bench_pattern_t;
+
+static char *bench_pattern_names[] = { "none", "one", "max", "random" };
+
+static char *bench_scheme_names[] = { "vandermonde", "cauchy", "gf16" };
+
+/*M
+  \emph{Benchmark timer.}
+**/
+typedef struct bench_timer_s {
+  struct timespec ts;
+#ifdef HAVE_RDTSC
+  unsigned long long tsc;
+#endif
+} bench_timer_t;
+
+static void bench_start(bench_timer_t *timer) {
+  clock_gettime(CLOCK_MONOTONIC, &timer->ts);
+#ifdef HAVE_RDTSC
+  timer->tsc = __rdtsc();
+#endif
+}
+
+/*M
+  \emph{Get elapsed nsecs and cycles since \verb|bench_start|.}
+
+  Cycles are $-1$ if the CPU has no cycle counter.
+**/
+static double bench_stop(bench_timer_t *timer, double *cycles) {
+  struct timespec ts;
+#ifdef HAVE_RDTSC
+  *cycles = (double)(__rdtsc() - timer->tsc);
+#else
+  *cycles = -1;
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec - timer->ts.tv_sec) * 1e9 +
+    (ts.tv_nsec - timer->ts.tv_nsec);
+}
+
+/*M
+  \emph{Print a benchmark result.}
+
+  \verb|bytes| is the number of source bytes processed per operation.
+**/
+static void bench_report(char *name, char *scheme,
+                         unsigned int k, unsigned int n,
+                         unsigned int len, char *pattern,
+                         unsigned long ops, double bytes,
+                         double ns, double cycles) {
+  double ns_op = ns / ops;
+  double mbps = bytes > 0 ? (bytes * ops) / (ns / 1e9) / 1e6 : 0;
+  double cpb = ((cycles >= 0) && (bytes > 0)) ? cycles / (bytes * ops) : -1;
+
+  if (machine) {
+    printf("%s\t%s\t%u\t%u\t%u\t%s\t%.2f\t%.1f\t%.3f\n",
+           name, scheme, k, n, len, pattern, mbps, ns_op, cpb);
+  } else {
+    printf("%-17s %-11s %3u %3u %5u %-6s %9.2f MB/s %12.1f ns/op",
+           name, scheme, k, n, len, pattern, mbps, ns_op);
+    if (cpb >= 0)
+      printf(" %7.3f c/B", cpb);
+    printf("\n");
+  }
+  fflush(stdout);
+}
+
+/*M
+  \emph{Run a benchmark loop until the minimal time has elapsed.}
+
+  The body is run in batches of doubling size, and the expression
+  \verb|ns| and \verb|cycles| hold the total time.
+**/
+#define BENCH_LOOP(ops, ns, cycles, body)               \
+  {                                                     \
+    unsigned long batch = 1;                            \
+    ops = 0; ns = 0; cycles = 0;                        \
+    while (ns < bench_min_time) {                       \
+      bench_timer_t timer;                              \
+      double c__;                                       \
+      unsigned long i__;                                \
+      bench_start(&timer);                              \
+      for (i__ = 0; i__ < batch; i__++) {               \
+        body;                                           \
+      }                                                 \
+      ns += bench_stop(&timer, &c__);                   \
+      cycles = (c__ < 0) ? -1 : cycles + c__;           \
+      ops += batch;                                     \
+      batch *= 2;                                       \
+    }                                                   \
+  }
+
+/*M
+  \emph{Fill a buffer with pseudo random data.}
+**/
+static void bench_fill(gf *buf, unsigned long len) {
+  unsigned long i;
+  for (i = 0; i < len; i++)
+    buf[i] = random() & 0xff;
+}
+
+/*M
+  \emph{Benchmark \verb|gf_add_mul| with every available kernel.}
+**/
+static void bench_gf_add_mul(unsigned int len) {
+  gf *a = malloc(len), *b = malloc(len);
+  assert((a != NULL) && (b != NULL));
+  bench_fill(a, len);
+  bench_fill(b, len);
+
+  gf_kernel_t saved = gf_get_kernel();
+  gf_kernel_t kernel;
+  for (kernel = GF_KERNEL_SCALAR; kernel <= GF_KERNEL_AVX2; kernel++) {
+    if (!gf_set_kernel(kernel))
+      continue;
+
+    unsigned long ops;
+    double ns, cycles;
+    gf c = 0x53;
+    BENCH_LOOP(ops, ns, cycles, gf_add_mul(a, b, c, len));
+
+    char name[32];
+    snprintf(name, sizeof(name), "gf_add_mul/%s", gf_kernel_name(kernel));
+    bench_report(name, "-", 0, 0, len, "-", ops, len, ns, cycles);
+  }
+  gf_set_kernel(saved);
+
+  saved = gf16_get_kernel();
+  for (kernel = GF_KERNEL_SCALAR; kernel <= GF_KERNEL_AVX2; kernel++) {
+    if (!gf16_set_kernel(kernel))
+      continue;
+
+    unsigned long ops;
+    double ns, cycles;
+    gf16 c = 0x5309;
+    BENCH_LOOP(ops, ns, cycles, gf16_add_mul(a, b, c, len & ~1));
+
+    char name[32];
+    snprintf(name, sizeof(name), "gf16_add_mul/%s", gf_kernel_name(kernel));
+    bench_report(name, "-", 0, 0, len, "-", ops, len & ~1, ns, cycles);
+  }
+  gf16_set_kernel(saved);
+
+  free(a);
+  free(b);
+}
+
+/*M
+  \emph{Benchmark building and inverting matrices.}
+**/
+static void bench_matrix(unsigned int k, unsigned int n) {
+  unsigned long ops;
+  double ns, cycles;
+  unsigned int scheme;
+
+  for (scheme = 0; scheme <= FEC_SCHEME_MAX; scheme++) {
+    if (n > fec_max_n(scheme))
+      continue;
+    BENCH_LOOP(ops, ns, cycles, fec_free(fec_new_scheme(k, n, scheme)));
+    bench_report("fec_new", bench_scheme_names[scheme], k, n, 0, "-",
+                 ops, 0, ns, cycles);
+  }
+
+  /*M
+    Invert the decoding matrix for the last $k$ packets.
+  **/
+  if (n > FEC_MAX_N)
+    return;
+  fec_t *fec = fec_new(k, n);
+  gf matrix[k * k], tmp[k * k];
+  memcpy(matrix, fec->gen_matrix + (n - k) * k, k * k);
+  BENCH_LOOP(ops, ns, cycles,
+             memcpy(tmp, matrix, k * k); matrix_inv(tmp, k));
+  bench_report("matrix_inv", "-", k, n, 0, "-", ops, 0, ns, cycles);
+  fec_free(fec);
+}
+
+/*M
+  \emph{Fill \verb|idxs| with the received packet indexes for a loss
+  pattern.}
+**/
+static void bench_idxs(bench_pattern_t pattern,
+                       unsigned int k, unsigned int n,
+                       unsigned int idxs[]) {
+  unsigned int i, lost = 0;
+
+  switch (pattern) {
+  case BENCH_NONE:
+    lost = 0;
+    break;
+
+  case BENCH_ONE:
+    lost = 1;
+    break;
+
+  case BENCH_MAX:
+    lost = (n - k < k) ? n - k : k;
+    break;
+
+  case BENCH_RANDOM:
+    {
+      unsigned int perm[n];
+      for (i = 0; i < n; i++)
+        perm[i] = i;
+      for (i = 0; i < k; i++) {
+        unsigned int j = i + random() % (n - i);
+        unsigned int tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+        idxs[i] = perm[i];
+      }
+      return;
+    }
+  }
+
+  for (i = 0; i < k - lost; i++)
+    idxs[i] = lost + i;
+  for (i = 0; i < lost; i++)
+    idxs[k - lost + i] = k + i;
+}
+
+/*M
+  \emph{Benchmark encoding and decoding a FEC group.}
+**/
+static void bench_fec(unsigned int scheme,
+                      unsigned int k, unsigned int n, unsigned int len) {
+  fec_t *fec = fec_new_scheme(k, n, scheme);
+  char *name = bench_scheme_names[scheme];
+  len = fec_pad_len(fec, len);
+
+  gf *pkts = malloc(n * len), *orig = malloc(n * len);
+  assert((pkts != NULL) && (orig != NULL));
+  bench_fill(pkts, k * len);
+
+  gf *src[k], *dst[n - k];
+  unsigned int i;
+  for (i = 0; i < k; i++)
+    src[i] = pkts + i * len;
+  for (i = 0; i < n - k; i++)
+    dst[i] = pkts + (k + i) * len;
+
+  unsigned long ops;
+  double ns, cycles;
+
+  /*M
+    One call of \verb|fec_encode| for every redundant packet.
+  **/
+  BENCH_LOOP(ops, ns, cycles,
+             for (i = k; i < n; i++)
+               fec_encode(fec, src, dst[i - k], i, len));
+  bench_report("fec_encode", name, k, n, len, "-",
+               ops, (double)k * len, ns, cycles);
+
+  BENCH_LOOP(ops, ns, cycles, fec_encode_all(fec, src, dst, len));
+  bench_report("fec_encode_all", name, k, n, len, "-",
+               ops, (double)k * len, ns, cycles);
+
+  memcpy(orig, pkts, n * len);
+
+  /*M
+    Decode with each loss pattern. Lost source packets are simply
+    overwritten by the decoder. The first decode is checked.
+  **/
+  bench_pattern_t pattern;
+  for (pattern = BENCH_NONE; pattern <= BENCH_RANDOM; pattern++) {
+    unsigned int idxs[k];
+
+    bench_idxs(pattern, k, n, idxs);
+    memset(pkts, 0, k * len);
+    for (i = 0; i < k; i++)
+      if (idxs[i] < k)
+        memcpy(pkts + idxs[i] * len, orig + idxs[i] * len, len);
+    if (!fec_decode(fec, pkts, idxs, len) ||
+        memcmp(pkts, orig, k * len)) {
+      fprintf(stderr, "Decoding error: %s %u %u %u %s\n",
+              name, k, n, len, bench_pattern_names[pattern]);
+      exit(EXIT_FAILURE);
+    }
+
+    BENCH_LOOP(ops, ns, cycles,
+               bench_idxs(pattern, k, n, idxs);
+               fec_decode(fec, pkts, idxs, len));
+    bench_report("fec_decode", name, k, n, len,
+                 bench_pattern_names[pattern],
+                 ops, (double)k * len, ns, cycles);
+  }
+
+  free(pkts);
+  free(orig);
+  fec_free(fec);
+}
+
+/*M
+  \emph{Print usage information.}
+**/
+static void usage(void) {
+  fprintf(stderr, "Usage: ./fec-bench [-m] [-t msecs] [-k fec_k -n fec_n] [-l len]\n");
+  fprintf(stderr, "\t-m         : machine readable (tab separated) output\n");
+  fprintf(stderr, "\t-t msecs   : minimal time per measurement (default 200)\n");
+  fprintf(stderr, "\t-k fec_k   : only benchmark this FEC k parameter\n");
+  fprintf(stderr, "\t-n fec_n   : only benchmark this FEC n parameter\n");
+  fprintf(stderr, "\t-l len     : only benchmark this packet length\n");
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int fec_k = 0, fec_n = 0, len = 0;
+
+  int c;
+  while ((c = getopt(argc, argv, "hmt:k:n:l:")) >= 0) {
+    switch (c) {
+    case 'm':
+      machine = 1;
+      break;
+
+    case 't':
+      bench_min_time = atof(optarg) * 1e6;
+      break;
+
+    case 'k':
+      fec_k = atoi(optarg);
+      break;
+
+    case 'n':
+      fec_n = atoi(optarg);
+      break;
+
+    case 'l':
+      len = atoi(optarg);
+      break;
+
+    case 'h':
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ((fec_k != 0) || (fec_n != 0)) {
+    if ((fec_k == 0) || (fec_n <= fec_k) || (fec_n > FEC_GF16_MAX_N)) {
+      fprintf(stderr, "Need 0 < fec_k < fec_n <= %u\n", FEC_GF16_MAX_N);
+      return EXIT_FAILURE;
+    }
+    bench_kn[0][0] = fec_k;
+    bench_kn[0][1] = fec_n;
+  }
+  if (len != 0)
+    bench_lens[0] = len;
+
+  unsigned int num_kn = fec_k ? 1 : NUM(bench_kn);
+  unsigned int num_lens = len ? 1 : NUM(bench_lens);
+
+  gf_init();
+  gf16_init();
+  srandom(0);
+
+  if (!machine)
+    fprintf(stderr, "gf_add_mul kernel: %s\n", gf_kernel_name(gf_get_kernel()));
+
+  unsigned int i, j;
+  for (j = 0; j < num_lens; j++)
+    bench_gf_add_mul(bench_lens[j]);
+
+  for (i = 0; i < num_kn; i++)
+    bench_matrix(bench_kn[i][0], bench_kn[i][1]);
+
+  unsigned int scheme;
+  for (scheme = 0; scheme <= FEC_SCHEME_MAX; scheme++)
+    for (i = 0; i < num_kn; i++)
+      for (j = 0; j < num_lens; j++)
+        if (bench_kn[i][1] <= fec_max_n(scheme))
+          bench_fec(scheme, bench_kn[i][0], bench_kn[i][1], bench_lens[j]);
+
+  return EXIT_SUCCESS;
+}
+
+/*C
+**/
@@ -17,24 +17,56 @@
   \emph{Initialize a FEC group structure to hold incoming packets.}
 **/
 void fec_group_init(fec_group_t *group,
-                    unsigned char fec_k,
-                    unsigned char fec_n,
-                    unsigned char seq,
-                    unsigned long tstamp,
+                    unsigned short fec_k,
+                    unsigned short fec_n,
+                    unsigned char scheme,
+                    unsigned long seq,
+                    unsigned long long tstamp,
                     unsigned short fec_len) {
   assert(group != NULL);
+
+  unsigned char *buf = malloc(sizeof(unsigned char) * fec_n * fec_len);
+  assert(buf != NULL);
+  unsigned int *lengths = malloc(sizeof(unsigned int) * fec_n);
+  assert(lengths != NULL);
+
+  fec_group_init_buf(group, fec_k, fec_n, scheme, seq, tstamp, fec_len,
+                     buf, lengths);
+}
+
+/*M
+  \emph{Initialize a FEC group structure with caller supplied buffers.}
+
+  \verb|buf| must hold at least \verb|fec_n * fec_len| bytes and
+  \verb|lengths| at least \verb|fec_n| entries. The buffers still
+  belong to the caller, who has to release the group with
+  \verb|fec_group_clear| instead of \verb|fec_group_destroy|.
+**/
+void fec_group_init_buf(fec_group_t *group,
+                        unsigned short fec_k,
+                        unsigned short fec_n,
+                        unsigned char scheme,
+                        unsigned long seq,
+                        unsigned long long tstamp,
+                        unsigned short fec_len,
+                        unsigned char *buf,
+                        unsigned int *lengths) {
+  assert(group != NULL);
+  assert(buf != NULL);
+  assert(lengths != NULL);
   
   group->fec_k = fec_k;
   group->fec_n = fec_n;
+  group->scheme = scheme;
+  group->hdr_version = FEC_PKT_SCHEME_HDR_VERSION(scheme);
+  group->stream_id = 0;
   group->seq = seq;
   group->tstamp = tstamp;
   group->fec_len = fec_len;
   group->rcvd_pkts = 0;
 
-  group->buf = malloc(sizeof(unsigned char) * fec_n * fec_len);
-  assert(group->buf != NULL);
-  group->lengths = malloc(sizeof(unsigned int) * fec_n);
-  assert(group->lengths != NULL);
+  group->buf = buf;
+  group->lengths = lengths;
 
   /* init pointers */
   int i;
@@ -66,23 +98,49 @@ void fec_group_destroy(fec_group_t *group) {
 
 /*M
   \emph{Clear a FEC group structure.}
+
+  The buffers of the group are not freed.
 **/
 void fec_group_clear(fec_group_t *group) {
   group->buf = NULL;
   group->lengths = NULL;
 
   group->fec_k = group->fec_n = group->tstamp = 0;
+  group->scheme = 0;
+  group->hdr_version = 0;
+  group->stream_id = 0;
   group->fec_len = 0;
   group->rcvd_pkts = 0;
 }
 
+/*M
+  \emph{Check whether a FEC packet belongs to a group.}
+
+  A packet with the sequence number of the group but another stream
+  id, timestamp or FEC parameters has been sent by a restarted
+  sender. Returns 1 if the packet belongs to the group, 0 otherwise.
+**/
+int fec_group_matches(fec_group_t *group, fec_pkt_hdr_t *hdr) {
+  assert(group != NULL);
+  assert(hdr != NULL);
+
+  return ((group->seq == hdr->group_seq) &&
+          (group->stream_id == hdr->stream_id) &&
+          (group->hdr_version == FEC_PKT_GET_HDR_VERSION(hdr->version)) &&
+          (group->tstamp == hdr->group_tstamp) &&
+          (group->scheme == FEC_PKT_GET_SCHEME(hdr->version)) &&
+          (group->fec_k == hdr->fec_k) &&
+          (group->fec_n == hdr->fec_n) &&
+          (group->fec_len == hdr->fec_len));
+}
+
 /*M
   \emph{Print debug information about a FEC group.}
 **/
 void fec_group_print(fec_group_t *group) {
   assert(group != NULL);
   
-  fprintf(stderr, "Group %p tstamp: %lu\n", group, group->tstamp);
+  fprintf(stderr, "Group %p tstamp: %llu\n", group, group->tstamp);
   fprintf(stderr, "k: %d, n: %d, len: %u\n",
           group->fec_k, group->fec_n, group->fec_len);
   
@@ -100,30 +158,80 @@ void fec_group_print(fec_group_t *group) {
 }
 
 /*M
-  \emph{Insert a received FEC packet into a FEC group.}
+  \emph{Get the buffer slot for the payload of a FEC packet.}
+
+  Returns the position in the group buffer where the payload of the
+  packet with header \verb|hdr| belongs, so that it can be received
+  there directly. Returns \verb|NULL| if the payload is not needed,
+  because the packet has already been received or the group has
+  already been decoded.
 **/
-void fec_group_insert_pkt(fec_group_t *group,
-                          fec_pkt_t *pkt) {
+unsigned char *fec_group_pkt_buf(fec_group_t *group,
+                                 fec_pkt_hdr_t *hdr) {
   assert(group != NULL);
-  assert(pkt != NULL);
+  assert(hdr != NULL);
 
   /* sanity checks, no real error handling yet */
-  assert(pkt->hdr.packet_seq < group->fec_n);
-  assert(pkt->hdr.len <= group->fec_len);
+  assert(hdr->packet_seq < group->fec_n);
+  assert(hdr->len <= group->fec_len);
   /* XXX das kann passieren wenn der streamer restartet, und
      versehentlich die selbe groupseqnumber erwischt. */
-  assert(pkt->hdr.group_tstamp == group->tstamp);
+  assert(hdr->group_tstamp == group->tstamp);
+
+  if ((group->lengths[hdr->packet_seq] != 0) || group->decoded)
+    return NULL;
+
+  return group->buf + hdr->packet_seq * group->fec_len;
+}
+
+/*M
+  \emph{Account for a FEC packet whose payload is in the group buffer.}
+
+  The payload has been stored at the position returned by
+  \verb|fec_group_pkt_buf|. As soon as $k$ packets of the group have
+  been received, the missing source packets are reconstructed, so
+  that decoding does not delay the output later on.
+**/
+void fec_group_add_pkt(fec_group_t *group,
+                       fec_pkt_hdr_t *hdr) {
+  assert(group != NULL);
+  assert(hdr != NULL);
 
   /* check if packet already received */
-  if (group->lengths[pkt->hdr.packet_seq] == 0) {
-    unsigned char *ptr = group->buf + pkt->hdr.packet_seq * group->fec_len;
-    memcpy(ptr, pkt->payload, pkt->hdr.len);
-    if (pkt->hdr.len < group->fec_len) {
-      memset(ptr + pkt->hdr.len, 0, group->fec_len - pkt->hdr.len);
-    }
-    group->lengths[pkt->hdr.packet_seq] = pkt->hdr.len;
-    group->rcvd_pkts++;
+  if (group->lengths[hdr->packet_seq] != 0)
+    return;
+
+  if (!group->decoded && (hdr->len < group->fec_len)) {
+    unsigned char *ptr = group->buf + hdr->packet_seq * group->fec_len;
+    memset(ptr + hdr->len, 0, group->fec_len - hdr->len);
   }
+  group->lengths[hdr->packet_seq] = hdr->len;
+  group->rcvd_pkts++;
+
+  /*M
+    Decode eagerly when the $k$-th packet arrives.
+  **/
+  if (group->rcvd_pkts == group->fec_k)
+    fec_group_decode(group);
+}
+
+/*M
+  \emph{Insert a received FEC packet into a FEC group.}
+
+  Copies the payload into the group buffer. Packets arriving after
+  the group has been decoded are only accounted for, their payload is
+  not copied.
+**/
+void fec_group_insert_pkt(fec_group_t *group,
+                          fec_pkt_t *pkt) {
+  assert(group != NULL);
+  assert(pkt != NULL);
+
+  unsigned char *ptr = fec_group_pkt_buf(group, &pkt->hdr);
+  if (ptr != NULL)
+    memcpy(ptr, pkt->payload, pkt->hdr.len);
+
+  fec_group_add_pkt(group, &pkt->hdr);
 }
 
 /*M
@@ -158,19 +266,16 @@ int fec_group_decode(fec_group_t *group) {
 
     assert(j == group->fec_k);
 
-    /* create the fec structure. */
-    fec_t *fec = fec_new(group->fec_k, group->fec_n);
+    /* get the shared fec structure. */
+    fec_t *fec = fec_cache_get(group->fec_k, group->fec_n, group->scheme);
     assert(fec != NULL);
 
     /* decode the fec group. */
     if (!fec_decode(fec, group->buf, idxs, group->fec_len)) {
       fprintf(stderr, "Could not decode FEC group\n");
-      fec_free(fec);
       return 0;
     }
 
-    fec_free(fec);
-
     group->decoded = 1;
 
     return 1;
@@ -179,6 +284,26 @@ int fec_group_decode(fec_group_t *group) {
   }
 }
 
+/*M
+  \emph{Unpack the ADU in slot \verb|i| of the group and add it to
+  the ADU queue.}
+
+  The ADU is unpacked in place in the group buffer, the queue copies
+  its header and data only.
+**/
+static int fec_group_add_adu(fec_group_t *group, int i, aq_t *aq) {
+  adu_t adu = { .raw = group->buf + i * group->fec_len };
+
+  if (!mp3_unpack(&adu) ||
+      (mp3_frame_size(&adu) > group->fec_len)) {
+    fprintf(stderr, "Error unpacking the mp3 adu\n");
+    return 0;
+  }
+
+  aq_add_adu(aq, &adu);
+  return 1;
+}
+
 int fec_group_decode_to_adus(fec_group_t *group,
                              aq_t *aq) {
   assert(group != NULL);
@@ -189,18 +314,9 @@ int fec_group_decode_to_adus(fec_group_t *group,
       Add the adus to the adu queue.
     **/
     int i;
-    for (i = 0; i < group->fec_k; i++) {
-      adu_t adu;
-      memcpy(adu.raw,
-             group->buf + i * group->fec_len,
-             group->fec_len);
-
-      if (!mp3_unpack(&adu)) {
-        fprintf(stderr, "Error unpacking the mp3 adu\n");
+    for (i = 0; i < group->fec_k; i++)
+      if (!fec_group_add_adu(group, i, aq))
         return 0;
-      }
-      aq_add_adu(aq, &adu);
-    }
   } else {
     /*M
       We don't have enough packets in the group to recover the whole
@@ -208,21 +324,10 @@ int fec_group_decode_to_adus(fec_group_t *group,
       encoding).
     **/
     int i;
-    for (i = 0; i < group->fec_k; i++) {
-      if (group->lengths[i] > 0) {
-        adu_t adu;
-        memcpy(adu.raw,
-               group->buf + i * group->fec_len,
-               group->fec_len);
-
-        if (!mp3_unpack(&adu)) {
-          fprintf(stderr, "Error unpacking the mp3 adu\n");
-          return 0;
-        }
-
-        aq_add_adu(aq, &adu);
-      }
-    }
+    for (i = 0; i < group->fec_k; i++)
+      if ((group->lengths[i] > 0) &&
+          !fec_group_add_adu(group, i, aq))
+        return 0;
   }
 
   return 1;
@@ -274,7 +379,8 @@ int main(int argc, char *argv[]) {
   static unsigned long fec_time = 0;
   fec_t *fec = fec_new(fec_k, fec_n);
 
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
   while (mp3_next_frame(&in, &frame) > 0) {
     static int cin = 0;
     if (aq_add_frame(&qin, &frame)) {
@@ -321,7 +427,7 @@ int main(int argc, char *argv[]) {
         }
 
         fec_group_t group;
-        fec_group_init(&group, fec_k, fec_n, 0, 0, max_len);
+        fec_group_init(&group, fec_k, fec_n, 0, 0, 0, max_len);
         memset(group.buf, 0, fec_n * max_len);
 
         group.tstamp = fec_time;
@@ -356,10 +462,7 @@ int main(int argc, char *argv[]) {
 #endif
 
         for (i = 0; i < fec_k; i++) {
-          adu_t adu;
-          memcpy(adu.raw,
-                 in_adus[i]->raw,
-                 max_len);
+          adu_t adu = { .raw = in_adus[i]->raw };
           
           if (!mp3_unpack(&adu)) {
             fprintf(stderr, "Error unpacking the mp3 adu\n");
@@ -380,16 +483,16 @@ int main(int argc, char *argv[]) {
               !mp3_fill_si(frame_out) ||
               (mp3_write_frame(&out, frame_out) <= 0)) {
             fprintf(stderr, "Error writing to stdout\n");
-            free(frame_out);
+            aq_release(&qout, frame_out);
             
             return 0;
           }
           
-          free(frame_out);
+          aq_release(&qout, frame_out);
         }
 
         for (i = 0; i < fec_k; i++)
-          free(in_adus[i]);
+          aq_release(&qin, in_adus[i]);
 
         cnt = 0;
       }
@@ -17,28 +17,41 @@ typedef struct fec_group_s {
     $k$ FEC parameter. At least $k$ packets have to be collected in
     order to recover the complete source information.
   **/
-  unsigned char fec_k;
+  unsigned short fec_k;
   /*M
     $n$ FEC parameter. The group contains at least $n$ packets.
   **/
-  unsigned char fec_n;
+  unsigned short fec_n;
+  /*M
+    FEC scheme used to encode the group.
+  **/
+  unsigned char scheme;
   /*M
     The maximal length of a packet. Packets with sequence numbers <
     $k$ can be shorter.
   **/
   unsigned short fec_len;
+  /*M
+    Header version of the packets of the group.
+  **/
+  unsigned char hdr_version;
+  /*M
+    Id of the stream the group belongs to, $0$ for header versions
+    without stream id.
+  **/
+  unsigned long stream_id;
   /*M
     The group sequence number.
   **/
-  unsigned char seq;
+  unsigned long seq;
   /*M
     The group timestamp in usecs.
   **/
-  unsigned long tstamp;
+  unsigned long long tstamp;
   /*M
     Received packets count.
   **/
-  unsigned char rcvd_pkts;
+  unsigned short rcvd_pkts;
 
   /*M
     Keeps track of received packets.
@@ -56,13 +69,28 @@ typedef struct fec_group_s {
 } fec_group_t;
 
 void fec_group_init(fec_group_t *group,
-                    unsigned char fec_k,
-                    unsigned char fec_n,
-                    unsigned char seq,
-                    unsigned long tstamp,
+                    unsigned short fec_k,
+                    unsigned short fec_n,
+                    unsigned char scheme,
+                    unsigned long seq,
+                    unsigned long long tstamp,
                     unsigned short fec_len);
+void fec_group_init_buf(fec_group_t *group,
+                        unsigned short fec_k,
+                        unsigned short fec_n,
+                        unsigned char scheme,
+                        unsigned long seq,
+                        unsigned long long tstamp,
+                        unsigned short fec_len,
+                        unsigned char *buf,
+                        unsigned int *lengths);
 void fec_group_destroy(fec_group_t *group);
 void fec_group_clear(fec_group_t *group);
+int fec_group_matches(fec_group_t *group, fec_pkt_hdr_t *hdr);
+unsigned char *fec_group_pkt_buf(fec_group_t *group,
+                                 fec_pkt_hdr_t *hdr);
+void fec_group_add_pkt(fec_group_t *group,
+                       fec_pkt_hdr_t *hdr);
 void fec_group_insert_pkt(fec_group_t *group,
                           fec_pkt_t *pkt);
 int fec_group_decode(fec_group_t *group);
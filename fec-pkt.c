@@ -5,13 +5,20 @@
 #include "conf.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <netinet/in.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_UDP_SEGMENT
+#include <netinet/udp.h>
+#endif /* HAVE_UDP_SEGMENT */
+
 #include "pack.h"
 #include "fec-pkt.h"
 
@@ -24,29 +31,113 @@ void fec_pkt_init(fec_pkt_t *pkt) {
   assert(pkt != NULL);
 
   pkt->hdr.magic = FEC_PKT_MAGIC;
-  pkt->hdr.version = 1;
+  pkt->hdr.version = FEC_PKT_VERSION(0);
   pkt->hdr.len = 0;
   pkt->hdr.group_seq = 0;
-  pkt->payload = pkt->data + FEC_PKT_HDR_SIZE;
+  pkt->hdr.stream_id = 0;
+  pkt->payload = pkt->data + FEC_PKT_MAX_HDR_SIZE;
+}
+
+/*M
+  \emph{Get the size of the packed header for a version byte.}
+
+  Unknown header versions are assumed to have the size of version
+  $1$, so that their version byte can be checked by the application.
+**/
+unsigned int fec_pkt_hdr_size(unsigned char version) {
+  switch (FEC_PKT_GET_HDR_VERSION(version)) {
+  case FEC_PKT_WIDE_HDR_VERSION:
+    return FEC_PKT_WIDE_HDR_SIZE;
+  case FEC_PKT_STREAM_HDR_VERSION:
+    return FEC_PKT_STREAM_HDR_SIZE;
+  default:
+    return FEC_PKT_HDR_SIZE;
+  }
+}
+
+/*M
+  \emph{Get the distance between two group sequence numbers.}
+
+  The sequence numbers wrap around at the maximal group sequence
+  number of the header version. Returns the signed distance from
+  \verb|seq1| to \verb|seq2|.
+**/
+int fec_pkt_seq_diff(unsigned char version,
+                     unsigned long seq1, unsigned long seq2) {
+  unsigned long max = FEC_PKT_MAX_SEQ(version);
+  unsigned long diff = (seq2 - seq1) & max;
+
+  if (diff <= max / 2)
+    return (int)diff;
+  else
+    return -(int)(max - diff) - 1;
+}
+
+/*M
+  \emph{Pack a FEC packet header.}
+
+  Writes the header to \verb|dst|, which must hold
+  \verb|FEC_PKT_MAX_HDR_SIZE| bytes. Returns the size of the packed
+  header.
+**/
+unsigned int fec_pkt_pack_hdr(fec_pkt_hdr_t *hdr, unsigned char *dst) {
+  assert(hdr != NULL);
+  assert(dst != NULL);
+
+  unsigned char *ptr = dst;
+
+  UINT8_PACK(ptr, hdr->magic);
+  UINT8_PACK(ptr, hdr->version);
+  switch (FEC_PKT_GET_HDR_VERSION(hdr->version)) {
+  case FEC_PKT_STREAM_HDR_VERSION:
+    UINT32_PACK(ptr, hdr->stream_id);
+    UINT32_PACK(ptr, hdr->group_seq);
+    UINT16_PACK(ptr, hdr->packet_seq);
+    UINT16_PACK(ptr, hdr->fec_k);
+    UINT16_PACK(ptr, hdr->fec_n);
+    UINT16_PACK(ptr, hdr->fec_len);
+    UINT16_PACK(ptr, hdr->len);
+    UINT64_PACK(ptr, hdr->group_tstamp);
+    return ptr - dst;
+
+  case FEC_PKT_WIDE_HDR_VERSION:
+    UINT8_PACK(ptr, hdr->group_seq);
+    UINT16_PACK(ptr, hdr->packet_seq);
+    UINT16_PACK(ptr, hdr->fec_k);
+    UINT16_PACK(ptr, hdr->fec_n);
+    break;
+
+  default:
+    UINT8_PACK(ptr, hdr->group_seq);
+    UINT8_PACK(ptr, hdr->packet_seq);
+    UINT8_PACK(ptr, hdr->fec_k);
+    UINT8_PACK(ptr, hdr->fec_n);
+    break;
+  }
+  UINT16_PACK(ptr, hdr->fec_len);  
+  UINT16_PACK(ptr, hdr->len);
+  UINT32_PACK(ptr, hdr->group_tstamp);
+
+  return ptr - dst;
 }
 
-static void fec_pkt_pack(fec_pkt_t *pkt) {
+/*M
+  \emph{Pack the header in front of the payload.}
+
+  Returns a pointer to the start of the packed packet.
+**/
+static unsigned char *fec_pkt_pack(fec_pkt_t *pkt) {
   assert(pkt != NULL);
 
-  unsigned char *ptr = pkt->data;
+  unsigned char *start = pkt->payload - fec_pkt_hdr_size(pkt->hdr.version);
+  assert(start >= pkt->data);
 
   /*M
     Pack the header data into the data buffer.
   **/
-  UINT8_PACK(ptr, pkt->hdr.magic);
-  UINT8_PACK(ptr, pkt->hdr.version);
-  UINT8_PACK(ptr, pkt->hdr.group_seq);
-  UINT8_PACK(ptr, pkt->hdr.packet_seq);
-  UINT8_PACK(ptr, pkt->hdr.fec_k);
-  UINT8_PACK(ptr, pkt->hdr.fec_n);
-  UINT16_PACK(ptr, pkt->hdr.fec_len);  
-  UINT16_PACK(ptr, pkt->hdr.len);
-  UINT32_PACK(ptr, pkt->hdr.group_tstamp);
+  fec_pkt_pack_hdr(&pkt->hdr, start);
+
+  return start;
 }
 
 /*M
@@ -57,14 +148,156 @@ static void fec_pkt_pack(fec_pkt_t *pkt) {
 **/
 ssize_t fec_pkt_send(fec_pkt_t *pkt, int fd) {
   assert(pkt != NULL);
-  fec_pkt_pack(pkt);
-  return send(fd, pkt->data, FEC_PKT_HDR_SIZE + pkt->hdr.len, 0);
+  unsigned char *start = fec_pkt_pack(pkt);
+  return send(fd, start, (pkt->payload - start) + pkt->hdr.len, 0);
 }
 
 ssize_t fec_pkt_sendto(fec_pkt_t *pkt, int fd, struct sockaddr *to, socklen_t tolen) {
   assert(pkt != NULL);
-  fec_pkt_pack(pkt);
-  return sendto(fd, pkt->data, FEC_PKT_HDR_SIZE + pkt->hdr.len, 0, to, tolen);
+  unsigned char *start = fec_pkt_pack(pkt);
+  return sendto(fd, start, (pkt->payload - start) + pkt->hdr.len, 0, to, tolen);
+}
+
+#ifdef HAVE_UDP_SEGMENT
+/*M
+  \emph{Set once the kernel has refused segmentation offload.}
+**/
+static int fec_pkt_gso_disabled = 0;
+#endif /* HAVE_UDP_SEGMENT */
+
+/*M
+  \emph{Send a run of packed FEC packets.}
+
+  \verb|buf| holds \verb|len| bytes of packets packed back to back,
+  each \verb|seg_size| bytes long except for the last one, which can
+  be shorter. Where available, the run is handed to the kernel with
+  one \verb|sendmsg| using UDP generic segmentation offload
+  (\verb|UDP_SEGMENT|), which splits it into datagrams. If the kernel
+  refuses the run, the packets are sent one by one, and if it does
+  not support segmentation offload at all, it is not tried again.
+  Returns the number of sent packets, or -1 if the first packet could
+  not be sent.
+**/
+int fec_pkt_sendto_run(int fd, unsigned char *buf, unsigned int len,
+                       unsigned int seg_size,
+                       struct sockaddr *to, socklen_t tolen) {
+  assert(buf != NULL);
+  assert(seg_size > 0);
+
+  unsigned int cnt = (len + seg_size - 1) / seg_size;
+  assert(cnt <= FEC_PKT_GSO_MAX_SEGS);
+  assert(len <= FEC_PKT_GSO_MAX_SIZE);
+
+#ifdef HAVE_UDP_SEGMENT
+  if ((cnt > 1) && !fec_pkt_gso_disabled) {
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    /* aligned for the control message header */
+    union {
+      char buf[CMSG_SPACE(sizeof(uint16_t))];
+      struct cmsghdr align;
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = to;
+    msg.msg_namelen = tolen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size = seg_size;
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+
+    if (sendmsg(fd, &msg, 0) >= 0)
+      return cnt;
+
+    /*M
+      Buffer shortage is reported to the application, any other
+      error means the kernel or the device refused the run.
+    **/
+    if ((errno == ENOBUFS) || (errno == EAGAIN))
+      return -1;
+    if ((errno == ENOPROTOOPT) || (errno == EOPNOTSUPP) || (errno == EIO))
+      fec_pkt_gso_disabled = 1;
+  }
+#endif /* HAVE_UDP_SEGMENT */
+
+  unsigned int i;
+  for (i = 0; i < cnt; i++) {
+    unsigned int size = (i == cnt - 1) ? len - i * seg_size : seg_size;
+    if (sendto(fd, buf + i * seg_size, size, 0, to, tolen) < 0)
+      return (i == 0) ? -1 : (int)i;
+  }
+
+  return cnt;
+}
+
+/*M
+  \emph{Unpack a FEC packet header.}
+
+  Returns the size of the packed header, or 0 if the \verb|len|
+  bytes in \verb|buf| do not start with a valid header.
+**/
+static unsigned int fec_pkt_unpack_hdr(fec_pkt_hdr_t *hdr,
+                                       unsigned char *buf,
+                                       unsigned int len) {
+  assert(hdr != NULL);
+  assert(buf != NULL);
+
+  if (len < FEC_PKT_HDR_SIZE)
+    return 0;
+
+  unsigned char *ptr = buf;
+  hdr->magic = UINT8_UNPACK(ptr);
+  if (hdr->magic != FEC_PKT_MAGIC)
+    return 0;
+  hdr->version = UINT8_UNPACK(ptr);
+
+  unsigned int hdr_size = fec_pkt_hdr_size(hdr->version);
+  if (len < hdr_size)
+    return 0;
+
+  hdr->stream_id = 0;
+  switch (FEC_PKT_GET_HDR_VERSION(hdr->version)) {
+  case FEC_PKT_STREAM_HDR_VERSION:
+    hdr->stream_id = UINT32_UNPACK(ptr);
+    hdr->group_seq = UINT32_UNPACK(ptr);
+    hdr->packet_seq = UINT16_UNPACK(ptr);
+    hdr->fec_k = UINT16_UNPACK(ptr);
+    hdr->fec_n = UINT16_UNPACK(ptr);
+    hdr->fec_len = UINT16_UNPACK(ptr);
+    hdr->len = UINT16_UNPACK(ptr);
+    hdr->group_tstamp = UINT64_UNPACK(ptr);
+    return hdr_size;
+
+  case FEC_PKT_WIDE_HDR_VERSION:
+    hdr->group_seq = UINT8_UNPACK(ptr);
+    hdr->packet_seq = UINT16_UNPACK(ptr);
+    hdr->fec_k = UINT16_UNPACK(ptr);
+    hdr->fec_n = UINT16_UNPACK(ptr);
+    break;
+
+  default:
+    hdr->group_seq = UINT8_UNPACK(ptr);
+    hdr->packet_seq = UINT8_UNPACK(ptr);
+    hdr->fec_k = UINT8_UNPACK(ptr);
+    hdr->fec_n = UINT8_UNPACK(ptr);
+    break;
+  }
+  hdr->fec_len = UINT16_UNPACK(ptr);
+  hdr->len = UINT16_UNPACK(ptr);
+  hdr->group_tstamp = UINT32_UNPACK(ptr);
+
+  return hdr_size;
 }
 
 /*M
@@ -91,32 +324,154 @@ int fec_pkt_read(fec_pkt_t *pkt, int fd) {
     break;
   }
 
-  if (len < FEC_PKT_HDR_SIZE)
-    return -1;
-
   /*M
-    Unpack the header data.
+    Unpack the header data and update the payload pointer.
   **/
-  unsigned char *ptr = pkt->data;
-  pkt->hdr.magic = UINT8_UNPACK(ptr);
-  if (pkt->hdr.magic != FEC_PKT_MAGIC)
+  unsigned char *payload = fec_pkt_parse(&pkt->hdr, pkt->data, len);
+  if (payload == NULL)
     return -1;
-  pkt->hdr.version = UINT8_UNPACK(ptr);
-  pkt->hdr.group_seq = UINT8_UNPACK(ptr);
-  pkt->hdr.packet_seq = UINT8_UNPACK(ptr);
-  pkt->hdr.fec_k = UINT8_UNPACK(ptr);
-  pkt->hdr.fec_n = UINT8_UNPACK(ptr);
-  pkt->hdr.fec_len = UINT16_UNPACK(ptr);
-  pkt->hdr.len = UINT16_UNPACK(ptr);
-  pkt->hdr.group_tstamp = UINT32_UNPACK(ptr);
-
-  if (pkt->hdr.len != (len - FEC_PKT_HDR_SIZE))
+
+  pkt->payload = payload;
+
+  return 1;
+}
+
+/*M
+  \emph{Unpack a FEC packet received into a buffer.}
+
+  Unpacks the header of the \verb|len| bytes long packet in
+  \verb|buf|. Returns a pointer to the payload in \verb|buf|, or
+  \verb|NULL| if the header is invalid or the packet length does not
+  match the header.
+**/
+unsigned char *fec_pkt_parse(fec_pkt_hdr_t *hdr,
+                             unsigned char *buf,
+                             unsigned int len) {
+  unsigned int hdr_size = fec_pkt_unpack_hdr(hdr, buf, len);
+  if (hdr_size == 0)
+    return NULL;
+
+  if (hdr->len != (len - hdr_size))
+    return NULL;
+
+  return buf + hdr_size;
+}
+
+/*M
+  \emph{Read the header of the next FEC packet from a datagram socket.}
+
+  The header is only peeked at, the packet stays in the socket
+  buffer until it is read with \verb|fec_pkt_recv_payload|, so that
+  the application can choose where the payload goes, for example
+  directly into the buffer of its FEC group. An empty datagram or a
+  packet with an invalid header is read and dropped. Returns 1 on
+  success, 0 if the packet was dropped, -1 on error.
+**/
+int fec_pkt_peek_hdr(fec_pkt_hdr_t *hdr, int fd) {
+  assert(hdr != NULL);
+
+  unsigned char buf[FEC_PKT_MAX_HDR_SIZE];
+  ssize_t len = recv(fd, buf, sizeof(buf), MSG_PEEK);
+  if (len < 0)
     return -1;
 
-  /*M
-    Update the payload pointer.
-  **/
-  pkt->payload = pkt->data + FEC_PKT_HDR_SIZE;
+  if ((len == 0) || (fec_pkt_unpack_hdr(hdr, buf, len) == 0)) {
+    recv(fd, buf, sizeof(buf), 0);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*M
+  \emph{Read the payload of a peeked FEC packet.}
+
+  Reads the packet whose header has been returned by
+  \verb|fec_pkt_peek_hdr|. The header is read into a scratch buffer
+  and the payload straight into \verb|dst|, which must hold
+  \verb|hdr->len| bytes. If \verb|dst| is \verb|NULL|, the packet is
+  dropped. Returns 1 on success, -1 on error or if the packet length
+  does not match the header.
+**/
+int fec_pkt_recv_payload(fec_pkt_hdr_t *hdr, int fd, unsigned char *dst) {
+  assert(hdr != NULL);
+
+  unsigned char buf[FEC_PKT_MAX_HDR_SIZE];
+  unsigned int hdr_size = fec_pkt_hdr_size(hdr->version);
+
+  struct iovec iov[2];
+  iov[0].iov_base = buf;
+  iov[0].iov_len = hdr_size;
+  iov[1].iov_base = dst;
+  iov[1].iov_len = hdr->len;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = (dst != NULL) ? 2 : 1;
+
+  ssize_t len = recvmsg(fd, &msg, 0);
+  if (len < 0)
+    return -1;
+  if (dst == NULL)
+    return 1;
+
+  if ((len != hdr_size + hdr->len) || (msg.msg_flags & MSG_TRUNC))
+    return -1;
+
+  return 1;
+}
+
+/*M
+  \emph{Pack a FEC loss report.}
+
+  Writes the report to \verb|dst|, which must hold
+  \verb|FEC_REPORT_SIZE| bytes. Returns the size of the packed
+  report.
+**/
+unsigned int fec_report_pack(fec_report_t *report, unsigned char *dst) {
+  assert(report != NULL);
+  assert(dst != NULL);
+
+  unsigned char *ptr = dst;
+
+  UINT8_PACK(ptr, FEC_REPORT_MAGIC);
+  UINT8_PACK(ptr, FEC_REPORT_VERSION);
+  UINT32_PACK(ptr, report->stream_id);
+  UINT32_PACK(ptr, report->groups);
+  UINT32_PACK(ptr, report->rcvd_pkts);
+  UINT32_PACK(ptr, report->lost_pkts);
+  UINT32_PACK(ptr, report->lost_groups);
+
+  return ptr - dst;
+}
+
+/*M
+  \emph{Unpack a FEC loss report.}
+
+  Returns 0 if the \verb|len| bytes in \verb|buf| are not a loss
+  report, 1 on success.
+**/
+int fec_report_parse(fec_report_t *report,
+                     unsigned char *buf, unsigned int len) {
+  assert(report != NULL);
+  assert(buf != NULL);
+
+  if (len != FEC_REPORT_SIZE)
+    return 0;
+
+  unsigned char *ptr = buf;
+  report->magic = UINT8_UNPACK(ptr);
+  report->version = UINT8_UNPACK(ptr);
+  if ((report->magic != FEC_REPORT_MAGIC) ||
+      (report->version != FEC_REPORT_VERSION))
+    return 0;
+
+  report->stream_id = UINT32_UNPACK(ptr);
+  report->groups = UINT32_UNPACK(ptr);
+  report->rcvd_pkts = UINT32_UNPACK(ptr);
+  report->lost_pkts = UINT32_UNPACK(ptr);
+  report->lost_groups = UINT32_UNPACK(ptr);
 
   return 1;
 }
@@ -8,22 +8,32 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include "fec.h"
+
 #define FEC_PKT_MAX_GROUP_SEQ 255
+#define FEC_PKT_MAX_STREAM_GROUP_SEQ 0xffffffffUL
 #define FEC_PKT_MAX_PACKET_SEQ 255
 
 /*M
   \emph{Structure representing a FEC packet header.}
+
+  In the wide header (version 2), the packet sequence number and the
+  FEC parameters take 16 bits each. The stream header (version 3)
+  additionally carries a 32 bits group sequence number, the id of the
+  sending stream and a 64 bits timestamp. The stream id is $0$ in
+  the other versions.
 **/
 typedef struct fec_pkt_hdr_s {
   unsigned char  magic; /* 8 bits magic: 0xfe  */
-  unsigned char version; /* version, default 1 */
-  unsigned char group_seq; /* 8 bits group sequence number */  
-  unsigned char packet_seq; /* 8 bits packet sequence number */
-  unsigned char fec_k; /* 8 bits FEC k parameter */
-  unsigned char fec_n; /* 8 bits FEC n parameter */
+  unsigned char version; /* version, default 1 (see below) */
+  unsigned long stream_id; /* (32 bits stream id) */
+  unsigned long group_seq; /* 8 (32) bits group sequence number */  
+  unsigned short packet_seq; /* 8 (16) bits packet sequence number */
+  unsigned short fec_k; /* 8 (16) bits FEC k parameter */
+  unsigned short fec_n; /* 8 (16) bits FEC n parameter */
   unsigned short fec_len; /* 16 bits FEC block length */
   unsigned short len; /* 16 bits payload length */
-  unsigned long  group_tstamp; /* 32 bits group timestamp in usecs */
+  unsigned long long group_tstamp; /* 32 (64) bits group timestamp in usecs */
 } fec_pkt_hdr_t;
 
 /*M
@@ -35,6 +45,9 @@ typedef struct fec_pkt_hdr_s {
   \emph{Header size of a FEC packet header.}
 **/
 #define FEC_PKT_HDR_SIZE 14
+#define FEC_PKT_WIDE_HDR_SIZE 17
+#define FEC_PKT_STREAM_HDR_SIZE 28
+#define FEC_PKT_MAX_HDR_SIZE FEC_PKT_STREAM_HDR_SIZE
 
 /*M
   \emph{Maximal FEC packet payload size.}
@@ -46,22 +59,119 @@ typedef struct fec_pkt_hdr_s {
 **/
 #define FEC_PKT_MAGIC 0xfe
 
+/*M
+  \emph{FEC packet version byte.}
+
+  The lower 4 bits of the version byte hold the header version, the
+  upper 4 bits the FEC scheme used to compute the redundant packets
+  (\verb|FEC_SCHEME_*| in \verb|fec.h|). Version $1$ is the header
+  described above with the Vandermonde scheme. The \gf{2^16} scheme
+  uses the wide header version $2$, all other schemes version $1$.
+  Every scheme can also be sent with the stream header version $3$,
+  receivers accept both.
+**/
+#define FEC_PKT_HDR_VERSION 1
+#define FEC_PKT_WIDE_HDR_VERSION 2
+#define FEC_PKT_STREAM_HDR_VERSION 3
+#define FEC_PKT_SCHEME_HDR_VERSION(scheme) \
+  (((scheme) == FEC_SCHEME_GF16) ? FEC_PKT_WIDE_HDR_VERSION : FEC_PKT_HDR_VERSION)
+#define FEC_PKT_VERSION(scheme) \
+  (FEC_PKT_SCHEME_HDR_VERSION(scheme) | ((scheme) << 4))
+#define FEC_PKT_STREAM_VERSION(scheme) \
+  (FEC_PKT_STREAM_HDR_VERSION | ((scheme) << 4))
+#define FEC_PKT_GET_HDR_VERSION(version) ((version) & 0x0f)
+#define FEC_PKT_GET_SCHEME(version) (((version) >> 4) & 0x0f)
+
+/*M
+  \emph{Check that the header version of a version byte can carry its
+  scheme.}
+**/
+#define FEC_PKT_VERSION_VALID(version) \
+  ((FEC_PKT_GET_HDR_VERSION(version) == FEC_PKT_STREAM_HDR_VERSION) || \
+   (FEC_PKT_GET_HDR_VERSION(version) == \
+    FEC_PKT_SCHEME_HDR_VERSION(FEC_PKT_GET_SCHEME(version))))
+
+/*M
+  \emph{Maximal FEC $n$ parameter the header can carry.}
+**/
+#define FEC_PKT_MAX_FEC_N(version) \
+  ((FEC_PKT_GET_HDR_VERSION(version) == FEC_PKT_HDR_VERSION) ? 255 : 65535)
+
+/*M
+  \emph{Maximal group sequence number the header can carry.}
+**/
+#define FEC_PKT_MAX_SEQ(version) \
+  ((FEC_PKT_GET_HDR_VERSION(version) == FEC_PKT_STREAM_HDR_VERSION) ? \
+   FEC_PKT_MAX_STREAM_GROUP_SEQ : FEC_PKT_MAX_GROUP_SEQ)
+
 /*M
   \emph{Structure representing a FEC packet.}
+
+  When sending, the payload starts at \verb|FEC_PKT_MAX_HDR_SIZE|
+  and the header is packed right in front of it, so that the payload
+  can be filled in before the header version is known.
 **/
 typedef struct fec_pkt_s {
   fec_pkt_hdr_t hdr; /* packet header */
-  unsigned char data[FEC_PKT_SIZE]; /* packet data: header + payload */
+  /* packet data: header + payload */
+  unsigned char data[FEC_PKT_MAX_HDR_SIZE + FEC_PKT_PAYLOAD_SIZE];
   unsigned char *payload; /* pointer to payload into data */
 } fec_pkt_t;
 
+/*M
+  \emph{Maximal number of packets sent in one segmentation offload
+  run.}
+
+  Limited by the kernel (\verb|UDP_MAX_SEGMENTS|), the run also has
+  to fit into a single UDP datagram.
+**/
+#define FEC_PKT_GSO_MAX_SEGS 64
+#define FEC_PKT_GSO_MAX_SIZE 65000
+
+/*M
+  \emph{Structure representing a FEC loss report.}
+
+  Receivers send loss reports to the feedback port of the server,
+  which adapts the FEC $n$ parameter to them. A report covers a
+  window of played groups.
+**/
+typedef struct fec_report_s {
+  unsigned char magic; /* 8 bits magic: 0xfd */
+  unsigned char version; /* 8 bits report version: 1 */
+  unsigned long stream_id; /* 32 bits stream id of the groups */
+  unsigned long groups; /* 32 bits number of groups in the window */
+  unsigned long rcvd_pkts; /* 32 bits received packets */
+  unsigned long lost_pkts; /* 32 bits lost packets */
+  unsigned long lost_groups; /* 32 bits unrecoverable groups */
+} fec_report_t;
+
+#define FEC_REPORT_MAGIC 0xfd
+#define FEC_REPORT_VERSION 1
+#define FEC_REPORT_SIZE 22
+
 /*M
 **/
 
 void fec_pkt_init(/*@out@*/ fec_pkt_t *pkt);
+unsigned int fec_pkt_hdr_size(unsigned char version);
+unsigned int fec_pkt_pack_hdr(fec_pkt_hdr_t *hdr, unsigned char *dst);
+int fec_pkt_seq_diff(unsigned char version,
+                     unsigned long seq1, unsigned long seq2);
 
 ssize_t fec_pkt_send(fec_pkt_t *pkt, int fd);
 ssize_t fec_pkt_sendto(fec_pkt_t *pkt, int fd, struct sockaddr *to, socklen_t tolen);
+int fec_pkt_sendto_run(int fd, unsigned char *buf, unsigned int len,
+                       unsigned int seg_size,
+                       struct sockaddr *to, socklen_t tolen);
 int fec_pkt_read(fec_pkt_t *pkt, int fd);
+unsigned char *fec_pkt_parse(fec_pkt_hdr_t *hdr,
+                             unsigned char *buf,
+                             unsigned int len);
+int fec_pkt_peek_hdr(fec_pkt_hdr_t *hdr, int fd);
+int fec_pkt_recv_payload(fec_pkt_hdr_t *hdr, int fd, unsigned char *dst);
+
+unsigned int fec_report_pack(fec_report_t *report, unsigned char *dst);
+int fec_report_parse(fec_report_t *report,
+                     unsigned char *buf, unsigned int len);
 
 #endif /* FEC_PKT_H__ */
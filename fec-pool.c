@@ -0,0 +1,275 @@
+/*C
+  (c) 2005 bl0rg.net
+**/
+
+#include "conf.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fec-pool.h"
+
+/*M
+  \emph{Worker thread.}
+
+  Takes the oldest job not yet started, encodes it outside of the
+  lock, and marks it as done.
+**/
+static void *fec_pool_worker(void *arg) {
+  fec_pool_t *pool = arg;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while ((pool->next == NULL) && !pool->finished)
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+    if (pool->next == NULL)
+      break;
+
+    fec_job_t *job = pool->next;
+    pool->next = job->next;
+    pthread_mutex_unlock(&pool->mutex);
+
+    fec_encode_all(job->fec, job->src, job->dst, job->len);
+
+    pthread_mutex_lock(&pool->mutex);
+    job->done = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+/*M
+  \emph{Initialize an encoding pool.}
+
+  With $0$ threads, jobs are encoded synchronously by
+  \verb|fec_pool_submit|. Returns 0 if the threads could not be
+  started, 1 on success.
+**/
+int fec_pool_init(fec_pool_t *pool, unsigned int num_threads) {
+  assert(pool != NULL);
+
+  pool->head = pool->tail = pool->next = NULL;
+  pool->num_jobs = 0;
+  pool->finished = 0;
+  pool->num_threads = 0;
+  pool->threads = NULL;
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  if (num_threads == 0)
+    return 1;
+
+  pool->threads = malloc(sizeof(pthread_t) * num_threads);
+  assert(pool->threads != NULL);
+
+  for (pool->num_threads = 0;
+       pool->num_threads < num_threads;
+       pool->num_threads++) {
+    if (pthread_create(pool->threads + pool->num_threads, NULL,
+                       fec_pool_worker, pool) != 0) {
+      fec_pool_destroy(pool);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*M
+  \emph{Destroy an encoding pool.}
+
+  Waits for the worker threads to encode the already submitted jobs
+  and stops them. Jobs not fetched with \verb|fec_pool_get| are
+  dropped from the pool, their buffers still belong to the submitter.
+**/
+void fec_pool_destroy(fec_pool_t *pool) {
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->finished = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  unsigned int i;
+  for (i = 0; i < pool->num_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  if (pool->threads != NULL)
+    free(pool->threads);
+  pool->threads = NULL;
+  pool->num_threads = 0;
+
+  pool->head = pool->tail = pool->next = NULL;
+  pool->num_jobs = 0;
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->mutex);
+}
+
+/*M
+  \emph{Submit a job to the encoding pool.}
+
+  The job and its buffers must not be touched until the job is
+  returned by \verb|fec_pool_get|.
+**/
+void fec_pool_submit(fec_pool_t *pool, fec_job_t *job) {
+  assert(pool != NULL);
+  assert(job != NULL);
+
+  job->next = NULL;
+  job->done = 0;
+
+  if (pool->num_threads == 0) {
+    fec_encode_all(job->fec, job->src, job->dst, job->len);
+    job->done = 1;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->tail != NULL)
+    pool->tail->next = job;
+  else
+    pool->head = job;
+  pool->tail = job;
+  if ((pool->next == NULL) && !job->done)
+    pool->next = job;
+  pool->num_jobs++;
+
+  pthread_cond_signal(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+/*M
+  \emph{Get the oldest submitted job once it is encoded.}
+
+  Jobs are returned in submission order. If \verb|block| is set,
+  waits until the oldest job is done, else returns \verb|NULL| if it
+  is not. Returns \verb|NULL| if no job is pending.
+**/
+fec_job_t *fec_pool_get(fec_pool_t *pool, int block) {
+  assert(pool != NULL);
+
+  fec_job_t *job = NULL;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (block && (pool->head != NULL) && !pool->head->done)
+    pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+  if ((pool->head != NULL) && pool->head->done) {
+    job = pool->head;
+    pool->head = job->next;
+    if (pool->head == NULL)
+      pool->tail = NULL;
+    pool->num_jobs--;
+    job->next = NULL;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return job;
+}
+
+/*M
+  \emph{Get the number of submitted jobs not yet fetched.}
+**/
+unsigned int fec_pool_length(fec_pool_t *pool) {
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->mutex);
+  unsigned int res = pool->num_jobs;
+  pthread_mutex_unlock(&pool->mutex);
+
+  return res;
+}
+
+/*C
+**/
+
+#ifdef FEC_POOL_TEST
+#include <stdio.h>
+#include <string.h>
+
+void testit(char *name, unsigned int result, unsigned int should) {
+  if (result == should) {
+    printf("Test %s was successful\n", name);
+  } else {
+    printf("Test %s was not successful, %u should have been %u\n",
+           name, result, should);
+  }
+}
+
+#define TEST_JOBS 64
+#define TEST_K    20
+#define TEST_N    25
+#define TEST_LEN  1000
+
+int main(void) {
+  static gf bufs[TEST_JOBS][TEST_N][TEST_LEN];
+  static gf *ptrs[TEST_JOBS][TEST_N];
+  static fec_job_t jobs[TEST_JOBS];
+  gf ref[TEST_N - TEST_K][TEST_LEN];
+  gf *ref_ptrs[TEST_N - TEST_K];
+
+  fec_t *fec = fec_cache_get(TEST_K, TEST_N, FEC_SCHEME_VANDERMONDE);
+
+  unsigned int threads;
+  for (threads = 0; threads <= 4; threads += 4) {
+    fec_pool_t pool;
+    testit("fec pool init", fec_pool_init(&pool, threads), 1);
+
+    unsigned int i, j, l;
+    for (i = 0; i < TEST_JOBS; i++) {
+      for (j = 0; j < TEST_N; j++) {
+        for (l = 0; l < TEST_LEN; l++)
+          bufs[i][j][l] = (i * 7 + j * 13 + l) & 0xff;
+        ptrs[i][j] = bufs[i][j];
+      }
+
+      jobs[i].fec = fec;
+      jobs[i].src = ptrs[i];
+      jobs[i].dst = ptrs[i] + TEST_K;
+      jobs[i].len = TEST_LEN;
+      jobs[i].data = (void *)(unsigned long)i;
+    }
+
+    /*M
+      Keep a few jobs in flight, as a sending stage would.
+    **/
+    unsigned int submitted = 0, ok = 1;
+    for (i = 0; i < TEST_JOBS; i++) {
+      while ((submitted < TEST_JOBS) && (submitted < i + 8))
+        fec_pool_submit(&pool, jobs + submitted++);
+
+      fec_job_t *job = fec_pool_get(&pool, 1);
+      if ((job == NULL) || ((unsigned long)job->data != i)) {
+        ok = 0;
+        break;
+      }
+
+      for (j = 0; j < TEST_N - TEST_K; j++)
+        ref_ptrs[j] = ref[j];
+      fec_encode_all(fec, job->src, ref_ptrs, TEST_LEN);
+      if (memcmp(ref, job->dst[0], sizeof(ref)))
+        ok = 0;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "fec pool order and data (%u threads)",
+             threads);
+    testit(name, ok, 1);
+    testit("fec pool empty", fec_pool_get(&pool, 1) == NULL, 1);
+    testit("fec pool length", fec_pool_length(&pool), 0);
+
+    fec_pool_destroy(&pool);
+  }
+
+  fec_cache_destroy();
+
+  return 0;
+}
+
+#endif /* FEC_POOL_TEST */
@@ -0,0 +1,83 @@
+/*C
+  (c) 2005 bl0rg.net
+**/
+
+#ifndef FEC_POOL_H__
+#define FEC_POOL_H__
+
+#include <pthread.h>
+
+#include "fec.h"
+
+/*H
+  \subsection{FEC encoding thread pool}
+
+  Encoding the redundant packets of a FEC group is independent of all
+  other groups. The encoding pool computes groups (of one or several
+  channels) on a set of worker threads, and hands them back in the
+  order they were submitted, so that the sending stage does not have
+  to care about reordering.
+**/
+
+/*M
+  \emph{FEC encoding job.}
+
+  Encodes the $n - k$ redundant packets \verb|dst| of length
+  \verb|len| from the $k$ source packets \verb|src|, using
+  \verb|fec_encode_all|. The buffers are owned by the submitter.
+**/
+typedef struct fec_job_s {
+  fec_t *fec;
+  gf **src;
+  gf **dst;
+  unsigned int len;
+
+  /*M
+    Application data, not used by the pool.
+  **/
+  void *data;
+
+  /*M
+    Set by the pool once the job has been encoded.
+  **/
+  int done;
+  struct fec_job_s *next;
+} fec_job_t;
+
+/*M
+  \emph{FEC encoding pool.}
+**/
+typedef struct fec_pool_s {
+  pthread_t *threads;
+  unsigned int num_threads;
+
+  pthread_mutex_t mutex;
+  /*M
+    Signalled when a job is submitted or the pool is destroyed.
+  **/
+  pthread_cond_t work_cond;
+  /*M
+    Signalled when a job is done.
+  **/
+  pthread_cond_t done_cond;
+
+  /*M
+    Submitted jobs in submission order. \verb|next| is the first job
+    not yet taken by a worker.
+  **/
+  fec_job_t *head, *tail, *next;
+  unsigned int num_jobs;
+
+  int finished;
+} fec_pool_t;
+
+int fec_pool_init(fec_pool_t *pool, unsigned int num_threads);
+void fec_pool_destroy(fec_pool_t *pool);
+void fec_pool_submit(fec_pool_t *pool, fec_job_t *job);
+fec_job_t *fec_pool_get(fec_pool_t *pool, int block);
+unsigned int fec_pool_length(fec_pool_t *pool);
+
+/*C
+**/
+
+#endif /* FEC_POOL_H__ */
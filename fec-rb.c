@@ -10,169 +10,237 @@
 #include <stdlib.h>
 
 #include "fec-group.h"
+#include "fec-rb.h"
 
 /*M
-  \emph{Maximal number of elements in the ring buffer.}
-**/
-unsigned int fec_rb_size  = 0;
+  \emph{Empty the ring buffer.}
 
-/*M
-  \emph{Index of first valid element in ring buffer.}
+  The group buffers are kept for the next groups.
 **/
-static unsigned int fec_rb_start = 0;
+void fec_rb_clear(fec_rb_t *rb) {
+  assert(rb != NULL);
 
-/*M
-  \emph{Index of first invalid element in ring buffer.}
-
-**/
-static unsigned int fec_rb_end  = 0;
+  rb->start = 0;
+  rb->end   = 0;
+  rb->cnt   = 0;
 
-/*M
-  \emph{Number of elements in the ring buffer.}
-**/
-unsigned int fec_rb_cnt   = 0;
+  unsigned int i;
+  for (i = 0; i < rb->size; i++)
+    fec_group_clear(rb->groups + i);
+}
 
-/*M
-  \emph{Ring buffer array.}
-**/
-fec_group_t *fec_rb = NULL;
+void fec_rb_pop(fec_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->groups != NULL);
+  assert(rb->end != rb->start);
 
-void fec_rb_clear(void) {
-  fec_rb_start = 0;
-  fec_rb_end   = 0;
-  fec_rb_cnt   = 0;
+  /*M
+    Empty slots, left by groups of which no packet was received, are
+    not counted.
+  **/
+  if (rb->groups[rb->start].buf != NULL)
+    rb->cnt--;
 
-  int i;
-  for (i = 0; i < fec_rb_size; i++)
-    fec_group_clear(fec_rb + i);
+  fec_group_clear(rb->groups + rb->start);
+  rb->start = (rb->start + 1) % rb->size;
 }
 
-void fec_rb_pop(void) {
-  assert(fec_rb != NULL);
-  assert(fec_rb_end != fec_rb_start);
-
-  fec_group_destroy(fec_rb + fec_rb_start);
-  fec_rb_start = (fec_rb_start + 1) % fec_rb_size;
+void fec_rb_destroy(fec_rb_t *rb) {
+  assert(rb != NULL);
 
-  fec_rb_cnt--;
-}
+  if (rb->groups != NULL) {
+    fec_rb_clear(rb);
+    free(rb->groups);
+    rb->groups = NULL;
+  }
 
-void fec_rb_destroy(void) {
-  if (fec_rb != NULL) {
-    while (fec_rb_cnt)
-      fec_rb_pop();
-    
-    free(fec_rb);
-    fec_rb = NULL;
+  if (rb->slots != NULL) {
+    unsigned int i;
+    for (i = 0; i < rb->size; i++) {
+      if (rb->slots[i].buf != NULL)
+        free(rb->slots[i].buf);
+      if (rb->slots[i].lengths != NULL)
+        free(rb->slots[i].lengths);
+    }
+    free(rb->slots);
+    rb->slots = NULL;
   }
 
-  fec_rb_size = 0;
-  fec_rb_clear();
+  rb->size = 0;
 }
 
-void fec_rb_init(unsigned int size) {
-  fec_rb_destroy();
+void fec_rb_init(fec_rb_t *rb, unsigned int size) {
+  assert(rb != NULL);
+  assert(size > 1);
 
-  fec_rb = malloc(sizeof(fec_group_t) * size);
-  assert(fec_rb != NULL);
+  rb->groups = malloc(sizeof(fec_group_t) * size);
+  assert(rb->groups != NULL);
+  rb->slots = calloc(size, sizeof(fec_rb_slot_t));
+  assert(rb->slots != NULL);
 
-  int i;
-  for (i = 0; i < fec_rb_size; i++)
-    fec_group_clear(fec_rb + i);
-  
-  fec_rb_size = size;
-  fec_rb_clear();
+  unsigned int i;
+  for (i = 0; i < size; i++) {
+    rb->groups[i].pkts = NULL;
+    fec_group_clear(rb->groups + i);
+  }
+
+  rb->size = size;
+  rb->start = rb->end = rb->cnt = 0;
 }
   
-unsigned int fec_rb_length(void) {
-  assert(fec_rb != NULL);
+unsigned int fec_rb_length(fec_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->groups != NULL);
   
-  if (fec_rb_end >= fec_rb_start)
-    return fec_rb_end - fec_rb_start;
+  if (rb->end >= rb->start)
+    return rb->end - rb->start;
   else
-    return fec_rb_end + (fec_rb_size - fec_rb_start);
+    return rb->end + (rb->size - rb->start);
 }
 
-int fec_rb_insert_pkt(fec_pkt_t *pkt, int idx) {
-  assert(pkt != NULL);
-  assert(fec_rb != NULL);
+/*M
+  \emph{Make the buffers of a ring buffer element large enough for a
+  group.}
+
+  The buffers only grow, so that they are allocated once for a stream
+  whose FEC parameters do not change.
+**/
+static void fec_rb_slot_reserve(fec_rb_slot_t *slot,
+                                unsigned int fec_n,
+                                unsigned int fec_len) {
+  assert(slot != NULL);
+
+  unsigned int size = fec_n * fec_len;
+  if (slot->buf_size < size) {
+    if (slot->buf != NULL)
+      free(slot->buf);
+    slot->buf = malloc(size);
+    assert(slot->buf != NULL);
+    slot->buf_size = size;
+  }
+
+  if (slot->lengths_size < fec_n) {
+    if (slot->lengths != NULL)
+      free(slot->lengths);
+    slot->lengths = malloc(sizeof(unsigned int) * fec_n);
+    assert(slot->lengths != NULL);
+    slot->lengths_size = fec_n;
+  }
+}
+
+/*M
+  \emph{Get the group a FEC packet belongs to.}
+
+  \verb|idx| is the position of the group relative to the first group
+  in the ring buffer. The group is initialized from the packet header
+  if no packet of it has been received yet. Returns \verb|NULL| if
+  the group does not fit into the ring buffer, or if the packet does
+  not match the group buffered at its position.
+**/
+fec_group_t *fec_rb_group(fec_rb_t *rb, fec_pkt_hdr_t *hdr, int idx) {
+  assert(rb != NULL);
+  assert(hdr != NULL);
+  assert(rb->groups != NULL);
 
 #ifdef DEBUG
-  fprintf(stderr, "insert packet at idx %d, gseq %d, pseq %d\n",
-          idx, pkt->hdr.group_seq, pkt->hdr.packet_seq);
+  fprintf(stderr, "insert packet at idx %d, gseq %lu, pseq %d\n",
+          idx, hdr->group_seq, hdr->packet_seq);
 #endif
   
   if (idx < 0) {
     /* try to grow the buffer downwards */
-    if ((fec_rb_length() - idx) <= fec_rb_size) {
-      fec_rb_start = (fec_rb_start + idx) % fec_rb_size;
+    if ((fec_rb_length(rb) - idx) <= rb->size) {
+      rb->start = (rb->start + rb->size + idx) % rb->size;
       idx = 0;
     } else
       /* drop the packet silently */
-      return 0;
-  } else if (idx >= fec_rb_size - 1) {
+      return NULL;
+  } else if (idx >= (int)rb->size - 1) {
     /* not enough place left in ring buffer */
-    return 0;
+    return NULL;
   }
 
-  fec_group_t *dst_group = fec_rb + ((idx + fec_rb_start) % fec_rb_size);
+  unsigned int pos = (idx + rb->start) % rb->size;
+  fec_group_t *dst_group = rb->groups + pos;
   if (dst_group->buf != NULL) {
-    assert(dst_group->seq == pkt->hdr.group_seq);
-    fec_group_insert_pkt(dst_group, pkt);
+    /* the packet belongs to another stream than the buffered group */
+    if (!fec_group_matches(dst_group, hdr))
+      return NULL;
   } else {
     assert(dst_group->pkts == NULL);
-    fec_group_init(dst_group,
-                   pkt->hdr.fec_k,
-                   pkt->hdr.fec_n,
-                   pkt->hdr.group_seq,
-                   pkt->hdr.group_tstamp,
-                   pkt->hdr.fec_len);
-    fec_group_insert_pkt(dst_group, pkt);
-
-    fec_rb_cnt++;
+    fec_rb_slot_t *slot = rb->slots + pos;
+    fec_rb_slot_reserve(slot, hdr->fec_n, hdr->fec_len);
+    fec_group_init_buf(dst_group,
+                       hdr->fec_k,
+                       hdr->fec_n,
+                       FEC_PKT_GET_SCHEME(hdr->version),
+                       hdr->group_seq,
+                       hdr->group_tstamp,
+                       hdr->fec_len,
+                       slot->buf,
+                       slot->lengths);
+    dst_group->hdr_version = FEC_PKT_GET_HDR_VERSION(hdr->version);
+    dst_group->stream_id = hdr->stream_id;
+
+    rb->cnt++;
   }
 
 
 #ifdef DEBUG
   fprintf(stderr, "packet inserted at %d, end: %d\n",
-          (idx + fec_rb_start) % fec_rb_size,
-          fec_rb_end);
+          (idx + rb->start) % rb->size, rb->end);
 #endif
   
   /* adjust the end pointer */
-  if (idx >= fec_rb_length()) 
-    fec_rb_end = ((idx + fec_rb_start + 1) % fec_rb_size);
+  if (idx >= (int)fec_rb_length(rb))
+    rb->end = ((idx + rb->start + 1) % rb->size);
 
-  assert(fec_rb_start != fec_rb_end);
+  assert(rb->start != rb->end);
   /* XXX kann anscheinend auch passieren wenn wraparound. Generell
      muessen hier alle asserts abgefangen werden und mit einer error
      struktur sauber verarbeitet werden. */
-  assert(fec_rb[fec_rb_end].buf == NULL);
+  assert(rb->groups[rb->end].buf == NULL);
+
+  return dst_group;
+}
+
+int fec_rb_insert_pkt(fec_rb_t *rb, fec_pkt_t *pkt, int idx) {
+  assert(pkt != NULL);
+
+  fec_group_t *dst_group = fec_rb_group(rb, &pkt->hdr, idx);
+  if (dst_group == NULL)
+    return 0;
+
+  fec_group_insert_pkt(dst_group, pkt);
 
   return 1;
 }
 
-void fec_rb_print(void) {
-  assert(fec_rb != NULL);
+void fec_rb_print(fec_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->groups != NULL);
 
   fprintf(stderr, "start: %.3u, end: %.3u, len: %.3u\n",
-          fec_rb_start, fec_rb_end, fec_rb_length());
+          rb->start, rb->end, fec_rb_length(rb));
 }
 
-void fec_rb_print_rb(void) {
+void fec_rb_print_rb(fec_rb_t *rb) {
+  assert(rb != NULL);
+
   unsigned int i;
-  for (i = fec_rb_start; i != fec_rb_end; i = (i + 1) % fec_rb_size) {
-    if (fec_rb[i].buf != NULL)
-      fprintf(stderr, "%.3u: seq %.3u\n", i, fec_rb[i].seq);
+  for (i = rb->start; i != rb->end; i = (i + 1) % rb->size) {
+    if (rb->groups[i].buf != NULL)
+      fprintf(stderr, "%.3u: seq %.3lu\n", i, rb->groups[i].seq);
   }
 }
 
-fec_group_t *fec_rb_first(void) {
-  assert(fec_rb != NULL);
+fec_group_t *fec_rb_first(fec_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->groups != NULL);
 
-  if (fec_rb_start == fec_rb_end)
+  if (rb->start == rb->end)
     return NULL;
 
   /* first should always be the first in buffer */
-  return fec_rb + fec_rb_start;
+  return rb->groups + rb->start;
 }
@@ -2,19 +2,74 @@
   (c) 2005 bl0rg.net
 **/
 
-#ifndef RTP_RB_H__
-#define RTP_RB_H__
+#ifndef FEC_RB_H__
+#define FEC_RB_H__
 
-extern unsigned int fec_rb_cnt;
-extern unsigned int fec_rb_size;
+/*M
+  \emph{Buffers of a ring buffer element.}
 
-void fec_rb_clear(void);
-void fec_rb_destroy(void);
-void fec_rb_init(unsigned int size);
-unsigned int fec_rb_length(void);
-void fec_rb_pop(void);
-void fec_rb_print(void);
-int fec_rb_insert_pkt(fec_pkt_t *pkt, int idx);
-fec_group_t *fec_rb_first(void);
+  The buffers are kept when a group is popped and reused by the next
+  group stored in the element.
+**/
+typedef struct fec_rb_slot_s {
+  /*M
+    Group buffer.
+  **/
+  unsigned char *buf;
+  /*M
+    Size of the group buffer in bytes.
+  **/
+  unsigned int buf_size;
+  /*M
+    Packet length array.
+  **/
+  unsigned int *lengths;
+  /*M
+    Number of entries in the packet length array.
+  **/
+  unsigned int lengths_size;
+} fec_rb_slot_t;
+
+/*M
+  \emph{Ring buffer of FEC groups.}
+
+  Each received stream has its own ring buffer.
+**/
+typedef struct fec_rb_s {
+  /*M
+    Maximal number of elements in the ring buffer.
+  **/
+  unsigned int size;
+  /*M
+    Index of first valid element in ring buffer.
+  **/
+  unsigned int start;
+  /*M
+    Index of first invalid element in ring buffer.
+  **/
+  unsigned int end;
+  /*M
+    Number of elements in the ring buffer.
+  **/
+  unsigned int cnt;
+  /*M
+    Ring buffer array.
+  **/
+  fec_group_t *groups;
+  /*M
+    Buffers of the ring buffer elements.
+  **/
+  fec_rb_slot_t *slots;
+} fec_rb_t;
+
+void fec_rb_clear(fec_rb_t *rb);
+void fec_rb_destroy(fec_rb_t *rb);
+void fec_rb_init(fec_rb_t *rb, unsigned int size);
+unsigned int fec_rb_length(fec_rb_t *rb);
+void fec_rb_pop(fec_rb_t *rb);
+void fec_rb_print(fec_rb_t *rb);
+int fec_rb_insert_pkt(fec_rb_t *rb, fec_pkt_t *pkt, int idx);
+fec_group_t *fec_rb_group(fec_rb_t *rb, fec_pkt_hdr_t *hdr, int idx);
+fec_group_t *fec_rb_first(fec_rb_t *rb);
 
-#endif /* RTP_RB_H__ */
+#endif /* FEC_RB_H__ */
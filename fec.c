@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "fec.h"
 #include "matrix.h"
@@ -18,45 +19,35 @@
 **/
 void fec_free(fec_t *fec) {
   assert(fec != NULL);
-  assert(fec->gen_matrix != NULL);
-  free(fec->gen_matrix);
+  assert((fec->gen_matrix != NULL) || (fec->gen_matrix16 != NULL));
+
+  int i;
+  for (i = 0; i < FEC_DECODE_CACHE_SIZE; i++)
+    if (fec->decode_cache[i].matrix != NULL)
+      free(fec->decode_cache[i].matrix);
+  pthread_mutex_destroy(&fec->decode_mutex);
+
+  if (fec->gen_matrix != NULL)
+    free(fec->gen_matrix);
+  if (fec->gen_matrix16 != NULL)
+    free(fec->gen_matrix16);
   free(fec);
 }
 
 /*M
-  \emph{Initialize a FEC parameter structure.}
+  \emph{Build the Vandermonde generator matrix.}
 
-  Create a generator matrix.
+  Fills the lower $(n - k) \times k$ band of the generator matrix.
   % XXX Documentation for generator matrix
 **/
-fec_t *fec_new(unsigned int k, unsigned int n) {
-  assert((k <= n ) || "k is too big");
-  assert((k <= 256) || "k is too big");
-  assert((n <= 256) || "n is too big");
-
-  /*M
-    Init Galois arithmetic if not already initialized.
-  **/
-  static int gf_initialized = 0;
-  if (!gf_initialized) {
-    gf_init();
-    gf_initialized = 1;
-  }
-
-  fec_t *res;
-  res = malloc(sizeof(fec_t));
-  assert(res != NULL);
-  res->gen_matrix = malloc(sizeof(gf)*k*n);
-  assert(res->gen_matrix != NULL);
-
-  res->k = k;
-  res->n = n;
+static void fec_vandermonde_matrix(fec_t *fec) {
+  unsigned int k = fec->k, n = fec->n;
 
   /*M
     Fill the matrix with powers of field elements.
   **/
   gf tmp[k*n];
-  /*  gf *tmp = res->gen_matrix; */
+  /*  gf *tmp = fec->gen_matrix; */
 
   /*M
     First row is special (powers of $0$).
@@ -75,7 +66,7 @@ fec_t *fec_new(unsigned int k, unsigned int n) {
 
 #ifdef DEBUG
   fprintf(stderr, "first vandermonde matrix\n");
-  matrix_print(tmp, res->n, res->k);
+  matrix_print(tmp, fec->n, fec->k);
 #endif
 
   /*M
@@ -85,19 +76,122 @@ fec_t *fec_new(unsigned int k, unsigned int n) {
 
 #ifdef DEBUG
   fprintf(stderr, "\ninverted vandermonde matrix\n");
-  matrix_print(tmp, res->n, res->k);
+  matrix_print(tmp, fec->n, fec->k);
 #endif
 
   /*M
     Multiply the inverted upper $k \times k$ vandermonde matrix with
     the lower band of the matrix.
   **/
-  matrix_mul(tmp + k * k, tmp, res->gen_matrix + k * k, n - k, k, k);
+  matrix_mul(tmp + k * k, tmp, fec->gen_matrix + k * k, n - k, k, k);
+}
+
+/*M
+  \emph{Build the Cauchy generator matrix.}
+
+  Fills the lower $(n - k) \times k$ band of the generator matrix
+  with the Cauchy matrix $c_{ij} = 1 / (x_i + y_j)$, with $x_i = i$
+  and $y_j = n - k + j$. As the $x_i$ and $y_j$ are distinct, every
+  square submatrix of a Cauchy matrix is invertible, so any $k$
+  packets are enough to decode.
+**/
+static void fec_cauchy_matrix(fec_t *fec) {
+  unsigned int k = fec->k, r = fec->n - fec->k;
+
+  unsigned int row, col;
+  for (row = 0; row < r; row++)
+    for (col = 0; col < k; col++)
+      fec->gen_matrix[(k + row) * k + col] = GF_INV(GF_ADD(row, r + col));
+}
+
+/*M
+  \emph{Build the \gf{2^16} Cauchy generator matrix.}
+
+  Same as \verb|fec_cauchy_matrix|, $x_i$ and $y_j$ are distinct as
+  $n \le 2^{16}$.
+**/
+static void fec_gf16_matrix(fec_t *fec) {
+  unsigned int k = fec->k, r = fec->n - fec->k;
+
+  unsigned int row, col;
+  for (row = 0; row < r; row++)
+    for (col = 0; col < k; col++)
+      fec->gen_matrix16[row * k + col] = gf16_inv(GF16_ADD(row, r + col));
+}
+
+/*M
+  \emph{Initialize a FEC parameter structure.}
+
+  Create a generator matrix for the Vandermonde scheme.
+**/
+fec_t *fec_new(unsigned int k, unsigned int n) {
+  return fec_new_scheme(k, n, FEC_SCHEME_VANDERMONDE);
+}
+
+/*M
+  \emph{Initialize a FEC parameter structure for a FEC scheme.}
+
+  Create a systematic generator matrix.
+**/
+fec_t *fec_new_scheme(unsigned int k, unsigned int n, unsigned int scheme) {
+  assert((scheme <= FEC_SCHEME_MAX) || "unknown FEC scheme");
+  assert((k <= n ) || "k is too big");
+  assert((n <= fec_max_n(scheme)) || "n is too big");
+
+  /*M
+    Init Galois arithmetic if not already initialized.
+  **/
+  static int gf_initialized = 0;
+  if (!gf_initialized) {
+    gf_init();
+    gf_initialized = 1;
+  }
+
+  fec_t *res;
+  res = malloc(sizeof(fec_t));
+  assert(res != NULL);
+
+  res->k = k;
+  res->n = n;
+  res->scheme = scheme;
+  res->gen_matrix = NULL;
+  res->gen_matrix16 = NULL;
+
+  memset(res->decode_cache, 0, sizeof(res->decode_cache));
+  res->decode_clock = 0;
+  pthread_mutex_init(&res->decode_mutex, NULL);
+
+  /*M
+    The \gf{2^16} scheme only stores the redundant rows, a full
+    generator matrix would take up to 8~GB.
+  **/
+  if (scheme == FEC_SCHEME_GF16) {
+    static int gf16_initialized = 0;
+    if (!gf16_initialized) {
+      gf16_init();
+      gf16_initialized = 1;
+    }
+
+    res->gen_matrix16 = malloc(sizeof(gf16) * k * (n - k) + 1);
+    assert(res->gen_matrix16 != NULL);
+    fec_gf16_matrix(res);
+
+    return res;
+  }
+
+  res->gen_matrix = malloc(sizeof(gf)*k*n);
+  assert(res->gen_matrix != NULL);
+
+  if (scheme == FEC_SCHEME_CAUCHY)
+    fec_cauchy_matrix(res);
+  else
+    fec_vandermonde_matrix(res);
 
   /*M
     Fill the upper $k \times k$ matrix with the identity matrix to
     generate a systematic matrix.
   **/
+  unsigned int row, col;
   for (row = 0; row < k; row++)
     for (col = 0; col < k; col++)
       if (col == row)
@@ -113,6 +207,169 @@ fec_t *fec_new(unsigned int k, unsigned int n) {
   return res;
 }
 
+/*M
+  \emph{Get the length packets have to be padded to.}
+**/
+unsigned int fec_pad_len(fec_t *fec, unsigned int len) {
+  assert(fec != NULL);
+
+  if (fec->scheme == FEC_SCHEME_CAUCHY)
+    return (len + FEC_CAUCHY_ALIGN - 1) & ~(FEC_CAUCHY_ALIGN - 1);
+  else if (fec->scheme == FEC_SCHEME_GF16)
+    return (len + FEC_GF16_ALIGN - 1) & ~(FEC_GF16_ALIGN - 1);
+  else
+    return len;
+}
+
+/*M
+  \emph{Get the maximal $n$ parameter of a FEC scheme.}
+**/
+unsigned int fec_max_n(unsigned int scheme) {
+  if (scheme == FEC_SCHEME_GF16)
+    return FEC_GF16_MAX_N;
+  else
+    return FEC_MAX_N;
+}
+
+/*M
+  \emph{Cache entry for a FEC parameter structure.}
+**/
+typedef struct fec_cache_s {
+  fec_t *fec;
+  struct fec_cache_s *next;
+} fec_cache_t;
+
+/*M
+  \emph{Process-wide list of FEC parameter structures.}
+
+  Entries are never removed before \verb|fec_cache_destroy|, so the
+  returned structures can be used without reference counting.
+**/
+static fec_cache_t *fec_cache = NULL;
+static pthread_mutex_t fec_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*M
+  \emph{Get a shared FEC parameter structure.}
+
+  Building the generator matrix involves a matrix inversion and
+  multiplication. As the matrix only depends on $k$, $n$ and the FEC
+  scheme, it is built once for each combination and shared by all
+  callers (also across threads). Calling this function at startup pre-warms the
+  cache. The returned structure must not be freed with
+  \verb|fec_free|.
+**/
+fec_t *fec_cache_get(unsigned int k, unsigned int n, unsigned int scheme) {
+  fec_cache_t *entry;
+  fec_t *res = NULL;
+
+  pthread_mutex_lock(&fec_cache_mutex);
+
+  for (entry = fec_cache; entry != NULL; entry = entry->next) {
+    if ((entry->fec->k == k) && (entry->fec->n == n) &&
+        (entry->fec->scheme == scheme)) {
+      res = entry->fec;
+      break;
+    }
+  }
+
+  if (res == NULL) {
+    entry = malloc(sizeof(fec_cache_t));
+    assert(entry != NULL);
+    res = entry->fec = fec_new_scheme(k, n, scheme);
+    entry->next = fec_cache;
+    fec_cache = entry;
+  }
+
+  pthread_mutex_unlock(&fec_cache_mutex);
+
+  return res;
+}
+
+/*M
+  \emph{Free all cached FEC parameter structures.}
+
+  Must only be called when no structure returned by
+  \verb|fec_cache_get| is in use anymore.
+**/
+void fec_cache_destroy(void) {
+  pthread_mutex_lock(&fec_cache_mutex);
+
+  while (fec_cache != NULL) {
+    fec_cache_t *next = fec_cache->next;
+    fec_free(fec_cache->fec);
+    free(fec_cache);
+    fec_cache = next;
+  }
+
+  pthread_mutex_unlock(&fec_cache_mutex);
+}
+
+/*M
+  \emph{Get the length of the units blocks are taken from.}
+
+  For the Vandermonde scheme, this is the whole packet. For the
+  Cauchy scheme, a packet consists of $8$ bit planes, and a block
+  spans the same bytes of all $8$ planes.
+**/
+static unsigned int fec_unit_len(fec_t *fec, unsigned int len) {
+  if (fec->scheme == FEC_SCHEME_CAUCHY) {
+    assert(((len % FEC_CAUCHY_ALIGN) == 0) || "unaligned packet length");
+    return len / 8;
+  } else {
+    assert((fec->scheme != FEC_SCHEME_GF16) ||
+           ((len % FEC_GF16_ALIGN) == 0) || "unaligned packet length");
+    return len;
+  }
+}
+
+/*M
+  \emph{Get a coefficient of the generator matrix.}
+**/
+static unsigned int fec_coeff(fec_t *fec,
+                              unsigned int row, unsigned int col) {
+  if (fec->scheme == FEC_SCHEME_GF16) {
+    if (row < fec->k)
+      return row == col;
+    return fec->gen_matrix16[(row - fec->k) * fec->k + col];
+  } else {
+    return fec->gen_matrix[row * fec->k + col];
+  }
+}
+
+/*M
+  \emph{Computes $a = a + c * b$ on a block of a packet.}
+
+  The block spans the bytes \verb|off| to \verb|off + blen| of each
+  unit of packets of length \verb|len|.
+**/
+static void fec_add_mul(fec_t *fec, gf *a, gf *b, unsigned int c,
+                        unsigned int len,
+                        unsigned int off, unsigned int blen) {
+  if (fec->scheme == FEC_SCHEME_CAUCHY) {
+    if (c != 0)
+      gf_add_mul_planes(a, b, c, len / 8, off, blen);
+  } else if (fec->scheme == FEC_SCHEME_GF16) {
+    gf16_add_mul(a + off, b + off, c, blen);
+  } else {
+    gf_add_mul(a + off, b + off, c, blen);
+  }
+}
+
+/*M
+  \emph{Zero a block of a packet.}
+**/
+static void fec_zero(fec_t *fec, gf *a,
+                     unsigned int len,
+                     unsigned int off, unsigned int blen) {
+  if (fec->scheme == FEC_SCHEME_CAUCHY) {
+    int r;
+    for (r = 0; r < 8; r++)
+      bzero(a + r * (len / 8) + off, blen * sizeof(gf));
+  } else {
+    bzero(a + off, blen * sizeof(gf));
+  }
+}
+
 /*M
   \emph{Produce encoded output packet.}
 
@@ -128,15 +385,106 @@ void fec_encode(fec_t *fec,
   if (idx < fec->k) {
     memcpy(dst, src[idx], len * sizeof(gf));
   } else {
-    gf *p = fec->gen_matrix + idx * fec->k;
+    unsigned int unit = fec_unit_len(fec, len);
 
-    bzero(dst, len * sizeof(gf));
+    fec_zero(fec, dst, len, 0, unit);
     unsigned int i;
     for (i = 0; i < fec->k; i++)
-      gf_add_mul(dst, src[i], p[i], len);
+      fec_add_mul(fec, dst, src[i], fec_coeff(fec, idx, i), len, 0, unit);
   }
 }
 
+/*M
+  \emph{Working set size for \verb|fec_encode_all|.}
+
+  The redundant packets are computed in blocks, so that the blocks of
+  all $n - k$ output packets fit into this many bytes of (L1) cache.
+**/
+#define FEC_ENCODE_CACHE_SIZE 16384
+
+/*M
+  \emph{Produce all redundant output packets.}
+
+  Encodes the $n - k$ redundant packets (with indexes $k, \dots, n -
+  1$) from the \verb|k| data packets in \verb|src| into \verb|dst|,
+  which holds $n - k$ buffers of \verb|len| bytes. The packets with
+  index $<$ \verb|k| are the source packets themselves (systematic
+  matrix).
+
+  Calling \verb|fec_encode| for each redundant packet reads the
+  source packets $n - k$ times. Here the packets are processed in
+  blocks small enough for the output blocks to stay in cache, so
+  that each source byte is read from memory only once.
+**/
+void fec_encode_all(fec_t *fec,
+                    gf *src[], gf *dst[],
+                    unsigned int len) {
+  assert(fec != NULL);
+
+  unsigned int r = fec->n - fec->k;
+  if (r == 0)
+    return;
+
+  /*M
+    The \gf{2^16} multiplication sets up its tables on every call, so
+    blocks are kept large enough to amortize that.
+  **/
+  unsigned int unit = fec_unit_len(fec, len);
+  unsigned int min_block = (fec->scheme == FEC_SCHEME_GF16) ? 1024 : 64;
+  unsigned int block = (FEC_ENCODE_CACHE_SIZE / r / (len / unit)) & ~63U;
+  if (block < min_block)
+    block = min_block;
+
+  unsigned int off;
+  for (off = 0; off < unit; off += block) {
+    unsigned int blen = (unit - off < block) ? (unit - off) : block;
+
+    unsigned int j;
+    for (j = 0; j < r; j++)
+      fec_zero(fec, dst[j], len, off, blen);
+
+    /*M
+      Add each source block to all output blocks while it is in cache.
+    **/
+    unsigned int i;
+    for (i = 0; i < fec->k; i++)
+      for (j = 0; j < r; j++)
+        fec_add_mul(fec, dst[j], src[i], fec_coeff(fec, fec->k + j, i),
+                    len, off, blen);
+  }
+}
+
+/*M
+  \emph{Add a source packet to the redundant packets.}
+
+  Adds the contribution of the source packet \verb|src| with index
+  \verb|idx| and length \verb|len| to the $n - k$ redundant packets
+  in \verb|dst|, which have to be zeroed before the first source
+  packet is added. As shorter source packets are implicitly padded
+  with zeros, the redundant packets can be accumulated while the
+  source packets arrive, before the length of the longest packet is
+  known. Once all $k$ source packets have been added, \verb|dst|
+  holds the same data as after \verb|fec_encode_all|.
+
+  Does not work for the Cauchy scheme, as its bit planes depend on
+  the final packet length. For the \gf{2^16} scheme, \verb|len| has
+  to be padded to an even length.
+**/
+void fec_encode_add(fec_t *fec,
+                    gf *src, gf *dst[],
+                    unsigned int idx, unsigned int len) {
+  assert(fec != NULL);
+  assert((fec->scheme != FEC_SCHEME_CAUCHY) ||
+         "incremental encoding does not work with the Cauchy scheme");
+  assert((idx < fec->k) || "Index of source packet to high");
+
+  unsigned int unit = fec_unit_len(fec, len);
+  unsigned int j;
+  for (j = 0; j < fec->n - fec->k; j++)
+    fec_add_mul(fec, dst[j], src, fec_coeff(fec, fec->k + j, idx),
+                len, 0, unit);
+}
+
 /*M
   \emph{Builds the decoding matrix.}
 
@@ -170,7 +518,9 @@ int fec_decode_matrix(fec_t *fec,
 /*M
   \emph{Put straight packets at the right place.}
 
-  Packets with index $<$ k are put at the right place.
+  Packets with index $<$ k are put at the right place. The remaining
+  (redundant) packets are sorted by index, so that the decoding
+  matrix only depends on the set of received packets.
 **/
 static int fec_shuffle(fec_t *fec, unsigned int idxs[]) {
   unsigned int i;
@@ -190,9 +540,228 @@ static int fec_shuffle(fec_t *fec, unsigned int idxs[]) {
     }
   }
 
+  /*M
+    Insertion sort of the redundant packet indexes, there are at most
+    $n - k$ of them.
+  **/
+  for (i = 0; i < fec->k; i++) {
+    if (idxs[i] < fec->k)
+      continue;
+
+    unsigned int j;
+    for (j = i + 1; j < fec->k; j++) {
+      if ((idxs[j] >= fec->k) && (idxs[j] < idxs[i])) {
+        unsigned int tmp = idxs[i];
+        idxs[i] = idxs[j];
+        idxs[j] = tmp;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/*M
+  \emph{Get the decoding matrix for the shuffled indexes.}
+
+  Looks up the decoding matrix in the LRU cache of \verb|fec|, and
+  builds and caches it if it is not present. The matrix is copied
+  into \verb|matrix|.
+
+  Returns 0 on error, 1 on success.
+**/
+static int fec_get_decode_matrix(fec_t *fec,
+                                 gf *matrix,
+                                 unsigned int idxs[]) {
+  unsigned char rcvd[256 / 8];
+  memset(rcvd, 0, sizeof(rcvd));
+
+  unsigned int i;
+  for (i = 0; i < fec->k; i++)
+    rcvd[idxs[i] / 8] |= 1 << (idxs[i] % 8);
+
+  unsigned int size = fec->k * fec->k * sizeof(gf);
+
+  pthread_mutex_lock(&fec->decode_mutex);
+
+  fec_decode_cache_t *entry, *lru = fec->decode_cache;
+  for (i = 0; i < FEC_DECODE_CACHE_SIZE; i++) {
+    entry = fec->decode_cache + i;
+    if ((entry->matrix != NULL) &&
+        !memcmp(entry->rcvd, rcvd, sizeof(rcvd))) {
+      entry->last_use = ++fec->decode_clock;
+      memcpy(matrix, entry->matrix, size);
+      pthread_mutex_unlock(&fec->decode_mutex);
+      return 1;
+    }
+
+    if ((lru->matrix != NULL) &&
+        ((entry->matrix == NULL) || (entry->last_use < lru->last_use)))
+      lru = entry;
+  }
+
+  pthread_mutex_unlock(&fec->decode_mutex);
+
+  /*M
+    Not cached, invert the matrix outside of the lock.
+  **/
+  if (!fec_decode_matrix(fec, matrix, idxs))
+    return 0;
+
+  pthread_mutex_lock(&fec->decode_mutex);
+  if (lru->matrix == NULL) {
+    lru->matrix = malloc(size);
+    assert(lru->matrix != NULL);
+  }
+  memcpy(lru->rcvd, rcvd, sizeof(rcvd));
+  memcpy(lru->matrix, matrix, size);
+  lru->last_use = ++fec->decode_clock;
+  pthread_mutex_unlock(&fec->decode_mutex);
+
+  return 1;
+}
+
+/*M
+  \emph{Invert a $n \times n$ matrix over \gf{2^16}.}
+
+  Gauss-Jordan elimination in place. Returns 0 if the matrix is
+  singular, 1 on success.
+**/
+static int fec_gf16_matrix_inv(gf16 *m, unsigned int n) {
+  gf16 *inv = malloc(sizeof(gf16) * n * n);
+  assert(inv != NULL);
+  memset(inv, 0, sizeof(gf16) * n * n);
+
+  unsigned int i, j, col;
+  for (i = 0; i < n; i++)
+    inv[i * n + i] = 1;
+
+  for (col = 0; col < n; col++) {
+    /*M
+      Find a pivot and swap it into place.
+    **/
+    for (i = col; i < n; i++)
+      if (m[i * n + col] != 0)
+        break;
+    if (i == n) {
+      free(inv);
+      return 0;
+    }
+
+    if (i != col) {
+      for (j = 0; j < n; j++) {
+        gf16 tmp = m[i * n + j];
+        m[i * n + j] = m[col * n + j];
+        m[col * n + j] = tmp;
+        tmp = inv[i * n + j];
+        inv[i * n + j] = inv[col * n + j];
+        inv[col * n + j] = tmp;
+      }
+    }
+
+    /*M
+      Normalize the pivot row and eliminate the column from all other
+      rows.
+    **/
+    gf16 c = gf16_inv(m[col * n + col]);
+    for (j = 0; j < n; j++) {
+      m[col * n + j] = gf16_mul(c, m[col * n + j]);
+      inv[col * n + j] = gf16_mul(c, inv[col * n + j]);
+    }
+
+    for (i = 0; i < n; i++) {
+      gf16 f = m[i * n + col];
+      if ((i == col) || (f == 0))
+        continue;
+
+      unsigned int lf = gf16_logs[f];
+      for (j = 0; j < n; j++) {
+        if (m[col * n + j] != 0)
+          m[i * n + j] ^= gf16_exps[lf + gf16_logs[m[col * n + j]]];
+        if (inv[col * n + j] != 0)
+          inv[i * n + j] ^= gf16_exps[lf + gf16_logs[inv[col * n + j]]];
+      }
+    }
+  }
+
+  memcpy(m, inv, sizeof(gf16) * n * n);
+  free(inv);
+
   return 1;
 }
 
+/*M
+  \emph{Decode the received packets of the \gf{2^16} scheme.}
+
+  With $e$ lost source packets, inverting the $k \times k$ decoding
+  matrix would be too expensive for large blocks. Instead, the
+  contribution of the received source packets is removed from the
+  $e$ received redundant packets $p_i$, which leaves a system with
+  the $e \times e$ Cauchy submatrix $C$ of the lost columns:
+  \[s_{l_q} = \sum_i C^{-1}_{qi} \left(p_i + \sum_{j\ \mathrm{received}}
+  c_{p_i j} s_j\right)\]
+  Only $C$ is inverted, the packet data is traversed $e \cdot k$
+  times as with the full decoding matrix.
+
+  \verb|idxs| has to be shuffled. Returns 0 on error, 1 on success.
+**/
+static int fec_decode_gf16(fec_t *fec,
+                           gf *pkts,
+                           unsigned int idxs[], unsigned len) {
+  unsigned int k = fec->k, e = 0;
+  unsigned int unit = fec_unit_len(fec, len);
+  unsigned int row, col, i, q;
+
+  unsigned int *lost = malloc(sizeof(unsigned int) * k);
+  assert(lost != NULL);
+  for (row = 0; row < k; row++)
+    if (idxs[row] >= k)
+      lost[e++] = row;
+
+  /*M
+    \verb|m[i][q]| is the coefficient of lost packet $l_q$ in the
+    redundant packet received in its place.
+  **/
+  gf16 *m = malloc(sizeof(gf16) * e * e);
+  assert(m != NULL);
+  for (i = 0; i < e; i++)
+    for (q = 0; q < e; q++)
+      m[i * e + q] = fec_coeff(fec, idxs[lost[i]], lost[q]);
+
+  if (!fec_gf16_matrix_inv(m, e)) {
+    free(lost);
+    free(m);
+    return 0;
+  }
+
+  /*M
+    Remove the received source packets from the redundant packets.
+  **/
+  gf *tmp = malloc(e * len);
+  assert(tmp != NULL);
+  for (i = 0; i < e; i++) {
+    unsigned int idx = idxs[lost[i]];
+    memcpy(tmp + i * len, pkts + idx * len, len);
+    for (col = 0; col < k; col++)
+      if (idxs[col] < k)
+        gf16_add_mul(tmp + i * len, pkts + col * len,
+                     fec_coeff(fec, idx, col), unit);
+  }
+
+  for (q = 0; q < e; q++) {
+    gf *pkt = pkts + lost[q] * len;
+
+    memset(pkt, 0, len);
+    for (i = 0; i < e; i++)
+      gf16_add_mul(pkt, tmp + i * len, m[q * e + i], unit);
+  }
+
+  free(lost);
+  free(m);
+  free(tmp);
+
+  return 1;
+}
 
 /*M
   \emph{Decode the received packets.}
@@ -208,22 +777,36 @@ int fec_decode(fec_t *fec,
     return 0;
 
   /*M
-    Build decoding matrix.
+    If all source packets have been received, there is nothing to do.
+  **/
+  unsigned int i;
+  for (i = 0; i < fec->k; i++)
+    if (idxs[i] != i)
+      break;
+  if (i == fec->k)
+    return 1;
+
+  if (fec->scheme == FEC_SCHEME_GF16)
+    return fec_decode_gf16(fec, pkts, idxs, len);
+
+  /*M
+    Get decoding matrix.
   **/
   gf dec_matrix[fec->k * fec->k];
-  if (!fec_decode_matrix(fec, dec_matrix, idxs))
+  if (!fec_get_decode_matrix(fec, dec_matrix, idxs))
     return 0;
 
+  unsigned int unit = fec_unit_len(fec, len);
   unsigned int row;
   for (row = 0; row < fec->k; row++) {
     if (idxs[row] >= fec->k) {
       gf *pkt = pkts + row * len;
       
-      bzero(pkt, len * sizeof(gf));
+      fec_zero(fec, pkt, len, 0, unit);
       unsigned int col;
       for (col = 0; col < fec->k; col++) {
-        gf_add_mul(pkt, pkts + idxs[col] * len,
-                   dec_matrix[row * fec->k + col], len);
+        fec_add_mul(fec, pkt, pkts + idxs[col] * len,
+                    dec_matrix[row * fec->k + col], len, 0, unit);
       }
     }
   }
@@ -284,6 +867,144 @@ int main(void) {
     for (j = 0; j < 4; j++)
       testit("fec decode", dst_pkts[i * 4 + j], src_pkts[i][j]);
   }
+
+  /*M
+    Compare \verb|fec_encode_all| with \verb|fec_encode| on packets
+    longer than one encoding block.
+  **/
+  fec_t *fec2 = fec_new(20, 25);
+  static gf big_src[20][5000], big_dst[5][5000], big_ref[5000];
+  gf *big_src_ptrs[20], *big_dst_ptrs[5];
+  for (i = 0; i < 20; i++) {
+    int j;
+    for (j = 0; j < 5000; j++)
+      big_src[i][j] = (i * 31 + j * 7) & 0xff;
+    big_src_ptrs[i] = big_src[i];
+  }
+  for (i = 0; i < 5; i++)
+    big_dst_ptrs[i] = big_dst[i];
+
+  fec_encode_all(fec2, big_src_ptrs, big_dst_ptrs, 5000);
+  for (i = 0; i < 5; i++) {
+    fec_encode(fec2, big_src_ptrs, big_ref, 20 + i, 5000);
+    testit("fec encode all", memcmp(big_ref, big_dst[i], 5000), 0);
+  }
+
+  /*M
+    Accumulate the redundant packets source by source.
+  **/
+  static gf big_acc[5][5000];
+  gf *big_acc_ptrs[5];
+  for (i = 0; i < 5; i++)
+    big_acc_ptrs[i] = big_acc[i];
+  for (i = 0; i < 20; i++)
+    fec_encode_add(fec2, big_src[i], big_acc_ptrs, i, 5000);
+  testit("fec encode add", memcmp(big_acc, big_dst, sizeof(big_acc)), 0);
+  fec_free(fec2);
+
+  /*M
+    Decode the same loss pattern twice (the second time with a cached
+    matrix), and with the indexes in a different order.
+  **/
+  fec2 = fec_new(20, 25);
+  static gf big_pkts[25 * 5000];
+  for (i = 0; i < 3; i++) {
+    int j;
+    for (j = 0; j < 20; j++)
+      memcpy(big_pkts + j * 5000, big_src[j], 5000);
+    for (j = 0; j < 5; j++)
+      memcpy(big_pkts + (20 + j) * 5000, big_dst[j], 5000);
+    memset(big_pkts + 3 * 5000, 0, 5000);
+    memset(big_pkts + 17 * 5000, 0, 5000);
+
+    unsigned int big_idxs[20];
+    int k = 0;
+    for (j = 0; j < 25; j++)
+      if ((j != 3) && (j != 17) && (j != 21) && (j != 22) && (j != 24))
+        big_idxs[k++] = j;
+    if (i == 2) {
+      unsigned int tmp = big_idxs[18];
+      big_idxs[18] = big_idxs[19];
+      big_idxs[19] = tmp;
+    }
+
+    testit("fec decode cached", fec_decode(fec2, big_pkts, big_idxs, 5000), 1);
+    testit("fec decode cached", memcmp(big_pkts + 3 * 5000, big_src[3], 5000), 0);
+    testit("fec decode cached", memcmp(big_pkts + 17 * 5000, big_src[17], 5000), 0);
+  }
+  fec_free(fec2);
+
+  /*M
+    Encode and decode using the Cauchy scheme.
+  **/
+  fec2 = fec_new_scheme(20, 25, FEC_SCHEME_CAUCHY);
+  testit("fec cauchy pad", fec_pad_len(fec2, 4997), 5000);
+  fec_encode_all(fec2, big_src_ptrs, big_dst_ptrs, 5000);
+  for (i = 0; i < 5; i++) {
+    fec_encode(fec2, big_src_ptrs, big_ref, 20 + i, 5000);
+    testit("fec cauchy encode all", memcmp(big_ref, big_dst[i], 5000), 0);
+  }
+  for (i = 0; i < 20; i++)
+    memcpy(big_pkts + i * 5000, big_src[i], 5000);
+  for (i = 0; i < 5; i++)
+    memcpy(big_pkts + (20 + i) * 5000, big_dst[i], 5000);
+  for (i = 0; i < 5; i++)
+    memset(big_pkts + (i * 4) * 5000, 0, 5000);
+  unsigned int cauchy_idxs[20] = { 1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15,
+                                   17, 18, 19, 20, 21, 22, 23, 24 };
+  testit("fec cauchy decode",
+         fec_decode(fec2, big_pkts, cauchy_idxs, 5000), 1);
+  for (i = 0; i < 20; i++)
+    testit("fec cauchy decode",
+           memcmp(big_pkts + i * 5000, big_src[i], 5000), 0);
+  fec_free(fec2);
+
+  /*M
+    Encode and decode a block of more than 256 packets using the
+    \gf{2^16} scheme, losing 30 source and 10 redundant packets.
+  **/
+  fec2 = fec_new_scheme(300, 340, FEC_SCHEME_GF16);
+  testit("fec gf16 pad", fec_pad_len(fec2, 63), 64);
+  static gf wide_pkts[340 * 64], wide_ref[340 * 64], wide_acc[40 * 64];
+  gf *wide_src_ptrs[300], *wide_dst_ptrs[40], *wide_acc_ptrs[40];
+  for (i = 0; i < 300 * 64; i++)
+    wide_ref[i] = (i * 13 + i / 64) & 0xff;
+  for (i = 0; i < 300; i++)
+    wide_src_ptrs[i] = wide_ref + i * 64;
+  for (i = 0; i < 40; i++) {
+    wide_dst_ptrs[i] = wide_ref + (300 + i) * 64;
+    wide_acc_ptrs[i] = wide_acc + i * 64;
+  }
+  fec_encode_all(fec2, wide_src_ptrs, wide_dst_ptrs, 64);
+  fec_encode(fec2, wide_src_ptrs, wide_pkts, 321, 64);
+  testit("fec gf16 encode all", memcmp(wide_pkts, wide_dst_ptrs[21], 64), 0);
+  for (i = 0; i < 300; i++)
+    fec_encode_add(fec2, wide_src_ptrs[i], wide_acc_ptrs, i, 64);
+  testit("fec gf16 encode add",
+         memcmp(wide_acc, wide_ref + 300 * 64, sizeof(wide_acc)), 0);
+
+  memcpy(wide_pkts, wide_ref, sizeof(wide_pkts));
+  unsigned int wide_idxs[300];
+  int wide_k = 0;
+  for (i = 0; i < 340; i++) {
+    if ((i < 300) && ((i % 10) == 3)) {
+      memset(wide_pkts + i * 64, 0, 64);
+      continue;
+    }
+    if ((i >= 300) && ((i % 4) == 1))
+      continue;
+    wide_idxs[wide_k++] = i;
+  }
+  testit("fec gf16 idxs", wide_k, 300);
+  testit("fec gf16 decode", fec_decode(fec2, wide_pkts, wide_idxs, 64), 1);
+  testit("fec gf16 decode", memcmp(wide_pkts, wide_ref, 300 * 64), 0);
+  fec_free(fec2);
+
+  testit("fec cache", fec_cache_get(20, 25, 0) == fec_cache_get(20, 25, 0), 1);
+  testit("fec cache", fec_cache_get(20, 25, 0) != fec_cache_get(20, 30, 0), 1);
+  testit("fec cache", fec_cache_get(20, 25, 0) != fec_cache_get(20, 25, 1), 1);
+  testit("fec cache", fec_cache_get(20, 30, 0)->n, 30);
+  fec_cache_destroy();
   
   fec_free(fec);
   
@@ -5,7 +5,62 @@
 #ifndef FEC_H__
 #define FEC_H__
 
+#include <pthread.h>
+
 #include "galois.h"
+#include "galois16.h"
+
+/*M
+  \emph{FEC schemes.}
+
+  \verb|FEC_SCHEME_VANDERMONDE| is the code by Luigi Rizzo, computing
+  the redundant packets with table driven \gf{2^8}
+  multiplications. \verb|FEC_SCHEME_CAUCHY| uses a Cauchy matrix
+  expanded to a bit matrix, so that encoding and decoding only need
+  \verb|XOR|s. Packet lengths have to be a multiple of
+  \verb|FEC_CAUCHY_ALIGN| for the Cauchy scheme.
+
+  Both schemes compute in \gf{2^8}, so $n$ is at most
+  \verb|FEC_MAX_N|. \verb|FEC_SCHEME_GF16| uses a Cauchy matrix over
+  \gf{2^16} for blocks of up to \verb|FEC_GF16_MAX_N| packets, packet
+  lengths have to be even.
+**/
+#define FEC_SCHEME_VANDERMONDE 0
+#define FEC_SCHEME_CAUCHY      1
+#define FEC_SCHEME_GF16        2
+#define FEC_SCHEME_MAX         FEC_SCHEME_GF16
+
+#define FEC_CAUCHY_ALIGN 8
+#define FEC_GF16_ALIGN   2
+
+#define FEC_MAX_N      256
+#define FEC_GF16_MAX_N 65535
+
+/*M
+  \emph{Number of cached decoding matrices per FEC parameter structure.}
+**/
+#define FEC_DECODE_CACHE_SIZE 16
+
+/*M
+  \emph{Cached decoding matrix.}
+
+  The decoding matrix only depends on which packets of a group have
+  been received, which is stored as a bitmap of packet indexes.
+**/
+typedef struct fec_decode_cache_s {
+  /*M
+    Bitmap of the received packet indexes.
+  **/
+  unsigned char rcvd[256 / 8];
+  /*M
+    Inverted $k \times k$ decoding matrix, \verb|NULL| if unused.
+  **/
+  gf *matrix;
+  /*M
+    Time of last use, for LRU replacement.
+  **/
+  unsigned long last_use;
+} fec_decode_cache_t;
 
 /*M
   \emph{FEC parameter structure.}
@@ -19,17 +74,48 @@ typedef struct fec_s {
   **/  
   unsigned int k, n;
   /*M
-    Linear block code generator matrix.
+    FEC scheme.
+  **/
+  unsigned int scheme;
+  /*M
+    Linear block code generator matrix, \verb|NULL| for the
+    \gf{2^16} scheme.
   **/
   gf *gen_matrix; 
+  /*M
+    Lower $(n - k) \times k$ band of the generator matrix for the
+    \gf{2^16} scheme, \verb|NULL| otherwise. The upper band is the
+    identity matrix.
+  **/
+  gf16 *gen_matrix16;
+
+  /*M
+    LRU cache of decoding matrices, protected by \verb|decode_mutex|
+    as FEC parameter structures are shared between threads.
+  **/
+  fec_decode_cache_t decode_cache[FEC_DECODE_CACHE_SIZE];
+  unsigned long decode_clock;
+  pthread_mutex_t decode_mutex;
 } fec_t;
 
 void fec_free(fec_t *fec);
 fec_t *fec_new(unsigned int k, unsigned int n);
+fec_t *fec_new_scheme(unsigned int k, unsigned int n, unsigned int scheme);
+unsigned int fec_pad_len(fec_t *fec, unsigned int len);
+unsigned int fec_max_n(unsigned int scheme);
+
+fec_t *fec_cache_get(unsigned int k, unsigned int n, unsigned int scheme);
+void fec_cache_destroy(void);
 
 void fec_encode(fec_t *fec,
                 gf *src[], gf *dst,
                 unsigned int idx, unsigned int len);
+void fec_encode_all(fec_t *fec,
+                    gf *src[], gf *dst[],
+                    unsigned int len);
+void fec_encode_add(fec_t *fec,
+                    gf *src, gf *dst[],
+                    unsigned int idx, unsigned int len);
 int fec_decode(fec_t *fec,
                gf *buf,
                unsigned int idxs[], unsigned len);
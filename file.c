@@ -6,6 +6,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -13,47 +14,219 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "file.h"
 #include "misc.h"
 
+/*M
+  \emph{Fill the read-ahead buffer.}
+
+  Reads at most \verb|FILE_BUF_SIZE| bytes with one system call, a
+  pipe returns the bytes available so far. Returns the number of bytes
+  read, 0 at the end of the file and -1 on error.
+**/
+static int file_fill(file_t *file) {
+  assert(file->buf_pos == file->buf_len);
+
+  file->buf_pos = file->buf_len = 0;
+
+  for (;;) {
+    ssize_t res = read(file->fd, file->buf, FILE_BUF_SIZE);
+    if (res < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      perror("read");
+      return -1;
+    }
+
+    file->buf_len = res;
+    return res;
+  }
+}
+
 /*M
   \emph{Read and retry on interrupted system calls.}
+
+  Reads exactly \verb|size| bytes through the read-ahead buffer.
+  Returns \verb|size|, 0 at the end of the file and -1 on error. Reads
+  larger than the buffer bypass it.
 **/ 
 int file_read(file_t *file, unsigned char *buf, size_t size) {
   assert(file != NULL);
   assert(buf != NULL);
   assert(size > 0);
 
-  int res = unix_read(file->fd, buf, size);
-  if (res > 0) {
-    file->pos += res;
+  if (file->map != NULL) {
+    if (file->size - file->pos < size) {
+      file->pos = file->size;
+      return 0;
+    }
+
+    memcpy(buf, file->map + file->pos, size);
+    file->pos += size;
+    return size;
+  }
+
+  if (file->buf == NULL) {
+    int res = unix_read(file->fd, buf, size);
+    if (res > 0) {
+      file->pos += res;
+    }
+    return res;
+  }
+
+  size_t len = 0;
+  while (len < size) {
+    if (file->buf_pos == file->buf_len) {
+      if (size - len >= FILE_BUF_SIZE) {
+        int res = unix_read(file->fd, buf + len, size - len);
+        if (res <= 0)
+          return res;
+        len += res;
+        break;
+      }
+
+      int res = file_fill(file);
+      if (res <= 0)
+        return res;
+    }
+
+    size_t n = file->buf_len - file->buf_pos;
+    if (n > size - len)
+      n = size - len;
+    memcpy(buf + len, file->buf + file->buf_pos, n);
+    file->buf_pos += n;
+    len += n;
   }
-  return res;
+
+  file->pos += size;
+  return size;
+}
+
+/*M
+  \emph{Get the next \verb|size| bytes of the file in place.}
+
+  Returns a pointer into the mapping or into the read-ahead buffer
+  without advancing the read position, or \verb|NULL| if the file has
+  less than \verb|size| bytes left or \verb|size| is larger than the
+  buffer. The buffered bytes are moved to the front of the buffer and
+  topped up as needed, so that a pointer into the buffer is only
+  valid until the next read, peek or seek. Bytes in the mapping stay
+  valid until the file is closed.
+**/
+unsigned char *file_peek(file_t *file, size_t size) {
+  assert(file != NULL);
+
+  if (file->map != NULL) {
+    if (file->size - file->pos < size)
+      return NULL;
+    return file->map + file->pos;
+  }
+
+  if ((file->buf == NULL) || (size > FILE_BUF_SIZE))
+    return NULL;
+
+  if (file->buf_len - file->buf_pos < size) {
+    memmove(file->buf, file->buf + file->buf_pos,
+            file->buf_len - file->buf_pos);
+    file->buf_len -= file->buf_pos;
+    file->buf_pos = 0;
+
+    while (file->buf_len < size) {
+      ssize_t res = read(file->fd, file->buf + file->buf_len,
+                         FILE_BUF_SIZE - file->buf_len);
+      if (res < 0) {
+        if ((errno == EINTR) || (errno == EAGAIN))
+          continue;
+        perror("read");
+        return NULL;
+      }
+      if (res == 0)
+        return NULL;
+      file->buf_len += res;
+    }
+  }
+
+  return file->buf + file->buf_pos;
+}
+
+/*M
+  \emph{Number of bytes that can be peeked without reading.}
+
+  These are the bytes left in the mapping, or in the read-ahead
+  buffer.
+**/
+size_t file_avail(file_t *file) {
+  assert(file != NULL);
+
+  if (file->map != NULL)
+    return file->size - file->pos;
+  if (file->buf != NULL)
+    return file->buf_len - file->buf_pos;
+  return 0;
 }
 
 /*M
   \emph{Seek forward in the file.}
+
+  Skips the buffered bytes first. If the file cannot seek, such as
+  standard input, the bytes are read and dropped.
 **/
 int file_seek_fwd(file_t *file, size_t size) {
-  if (lseek(file->fd, size, SEEK_CUR) < 0)
-    return 0;
-  else {
-    file->pos += size;
+  assert(file != NULL);
+
+  if (file->map != NULL) {
+    if (file->size - file->pos < size)
+      file->pos = file->size;
+    else
+      file->pos += size;
     return 1;
   }
+
+  size_t skip = size;
+  if (file->buf != NULL) {
+    size_t n = file->buf_len - file->buf_pos;
+    if (n > skip)
+      n = skip;
+    file->buf_pos += n;
+    skip -= n;
+  }
+
+  if ((skip > 0) && (lseek(file->fd, skip, SEEK_CUR) < 0)) {
+    if ((errno != ESPIPE) || (file->buf == NULL))
+      return 0;
+
+    while (skip > 0) {
+      int res = file_fill(file);
+      if (res <= 0)
+        return 0;
+      file->buf_pos = (skip < (size_t)res) ? skip : (size_t)res;
+      skip -= file->buf_pos;
+    }
+  }
+
+  file->pos += size;
+  return 1;
 }
 
 /*M
   \emph{Open a file.}
 
   Return 0 on error, 1 on success. To read from STDIN, call with "-"
-  as filename.
+  as filename. A regular file is mapped, other files are read through
+  a read-ahead buffer. The kernel is told that the file is read
+  sequentially.
 **/
 int file_open_read(file_t *file, char *filename) {
   assert(file != NULL);
   assert(filename != NULL);
 
+  file->buf = NULL;
+  file->map = NULL;
+  file->offset = 0;
+  file->pos = 0;
+
   if (strcmp(filename, "-") == 0) {
     /* read from stdin */
     file->fd   = STDIN_FILENO;
@@ -67,14 +240,42 @@ int file_open_read(file_t *file, char *filename) {
     }
 
     struct stat sb;
-    if (stat(filename, &sb) < 0) {
+    if (fstat(file->fd, &sb) < 0) {
       perror("stat");
+      close(file->fd);
       return 0;
     }
     file->size = (unsigned long)sb.st_size;
+
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    /*M
+      The mapping is private and writable, so that frames returned in
+      place can be modified like frames read into a buffer.
+    **/
+    if (S_ISREG(sb.st_mode) && (file->size > 0)) {
+      void *map = mmap(NULL, file->size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, file->fd, 0);
+      if (map != MAP_FAILED) {
+        file->map = map;
+#ifdef MADV_SEQUENTIAL
+        madvise(map, file->size, MADV_SEQUENTIAL);
+#endif
+        return 1;
+      }
+    }
   }
 
-  file->offset = 0;
+  void *buf;
+  if (posix_memalign(&buf, FILE_BUF_ALIGN, FILE_BUF_SIZE) != 0) {
+    fprintf(stderr, "Could not allocate the read buffer\n");
+    file_close(file);
+    return 0;
+  }
+  file->buf = buf;
+  file->buf_pos = file->buf_len = 0;
 
   return 1;
 }
@@ -96,6 +297,9 @@ int file_open_write(file_t *file, char *filename) {
   assert(file != NULL);
   assert(filename != NULL);
 
+  file->buf = NULL;
+  file->map = NULL;
+
   if (!strcmp(filename, "-"))
     /* write to stdout */
     file->fd = STDOUT_FILENO;
@@ -122,6 +326,13 @@ int file_open_write(file_t *file, char *filename) {
 int file_close(file_t *file) {
   assert(file != NULL);
 
+  free(file->buf);
+  file->buf = NULL;
+  if (file->map != NULL) {
+    munmap(file->map, file->size);
+    file->map = NULL;
+  }
+
   if (file->fd != STDIN_FILENO) {
     if (close(file->fd) < 0) {
       perror("close");
@@ -14,6 +14,13 @@
 #define EEOF (-1)
 #define ESYNC (-2)
 
+/*M
+  \emph{Size and alignment of the read-ahead buffer of a file opened
+  for reading.}
+**/
+#define FILE_BUF_SIZE  (64 * 1024)
+#define FILE_BUF_ALIGN 4096
+
 typedef struct file_s {
   /*M
     File descriptor.
@@ -29,12 +36,27 @@ typedef struct file_s {
   unsigned long size;
   unsigned short maxsync;
   unsigned long pos;
+  /*M
+    Read-ahead buffer, \verb|buf_pos| is the position of the next
+    byte to read in the buffer, \verb|buf_len| the number of bytes in
+    the buffer. \verb|NULL| for files opened for writing.
+  **/
+  unsigned char *buf;
+  size_t buf_pos, buf_len;
+  /*M
+    Mapping of a regular file opened for reading, \verb|pos| is the
+    read position in the mapping. \verb|NULL| if the file is read
+    through the buffer.
+  **/
+  unsigned char *map;
 } file_t;
 
 int file_open_read(file_t *file, char *filename);
 int file_open_write(file_t *file, char *filename);
 int file_close(file_t *file);
 int file_read(file_t *file, unsigned char *buf, size_t size);
+unsigned char *file_peek(file_t *file, size_t size);
+size_t file_avail(file_t *file);
 int file_seek_fwd(file_t *file, size_t size);
 int file_write(file_t *file, unsigned char *buf, size_t size);
 
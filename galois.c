@@ -4,8 +4,23 @@
   Based on an implementation by Luigi Rizzo
 **/
 
+#include "conf.h"
+
+#include <string.h>
+
 #include "galois.h"
 
+/*M
+  The SIMD kernels are compiled using function target attributes, so
+  that no global compiler flags are needed and the binary still runs
+  on CPUs without SSSE3. Define \verb|GF_NO_SIMD| to disable them.
+**/
+#if !defined(GF_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define GF_SIMD
+#include <immintrin.h>
+#endif
+
 /*M
   \emph{Polynomial representation of field elements.}
 **/
@@ -26,6 +41,17 @@ gf gf_mul[256][256] = { { 0 } };
 **/
 gf gf_inv[256] = { 0 };
 
+/*M
+  \emph{Precomputed split-nibble multiplication tables.}
+**/
+gf gf_mul_lo[256][16] = { { 0 } };
+gf gf_mul_hi[256][16] = { { 0 } };
+
+/*M
+  \emph{Precomputed bit matrices.}
+**/
+gf gf_bitmatrix[256][8] = { { 0 } };
+
 /*M
   \emph{A primitive polynomial.}
 
@@ -118,19 +144,226 @@ void gf_init(void) {
   gf_inv[1] = 1;
   for (i = 2; i < 256; i++)
     gf_inv[i] = gf_polys[255 - gf_logs[i]];
+
+  /*M
+    Compute split-nibble tables.
+  **/
+  for (i = 0; i < 256; i++) {
+    int j;
+    for (j = 0; j < 16; j++) {
+      gf_mul_lo[i][j] = gf_mul[i][j];
+      gf_mul_hi[i][j] = gf_mul[i][j << 4];
+    }
+  }
+
+  /*M
+    Compute bit matrices, column $s$ is $c \cdot 2^s$.
+  **/
+  for (i = 0; i < 256; i++) {
+    int r, s;
+    for (r = 0; r < 8; r++) {
+      gf_bitmatrix[i][r] = 0;
+      for (s = 0; s < 8; s++)
+        if (gf_mul[i][1 << s] & (1 << r))
+          gf_bitmatrix[i][r] |= 1 << s;
+    }
+  }
+
+  /*M
+    Choose the fastest \verb|gf_add_mul| supported by the CPU.
+  **/
+  if (!gf_set_kernel(GF_KERNEL_AVX2) &&
+      !gf_set_kernel(GF_KERNEL_SSSE3))
+    gf_set_kernel(GF_KERNEL_SCALAR);
 }
 
 /*M
   \emph{Computes addition of a row multiplied by a constant.}
 
   Computes $a = a + c * b$, $a, b \in \gf{2^8}^k, c \in \gf{2^8}$.
+  This is the reference implementation, used for CPUs without SIMD
+  support and for the tail of the SIMD kernels.
 **/
-void gf_add_mul(gf *a, gf *b, gf c, int k) {
+void gf_add_mul_scalar(gf *a, gf *b, gf c, int k) {
   int i;
   for (i = 0; i < k; i++)
     a[i] = GF_ADD(a[i], GF_MUL(c, b[i]));
 }
 
+#ifdef GF_SIMD
+/*M
+  \emph{SSSE3 version of \verb|gf_add_mul|.}
+
+  Processes 16 bytes at a time, using \verb|pshufb| to look up the
+  products of the low and high nibbles.
+**/
+__attribute__((target("ssse3")))
+static void gf_add_mul_ssse3(gf *a, gf *b, gf c, int k) {
+  __m128i lo   = _mm_loadu_si128((__m128i *)gf_mul_lo[c]);
+  __m128i hi   = _mm_loadu_si128((__m128i *)gf_mul_hi[c]);
+  __m128i mask = _mm_set1_epi8(0x0f);
+
+  int i;
+  for (i = 0; i + 16 <= k; i += 16) {
+    __m128i x = _mm_loadu_si128((__m128i *)(b + i));
+    __m128i p = _mm_xor_si128(
+      _mm_shuffle_epi8(lo, _mm_and_si128(x, mask)),
+      _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+    __m128i y = _mm_loadu_si128((__m128i *)(a + i));
+    _mm_storeu_si128((__m128i *)(a + i), _mm_xor_si128(y, p));
+  }
+
+  gf_add_mul_scalar(a + i, b + i, c, k - i);
+}
+
+/*M
+  \emph{AVX2 version of \verb|gf_add_mul|.}
+
+  Processes 32 bytes at a time, the shuffle tables are broadcast to
+  both 128 bit lanes.
+**/
+__attribute__((target("avx2")))
+static void gf_add_mul_avx2(gf *a, gf *b, gf c, int k) {
+  __m256i lo   = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128((__m128i *)gf_mul_lo[c]));
+  __m256i hi   = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128((__m128i *)gf_mul_hi[c]));
+  __m256i mask = _mm256_set1_epi8(0x0f);
+
+  int i;
+  for (i = 0; i + 32 <= k; i += 32) {
+    __m256i x = _mm256_loadu_si256((__m256i *)(b + i));
+    __m256i p = _mm256_xor_si256(
+      _mm256_shuffle_epi8(lo, _mm256_and_si256(x, mask)),
+      _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(x, 4),
+                                               mask)));
+    __m256i y = _mm256_loadu_si256((__m256i *)(a + i));
+    _mm256_storeu_si256((__m256i *)(a + i), _mm256_xor_si256(y, p));
+  }
+
+  gf_add_mul_scalar(a + i, b + i, c, k - i);
+}
+#endif /* GF_SIMD */
+
+/*M
+  \emph{Currently used \verb|gf_add_mul| implementation.}
+**/
+static gf_kernel_t gf_kernel = GF_KERNEL_SCALAR;
+static void (*gf_add_mul_fn)(gf *a, gf *b, gf c, int k) = gf_add_mul_scalar;
+
+/*M
+  \emph{Select the \verb|gf_add_mul| implementation.}
+
+  Returns 0 if the kernel is not supported by the CPU (or not
+  compiled in), 1 on success.
+**/
+int gf_set_kernel(gf_kernel_t kernel) {
+  switch (kernel) {
+  case GF_KERNEL_SCALAR:
+    gf_add_mul_fn = gf_add_mul_scalar;
+    break;
+
+#ifdef GF_SIMD
+  case GF_KERNEL_SSSE3:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("ssse3"))
+      return 0;
+    gf_add_mul_fn = gf_add_mul_ssse3;
+    break;
+
+  case GF_KERNEL_AVX2:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2"))
+      return 0;
+    gf_add_mul_fn = gf_add_mul_avx2;
+    break;
+#endif /* GF_SIMD */
+
+  default:
+    return 0;
+  }
+
+  gf_kernel = kernel;
+  return 1;
+}
+
+/*M
+  \emph{Get the currently used \verb|gf_add_mul| implementation.}
+**/
+gf_kernel_t gf_get_kernel(void) {
+  return gf_kernel;
+}
+
+/*M
+  \emph{Get the name of a \verb|gf_add_mul| implementation.}
+**/
+const char *gf_kernel_name(gf_kernel_t kernel) {
+  switch (kernel) {
+  case GF_KERNEL_SCALAR:
+    return "scalar";
+  case GF_KERNEL_SSSE3:
+    return "ssse3";
+  case GF_KERNEL_AVX2:
+    return "avx2";
+  default:
+    return "unknown";
+  }
+}
+
+/*M
+  \emph{Computes addition of two rows.}
+
+  Computes $a = a + b$ using 8 byte words, $a, b \in \gf{2^8}^k$.
+**/
+void gf_xor(gf *a, gf *b, int k) {
+  int i;
+  for (i = 0; i + 8 <= k; i += 8) {
+    unsigned long long x, y;
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    x ^= y;
+    memcpy(a + i, &x, 8);
+  }
+
+  for (; i < k; i++)
+    a[i] ^= b[i];
+}
+
+/*M
+  \emph{Computes addition of a bit-plane row multiplied by a constant.}
+
+  \verb|a| and \verb|b| consist of $8$ planes of \verb|plane_len|
+  bytes each. Computes $a = a + c * b$ on the bytes \verb|off| to
+  \verb|off + k| of every plane, using only \verb|XOR|s: plane $r$
+  of the result is the sum of the planes $s$ of \verb|b| with bit $s$
+  of \verb|gf_bitmatrix[c][r]| set.
+**/
+void gf_add_mul_planes(gf *a, gf *b, gf c, int plane_len, int off, int k) {
+  int r;
+  for (r = 0; r < 8; r++) {
+    gf mask = gf_bitmatrix[c][r];
+
+    int s;
+    for (s = 0; mask != 0; s++, mask >>= 1)
+      if (mask & 1)
+        gf_xor(a + r * plane_len + off, b + s * plane_len + off, k);
+  }
+}
+
+/*M
+  \emph{Computes addition of a row multiplied by a constant.}
+
+  Computes $a = a + c * b$, $a, b \in \gf{2^8}^k, c \in \gf{2^8}$,
+  using the implementation chosen by \verb|gf_init|. Multiplication
+  by $0$ is a no-op.
+**/
+void gf_add_mul(gf *a, gf *b, gf c, int k) {
+  if (c == 0)
+    return;
+
+  gf_add_mul_fn(a, b, c, k);
+}
+
 /*C
 **/
 
@@ -164,6 +397,38 @@ int main(void) {
          GF_MUL(GF_MUL(b, b), c));
   testit("b * b^-1 = 1", GF_MUL(b, GF_INV(b)), 1);
 
+  /*M
+    Compare the SIMD kernels with the scalar reference, using an odd
+    length to exercise the tails.
+  **/
+  gf src[1027], ref[1027], dst[1027];
+  int i;
+  for (i = 0; i < (int)sizeof(src); i++)
+    src[i] = (i * 7 + 13) & 0xff;
+
+  gf_kernel_t kernel;
+  for (kernel = GF_KERNEL_SSSE3; kernel <= GF_KERNEL_AVX2; kernel++) {
+    if (!gf_set_kernel(kernel)) {
+      printf("Kernel %s not supported, skipping\n", gf_kernel_name(kernel));
+      continue;
+    }
+
+    int ok = 1, j;
+    for (j = 0; j < 256; j++) {
+      memset(ref, j, sizeof(ref));
+      memset(dst, j, sizeof(dst));
+      gf_add_mul_scalar(ref, src, j, sizeof(src));
+      gf_add_mul(dst, src, j, sizeof(dst));
+      if (memcmp(ref, dst, sizeof(ref)))
+        ok = 0;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s gf_add_mul = scalar gf_add_mul",
+             gf_kernel_name(kernel));
+    testit(name, ok, 1);
+  }
+
   return 0;
 }
 
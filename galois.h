@@ -187,6 +187,20 @@
   \gf{2^8}. Multiplications are done using lookup, division can be
   done using logarithm table, substraction and addition is \verb|XOR|.
 
+  The inner loop of FEC encoding and decoding is
+  \verb|gf_add_mul|. Besides the table driven scalar version, there
+  are SSSE3 and AVX2 versions which split every byte into two
+  nibbles, and look up the products of both nibbles with 16 byte
+  shuffle tables. As multiplication distributes over addition,
+  $c \cdot x = c \cdot x_{lo} + c \cdot (x_{hi} \ll 4)$. The best
+  version supported by the CPU is chosen at runtime by \verb|gf_init|.
+
+  Multiplication by a constant $c$ is a linear map over \gf{2}, and
+  can be written as a $8 \times 8$ bit matrix. When a packet is split
+  into $8$ planes, plane $s$ holding bit $s$ of every element,
+  multiplication by $c$ only needs \verb|XOR|s of whole planes
+  (\verb|gf_add_mul_planes|). This is used by the Cauchy FEC scheme.
+
 **/
 
 /*M
@@ -216,8 +230,40 @@ extern gf gf_mul[256][256];
 **/
 extern gf gf_inv[256];
 
+/*M
+  \emph{Precomputed split-nibble multiplication tables.}
+
+  \verb|gf_mul_lo[c][x]| is $c \cdot x$, \verb|gf_mul_hi[c][x]| is
+  $c \cdot (x \ll 4)$ for $0 \le x < 16$.
+**/
+extern gf gf_mul_lo[256][16];
+extern gf gf_mul_hi[256][16];
+
+/*M
+  \emph{Precomputed bit matrices.}
+
+  Bit $s$ of \verb|gf_bitmatrix[c][r]| is bit $r$ of $c \cdot 2^s$.
+**/
+extern gf gf_bitmatrix[256][8];
+
+/*M
+  \emph{Implementations of \verb|gf_add_mul|.}
+**/
+typedef enum gf_kernel_e {
+  GF_KERNEL_SCALAR = 0,
+  GF_KERNEL_SSSE3,
+  GF_KERNEL_AVX2
+} gf_kernel_t;
+
 void gf_init(void);
 void gf_add_mul(gf *a, gf *b, gf c, int k);
+void gf_add_mul_scalar(gf *a, gf *b, gf c, int k);
+void gf_xor(gf *a, gf *b, int k);
+void gf_add_mul_planes(gf *a, gf *b, gf c, int plane_len, int off, int k);
+
+int gf_set_kernel(gf_kernel_t kernel);
+gf_kernel_t gf_get_kernel(void);
+const char *gf_kernel_name(gf_kernel_t kernel);
 
 #define GF_MUL(x, y) (gf_mul[(x)][(y)])
 #define GF_ADD(x, y) ((x) ^ (y))
@@ -0,0 +1,411 @@
+/*C
+  (c) 2005 bl0rg.net
+**/
+
+#include "conf.h"
+
+#include <string.h>
+
+#include "galois16.h"
+
+/*M
+  The SIMD kernels are compiled using function target attributes,
+  see \verb|galois.c|.
+**/
+#if !defined(GF_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define GF_SIMD
+#include <immintrin.h>
+#endif
+
+/*M
+  \emph{Logarithmic representation of field elements.}
+**/
+gf16 gf16_logs[65536] = { 0 };
+
+/*M
+  \emph{Polynomial representation of field elements.}
+**/
+gf16 gf16_exps[2 * 65535] = { 0 };
+
+/*M
+  \emph{A primitive polynomial.}
+
+  $1 + x + x^3 + x^{12} + x^{16}$, bit $i$ is the coefficient of
+  $x^i$.
+**/
+#define GF16_PRIM_POLY 0x1100B
+
+/*M
+  \emph{Initialize data structures.}
+**/
+void gf16_init(void) {
+  /*M
+    Compute the powers of $\alpha = x$, reducing modulo the primitive
+    polynomial when the degree reaches $16$.
+  **/
+  unsigned int i, g = 1;
+  for (i = 0; i < 65535; i++) {
+    gf16_exps[i] = gf16_exps[i + 65535] = g;
+    gf16_logs[g] = i;
+
+    g <<= 1;
+    if (g & 0x10000)
+      g ^= GF16_PRIM_POLY;
+  }
+
+  /*M
+    The 0th element is undefined.
+  **/
+  gf16_logs[0] = 0xFFFF;
+
+  /*M
+    Choose the fastest \verb|gf16_add_mul| supported by the CPU.
+  **/
+  if (!gf16_set_kernel(GF_KERNEL_AVX2) &&
+      !gf16_set_kernel(GF_KERNEL_SSSE3))
+    gf16_set_kernel(GF_KERNEL_SCALAR);
+}
+
+/*M
+  \emph{Multiply two field elements.}
+**/
+gf16 gf16_mul(gf16 x, gf16 y) {
+  if ((x == 0) || (y == 0))
+    return 0;
+
+  return gf16_exps[gf16_logs[x] + gf16_logs[y]];
+}
+
+/*M
+  \emph{Invert a field element.}
+
+  The inverse of $0$ is defined as $0$.
+**/
+gf16 gf16_inv(gf16 x) {
+  if (x == 0)
+    return 0;
+
+  return gf16_exps[65535 - gf16_logs[x]];
+}
+
+/*M
+  \emph{Computes addition of a row multiplied by a constant.}
+
+  Computes $a = a + c * b$, where \verb|a| and \verb|b| hold
+  \verb|len| / 2 little endian elements of \gf{2^16}. This is the
+  reference implementation, used for CPUs without SIMD support and
+  for the tail of the SIMD kernels.
+**/
+void gf16_add_mul_scalar(gf *a, gf *b, gf16 c, int len) {
+  if (c == 0)
+    return;
+
+  unsigned int lc = gf16_logs[c];
+  int i;
+  for (i = 0; i + 2 <= len; i += 2) {
+    gf16 x = b[i] | (b[i + 1] << 8);
+    if (x != 0) {
+      gf16 p = gf16_exps[lc + gf16_logs[x]];
+      a[i]     ^= p & 0xff;
+      a[i + 1] ^= p >> 8;
+    }
+  }
+}
+
+#ifdef GF_SIMD
+/*M
+  \emph{Compute the split-nibble tables for a constant.}
+
+  \verb|t[2j]| and \verb|t[2j + 1]| hold the low and high bytes of
+  $c \cdot (x \ll 4j)$ for $0 \le x < 16$. As multiplication by $c$
+  is linear, the products are sums of the products of $c$ with the
+  powers of $x$, which are computed by shifting. The tables are
+  built in vector registers, as they are needed for every call.
+**/
+__attribute__((target("ssse3")))
+static inline void gf16_split_tables(gf16 c, __m128i t[8]) {
+  __m128i idx = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                              8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i masks[4];
+  unsigned int i, j;
+  for (i = 0; i < 4; i++) {
+    __m128i bit = _mm_set1_epi8(1 << i);
+    masks[i] = _mm_cmpeq_epi8(_mm_and_si128(idx, bit), bit);
+  }
+
+  gf16 basis[16];
+  unsigned int g = c;
+  for (i = 0; i < 16; i++) {
+    basis[i] = g;
+    g <<= 1;
+    if (g & 0x10000)
+      g ^= GF16_PRIM_POLY;
+  }
+
+  for (j = 0; j < 4; j++) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    for (i = 0; i < 4; i++) {
+      gf16 p = basis[4 * j + i];
+      lo = _mm_xor_si128(lo, _mm_and_si128(masks[i], _mm_set1_epi8(p & 0xff)));
+      hi = _mm_xor_si128(hi, _mm_and_si128(masks[i], _mm_set1_epi8(p >> 8)));
+    }
+    t[2 * j]     = lo;
+    t[2 * j + 1] = hi;
+  }
+}
+
+/*M
+  \emph{SSSE3 version of \verb|gf16_add_mul|.}
+
+  Processes 16 elements at a time.
+**/
+__attribute__((target("ssse3")))
+static void gf16_add_mul_ssse3(gf *a, gf *b, gf16 c, int len) {
+  __m128i t[8];
+  gf16_split_tables(c, t);
+
+  __m128i mask  = _mm_set1_epi8(0x0f);
+  __m128i deint = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+                                1, 3, 5, 7, 9, 11, 13, 15);
+
+  int i;
+  for (i = 0; i + 32 <= len; i += 32) {
+    /*M
+      Separate the low and high bytes of the elements.
+    **/
+    __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(b + i)), deint);
+    __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(b + i + 16)),
+                                  deint);
+    __m128i lo = _mm_unpacklo_epi64(x0, x1);
+    __m128i hi = _mm_unpackhi_epi64(x0, x1);
+
+    __m128i n0 = _mm_and_si128(lo, mask);
+    __m128i n1 = _mm_and_si128(_mm_srli_epi64(lo, 4), mask);
+    __m128i n2 = _mm_and_si128(hi, mask);
+    __m128i n3 = _mm_and_si128(_mm_srli_epi64(hi, 4), mask);
+
+    __m128i plo = _mm_xor_si128(
+      _mm_xor_si128(_mm_shuffle_epi8(t[0], n0), _mm_shuffle_epi8(t[2], n1)),
+      _mm_xor_si128(_mm_shuffle_epi8(t[4], n2), _mm_shuffle_epi8(t[6], n3)));
+    __m128i phi = _mm_xor_si128(
+      _mm_xor_si128(_mm_shuffle_epi8(t[1], n0), _mm_shuffle_epi8(t[3], n1)),
+      _mm_xor_si128(_mm_shuffle_epi8(t[5], n2), _mm_shuffle_epi8(t[7], n3)));
+
+    /*M
+      Interleave the product bytes again.
+    **/
+    __m128i y0 = _mm_loadu_si128((__m128i *)(a + i));
+    __m128i y1 = _mm_loadu_si128((__m128i *)(a + i + 16));
+    _mm_storeu_si128((__m128i *)(a + i),
+                     _mm_xor_si128(y0, _mm_unpacklo_epi8(plo, phi)));
+    _mm_storeu_si128((__m128i *)(a + i + 16),
+                     _mm_xor_si128(y1, _mm_unpackhi_epi8(plo, phi)));
+  }
+
+  gf16_add_mul_scalar(a + i, b + i, c, len - i);
+}
+
+/*M
+  \emph{AVX2 version of \verb|gf16_add_mul|.}
+
+  Processes 32 elements at a time. The bytes are separated within
+  each 128 bit lane, so that the elements end up at their original
+  place after interleaving.
+**/
+__attribute__((target("avx2")))
+static void gf16_add_mul_avx2(gf *a, gf *b, gf16 c, int len) {
+  __m128i t128[8];
+  gf16_split_tables(c, t128);
+
+  __m256i t[8];
+  int j;
+  for (j = 0; j < 8; j++)
+    t[j] = _mm256_broadcastsi128_si256(t128[j]);
+
+  __m256i mask  = _mm256_set1_epi8(0x0f);
+  __m256i deint = _mm256_broadcastsi128_si256(
+    _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15));
+
+  int i;
+  for (i = 0; i + 64 <= len; i += 64) {
+    __m256i x0 = _mm256_shuffle_epi8(
+      _mm256_loadu_si256((__m256i *)(b + i)), deint);
+    __m256i x1 = _mm256_shuffle_epi8(
+      _mm256_loadu_si256((__m256i *)(b + i + 32)), deint);
+    __m256i lo = _mm256_unpacklo_epi64(x0, x1);
+    __m256i hi = _mm256_unpackhi_epi64(x0, x1);
+
+    __m256i n0 = _mm256_and_si256(lo, mask);
+    __m256i n1 = _mm256_and_si256(_mm256_srli_epi64(lo, 4), mask);
+    __m256i n2 = _mm256_and_si256(hi, mask);
+    __m256i n3 = _mm256_and_si256(_mm256_srli_epi64(hi, 4), mask);
+
+    __m256i plo = _mm256_xor_si256(
+      _mm256_xor_si256(_mm256_shuffle_epi8(t[0], n0),
+                       _mm256_shuffle_epi8(t[2], n1)),
+      _mm256_xor_si256(_mm256_shuffle_epi8(t[4], n2),
+                       _mm256_shuffle_epi8(t[6], n3)));
+    __m256i phi = _mm256_xor_si256(
+      _mm256_xor_si256(_mm256_shuffle_epi8(t[1], n0),
+                       _mm256_shuffle_epi8(t[3], n1)),
+      _mm256_xor_si256(_mm256_shuffle_epi8(t[5], n2),
+                       _mm256_shuffle_epi8(t[7], n3)));
+
+    __m256i y0 = _mm256_loadu_si256((__m256i *)(a + i));
+    __m256i y1 = _mm256_loadu_si256((__m256i *)(a + i + 32));
+    _mm256_storeu_si256((__m256i *)(a + i),
+                        _mm256_xor_si256(y0, _mm256_unpacklo_epi8(plo, phi)));
+    _mm256_storeu_si256((__m256i *)(a + i + 32),
+                        _mm256_xor_si256(y1, _mm256_unpackhi_epi8(plo, phi)));
+  }
+
+  /*M
+    Avoid AVX-SSE transition penalties in the scalar code.
+  **/
+  _mm256_zeroupper();
+  gf16_add_mul_scalar(a + i, b + i, c, len - i);
+}
+#endif /* GF_SIMD */
+
+/*M
+  \emph{Currently used \verb|gf16_add_mul| implementation.}
+**/
+static gf_kernel_t gf16_kernel = GF_KERNEL_SCALAR;
+static void (*gf16_add_mul_fn)(gf *a, gf *b, gf16 c, int len) =
+  gf16_add_mul_scalar;
+
+/*M
+  \emph{Select the \verb|gf16_add_mul| implementation.}
+
+  Returns 0 if the kernel is not supported by the CPU (or not
+  compiled in), 1 on success.
+**/
+int gf16_set_kernel(gf_kernel_t kernel) {
+  switch (kernel) {
+  case GF_KERNEL_SCALAR:
+    gf16_add_mul_fn = gf16_add_mul_scalar;
+    break;
+
+#ifdef GF_SIMD
+  case GF_KERNEL_SSSE3:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("ssse3"))
+      return 0;
+    gf16_add_mul_fn = gf16_add_mul_ssse3;
+    break;
+
+  case GF_KERNEL_AVX2:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2"))
+      return 0;
+    gf16_add_mul_fn = gf16_add_mul_avx2;
+    break;
+#endif /* GF_SIMD */
+
+  default:
+    return 0;
+  }
+
+  gf16_kernel = kernel;
+  return 1;
+}
+
+/*M
+  \emph{Get the currently used \verb|gf16_add_mul| implementation.}
+**/
+gf_kernel_t gf16_get_kernel(void) {
+  return gf16_kernel;
+}
+
+/*M
+  \emph{Computes addition of a row multiplied by a constant.}
+
+  Computes $a = a + c * b$ on \verb|len| bytes, using the
+  implementation chosen by \verb|gf16_init|. \verb|len| has to be
+  even. Multiplication by $0$ is a no-op.
+**/
+void gf16_add_mul(gf *a, gf *b, gf16 c, int len) {
+  if (c == 0)
+    return;
+
+  gf16_add_mul_fn(a, b, c, len);
+}
+
+/*C
+**/
+
+#ifdef GALOIS16_TEST
+#include <stdio.h>
+
+void testit(char *name, int result, int should) {
+  if (result == should) {
+    printf("Test %s was successful\n", name);
+  } else {
+    printf("Test %s was not successful, %x should have been %x\n",
+           name, result, should);
+  }
+}
+
+int main(void) {
+  gf16 a, b, c;
+
+  gf16_init();
+  a = 1;
+  b = 4711;
+  c = 54321;
+  testit("1 * ( 4711 + 54321 ) = 1 * 4711 + 1 * 54321",
+         gf16_mul(a, GF16_ADD(b, c)),
+         GF16_ADD(gf16_mul(a, b), gf16_mul(a, c)));
+  testit("(4711 * 54321) * 4711 = (4711 * 4711) * 54321",
+         gf16_mul(gf16_mul(b, c), b),
+         gf16_mul(gf16_mul(b, b), c));
+  testit("b * (c + 1) = b * c + b",
+         gf16_mul(b, GF16_ADD(c, 1)),
+         GF16_ADD(gf16_mul(b, c), b));
+  testit("b * b^-1 = 1", gf16_mul(b, gf16_inv(b)), 1);
+
+  /*M
+    Every non-zero element has an inverse, so $\alpha$ is primitive.
+  **/
+  unsigned int i, ok = 1;
+  for (i = 1; i < 65536; i++)
+    if (gf16_mul(i, gf16_inv(i)) != 1)
+      ok = 0;
+  testit("x * x^-1 = 1 for all x", ok, 1);
+
+  /*M
+    Compare the SIMD kernels with the scalar reference, using a length
+    which is not a multiple of the vector size to exercise the tails.
+  **/
+  gf src[1030], ref[1030], dst[1030];
+  for (i = 0; i < sizeof(src); i++)
+    src[i] = (i * 7 + 13) & 0xff;
+
+  gf_kernel_t kernel;
+  for (kernel = GF_KERNEL_SSSE3; kernel <= GF_KERNEL_AVX2; kernel++) {
+    if (!gf16_set_kernel(kernel)) {
+      printf("Kernel %s not supported, skipping\n", gf_kernel_name(kernel));
+      continue;
+    }
+
+    ok = 1;
+    for (i = 0; i < 65536; i += 97) {
+      memset(ref, i, sizeof(ref));
+      memset(dst, i, sizeof(dst));
+      gf16_add_mul_scalar(ref, src, i, sizeof(src));
+      gf16_add_mul(dst, src, i, sizeof(dst));
+      if (memcmp(ref, dst, sizeof(ref)))
+        ok = 0;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s gf16_add_mul = scalar gf16_add_mul",
+             gf_kernel_name(kernel));
+    testit(name, ok, 1);
+  }
+
+  return 0;
+}
+
+#endif /* GALOIS16_TEST */
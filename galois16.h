@@ -0,0 +1,64 @@
+/*C
+  (c) 2005 bl0rg.net
+**/
+
+#ifndef GALOIS16_H__
+#define GALOIS16_H__
+
+#include "galois.h"
+
+/*H
+  \subsection{\gf{2^16} implementation}
+
+  \gf{2^8} limits a code block to $256$ packets. For longer blocks,
+  the same arithmetic is implemented in \gf{2^16}, using the
+  primitive polynomial
+  \[1 + x + x^3 + x^{12} + x^{16}\]
+
+  Multiplication and division are done using logarithm and
+  exponentiation tables, a full multiplication table would need
+  8~GB. Rows of field elements are stored as byte buffers, each
+  element taking two bytes in little endian order, so that encoded
+  packets are the same on every host.
+
+  As in \gf{2^8}, the SSSE3 and AVX2 versions of
+  \verb|gf16_add_mul| split the elements into nibbles. An element
+  has $4$ nibbles, and the product of each nibble with the constant
+  has two bytes, so that $8$ shuffle tables are needed. The low and
+  high bytes of $16$ (respectively $32$) elements are separated
+  before the lookups and interleaved again afterwards.
+**/
+
+/*M
+  \emph{\gf{2^16} field element type.}
+**/
+typedef unsigned short gf16;
+
+/*M
+  \emph{Logarithmic representation of field elements.}
+**/
+extern gf16 gf16_logs[65536];
+
+/*M
+  \emph{Polynomial representation of field elements.}
+
+  \verb|gf16_exps[i]| is $\alpha^i$, the table is doubled so that
+  the sum of two logarithms can be used as index without reduction.
+**/
+extern gf16 gf16_exps[2 * 65535];
+
+void gf16_init(void);
+gf16 gf16_mul(gf16 x, gf16 y);
+gf16 gf16_inv(gf16 x);
+void gf16_add_mul(gf *a, gf *b, gf16 c, int len);
+void gf16_add_mul_scalar(gf *a, gf *b, gf16 c, int len);
+
+int gf16_set_kernel(gf_kernel_t kernel);
+gf_kernel_t gf16_get_kernel(void);
+
+#define GF16_ADD(x, y) ((x) ^ (y))
+
+/*C
+**/
+
+#endif /* GALOIS16_H__ */
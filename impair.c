@@ -0,0 +1,438 @@
+/*C
+  (c) 2005 bl0rg.net
+**/
+
+#include "conf.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "impair.h"
+
+/*M
+  \emph{Get the current time in usecs.}
+**/
+static unsigned long long impair_now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*M
+  \emph{Get a random number between 0 and 100 (excluded).}
+
+  Uses a xorshift generator, so that a seed gives the same sequence
+  on every system.
+**/
+static double impair_random(impair_t *imp) {
+  unsigned long long x = imp->rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  imp->rng = x;
+
+  return (double)((x * 0x2545f4914f6cdd1dULL) >> 11) /
+    9007199254740992.0 * 100.0;
+}
+
+/*M
+  \emph{Parse a setting of an impairment specification.}
+
+  Returns 0 on error, 1 on success.
+**/
+static int impair_set(impair_t *imp, char *key, char *value) {
+  char *end;
+  double d = strtod(value, &end);
+  if ((end == value) || (*end != '\0') || (d < 0))
+    return 0;
+
+  if (!strcmp(key, "loss"))
+    imp->loss = d;
+  else if (!strcmp(key, "p"))
+    imp->p_bad = d;
+  else if (!strcmp(key, "r"))
+    imp->p_good = d;
+  else if (!strcmp(key, "bloss"))
+    imp->bad_loss = d;
+  else if (!strcmp(key, "dup"))
+    imp->dup = d;
+  else if (!strcmp(key, "reorder"))
+    imp->reorder = d;
+  else if (!strcmp(key, "delay"))
+    imp->delay = (unsigned long)d;
+  else if (!strcmp(key, "jitter"))
+    imp->jitter = (unsigned long)d;
+  else if (!strcmp(key, "seed"))
+    imp->seed = strtoull(value, NULL, 0);
+  else
+    return 0;
+
+  return 1;
+}
+
+/*M
+  \emph{Initialize the impairment from a specification.}
+
+  If \verb|spec| is \verb|NULL|, the specification is taken from the
+  \verb|POC_IMPAIR| environment variable. Without specification, the
+  impairment is disabled. Returns 0 if the specification is invalid,
+  1 on success.
+**/
+int impair_init(impair_t *imp, const char *spec) {
+  assert(imp != NULL);
+
+  memset(imp, 0, sizeof(*imp));
+  imp->p_good = 100;
+  imp->bad_loss = 100;
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  imp->seed = ((unsigned long long)tv.tv_sec << 20) ^ tv.tv_usec ^
+    ((unsigned long long)getpid() << 40);
+
+  if (spec == NULL)
+    spec = getenv(IMPAIR_ENV);
+  if ((spec == NULL) || (*spec == '\0'))
+    return 1;
+
+  char *buf = strdup(spec);
+  assert(buf != NULL);
+
+  int retval = 1;
+  char *saveptr, *tok;
+  for (tok = strtok_r(buf, ",", &saveptr); tok != NULL;
+       tok = strtok_r(NULL, ",", &saveptr)) {
+    char *value = strchr(tok, '=');
+    if (value == NULL) {
+      value = tok;
+      tok = "loss";
+    } else {
+      *value++ = '\0';
+    }
+
+    if (!impair_set(imp, tok, value)) {
+      retval = 0;
+      break;
+    }
+  }
+  free(buf);
+
+  impair_seed(imp, imp->seed);
+  imp->enabled = retval;
+
+  return retval;
+}
+
+/*M
+  \emph{Restart the random number generator with \verb|seed|.}
+**/
+void impair_seed(impair_t *imp, unsigned long long seed) {
+  assert(imp != NULL);
+
+  imp->seed = seed;
+  imp->rng = seed ^ 0x9e3779b97f4a7c15ULL;
+  if (imp->rng == 0)
+    imp->rng = 1;
+}
+
+/*M
+  \emph{Destroy the impairment, and drop the held back packets.}
+**/
+void impair_destroy(impair_t *imp) {
+  assert(imp != NULL);
+
+  while (imp->queue != NULL) {
+    impair_pkt_t *pkt = imp->queue;
+    imp->queue = pkt->next;
+    free(pkt);
+  }
+}
+
+/*M
+  \emph{Queue a packet to be delivered at \verb|due|.}
+
+  Packets with the same delivery time stay in order.
+**/
+static void impair_queue(impair_t *imp, unsigned char *buf,
+                         unsigned int len, unsigned long long due) {
+  impair_pkt_t *pkt = malloc(sizeof(impair_pkt_t) + len);
+  assert(pkt != NULL);
+  pkt->due = due;
+  pkt->len = len;
+  memcpy(pkt->data, buf, len);
+
+  impair_pkt_t **ptr = &imp->queue;
+  while ((*ptr != NULL) && ((*ptr)->due <= due))
+    ptr = &(*ptr)->next;
+  pkt->next = *ptr;
+  *ptr = pkt;
+}
+
+/*M
+  \emph{Pass a packet through the impairment at time \verb|now|.}
+
+  The packet is dropped, or copied into the queue of held back
+  packets, once or twice. Get the packets with \verb|impair_get| when
+  they are due.
+**/
+void impair_add(impair_t *imp, unsigned char *buf, unsigned int len,
+                unsigned long long now) {
+  assert(imp != NULL);
+  assert((buf != NULL) || (len == 0));
+
+  imp->pkts++;
+
+  /*M
+    Change the state of the Gilbert-Elliott model, then lose the
+    packet with the loss probability of the state.
+  **/
+  if (imp->bad) {
+    if (impair_random(imp) < imp->p_good)
+      imp->bad = 0;
+  } else if ((imp->p_bad > 0) && (impair_random(imp) < imp->p_bad)) {
+    imp->bad = 1;
+  }
+
+  double loss = imp->bad ? imp->bad_loss : imp->loss;
+  if ((loss > 0) && (impair_random(imp) < loss)) {
+    imp->dropped++;
+    return;
+  }
+
+  unsigned int copies = 1;
+  if ((imp->dup > 0) && (impair_random(imp) < imp->dup)) {
+    imp->duplicated++;
+    copies = 2;
+  }
+
+  while (copies-- > 0) {
+    unsigned long long due = now;
+    if ((imp->reorder > 0) && (impair_random(imp) < imp->reorder)) {
+      imp->reordered++;
+    } else {
+      long delay = imp->delay;
+      if (imp->jitter > 0)
+        delay += (long)(impair_random(imp) / 100.0 * (2 * imp->jitter + 1))
+          - (long)imp->jitter;
+      if (delay > 0)
+        due += delay;
+    }
+
+    impair_queue(imp, buf, len, due);
+  }
+}
+
+/*M
+  \emph{Get the next packet due at time \verb|now|.}
+
+  Returns \verb|NULL| if no packet is due. The packet has to be freed
+  by the caller.
+**/
+impair_pkt_t *impair_get(impair_t *imp, unsigned long long now) {
+  assert(imp != NULL);
+
+  impair_pkt_t *pkt = imp->queue;
+  if ((pkt == NULL) || (pkt->due > now))
+    return NULL;
+
+  imp->queue = pkt->next;
+  pkt->next = NULL;
+  return pkt;
+}
+
+/*M
+  \emph{Check if packets are held back.}
+**/
+int impair_pending(impair_t *imp) {
+  assert(imp != NULL);
+
+  return imp->queue != NULL;
+}
+
+/*M
+  \emph{Send a packet through the impairment.}
+
+  Sends the packet to \verb|to|, or on the connected socket if
+  \verb|to| is \verb|NULL|. With impairment, the packet is queued and
+  the packets which are due are sent, so that held back packets are
+  sent with a later packet. Returns -1 if a packet could not be sent,
+  else 0.
+**/
+int impair_sendto(impair_t *imp, int fd, unsigned char *buf,
+                  unsigned int len, struct sockaddr *to, socklen_t tolen) {
+  assert(imp != NULL);
+
+  if (!imp->enabled)
+    return (sendto(fd, buf, len, 0, to, tolen) < 0) ? -1 : 0;
+
+  unsigned long long now = impair_now();
+  impair_add(imp, buf, len, now);
+
+  int retval = 0;
+  impair_pkt_t *pkt;
+  while ((pkt = impair_get(imp, now)) != NULL) {
+    if (sendto(fd, pkt->data, pkt->len, 0, to, tolen) < 0)
+      retval = -1;
+    free(pkt);
+  }
+
+  return retval;
+}
+
+/*M
+  \emph{Send the held back packets.}
+
+  Called at the end of a stream, the packets are sent at once.
+**/
+void impair_flush(impair_t *imp, int fd,
+                  struct sockaddr *to, socklen_t tolen) {
+  assert(imp != NULL);
+
+  while (imp->queue != NULL) {
+    impair_pkt_t *pkt = imp->queue;
+    imp->queue = pkt->next;
+    sendto(fd, pkt->data, pkt->len, 0, to, tolen);
+    free(pkt);
+  }
+}
+
+/*M
+  \emph{Pass a received batch through the impairment.}
+
+  The \verb|cnt| received datagrams of the batch are queued, and
+  replaced by the datagrams which are due. Held back datagrams are
+  only delivered when the batch is received again, callers should
+  also call it when \verb|impair_pending| is set. Truncated datagrams
+  keep their length of $0$. Returns the new number of datagrams in
+  the batch.
+**/
+int impair_batch(impair_t *imp, net_batch_t *batch) {
+  assert(imp != NULL);
+  assert(batch != NULL);
+
+  if (!imp->enabled)
+    return batch->cnt;
+
+  unsigned long long now = impair_now();
+  unsigned int i;
+  for (i = 0; i < batch->cnt; i++)
+    impair_add(imp, batch->iovs[i].iov_base, batch->lengths[i], now);
+
+  batch->cnt = 0;
+  impair_pkt_t *pkt;
+  while ((batch->cnt < batch->size) &&
+         ((pkt = impair_get(imp, now)) != NULL)) {
+    assert(pkt->len <= batch->iovs[batch->cnt].iov_len);
+    memcpy(batch->iovs[batch->cnt].iov_base, pkt->data, pkt->len);
+    batch->lengths[batch->cnt] = pkt->len;
+    batch->cnt++;
+    free(pkt);
+  }
+
+  return batch->cnt;
+}
+
+#ifdef IMPAIR_TEST
+#include <stdio.h>
+
+void testit(char *name, unsigned long result, unsigned long should) {
+  if (result == should) {
+    printf("Test %s was successful\n", name);
+  } else {
+    printf("Test %s was not successful, %lu should have been %lu\n",
+           name, result, should);
+  }
+}
+
+#define TEST_PKTS 100000
+
+/*M
+  \emph{Count the packets delivered by an impairment.}
+
+  Each packet carries its number, \verb|misordered| counts the
+  packets delivered after a packet with a higher number.
+**/
+unsigned long test_run(impair_t *imp, char *spec, unsigned long *misordered) {
+  if (!impair_init(imp, spec))
+    return 0;
+
+  unsigned long delivered = 0, last = 0;
+  *misordered = 0;
+
+  unsigned long long now = 0;
+  unsigned long i;
+  for (i = 1; i <= TEST_PKTS + 1000; i++, now += 100) {
+    if (i <= TEST_PKTS)
+      impair_add(imp, (unsigned char *)&i, sizeof(i), now);
+
+    impair_pkt_t *pkt;
+    while ((pkt = impair_get(imp, now)) != NULL) {
+      unsigned long num;
+      memcpy(&num, pkt->data, sizeof(num));
+      if (num < last)
+        (*misordered)++;
+      last = num;
+      delivered++;
+      free(pkt);
+    }
+  }
+
+  testit("impair queue empty", impair_pending(imp), 0);
+  impair_destroy(imp);
+
+  return delivered;
+}
+
+int main(void) {
+  impair_t imp;
+  unsigned long n, misordered;
+
+  testit("impair disabled", impair_init(&imp, "") && !imp.enabled, 1);
+  testit("impair invalid key", impair_init(&imp, "foo=1"), 0);
+  testit("impair invalid value", impair_init(&imp, "loss=x"), 0);
+  testit("impair loss without key",
+         impair_init(&imp, "20") && (imp.loss == 20), 1);
+
+  testit("impair no loss", test_run(&imp, "seed=1", &misordered), TEST_PKTS);
+  testit("impair no loss in order", misordered, 0);
+
+  n = test_run(&imp, "loss=10,seed=1", &misordered);
+  testit("impair uniform loss", (n > TEST_PKTS * 0.89) &&
+         (n < TEST_PKTS * 0.91), 1);
+  testit("impair same seed",
+         test_run(&imp, "loss=10,seed=1", &misordered), n);
+
+  /*M
+    In the Gilbert-Elliott model, $p / (p + r)$ of the packets are
+    sent in the bad state, here 4\%.
+  **/
+  n = test_run(&imp, "p=1,r=24,seed=2", &misordered);
+  testit("impair burst loss", (n > TEST_PKTS * 0.95) &&
+         (n < TEST_PKTS * 0.97), 1);
+
+  n = test_run(&imp, "dup=5,seed=3", &misordered);
+  testit("impair duplication", (n > TEST_PKTS * 1.04) &&
+         (n < TEST_PKTS * 1.06), 1);
+
+  n = test_run(&imp, "delay=2000,seed=4", &misordered);
+  testit("impair delay", n, TEST_PKTS);
+  testit("impair delay in order", misordered, 0);
+
+  n = test_run(&imp, "delay=2000,jitter=1000,seed=5", &misordered);
+  testit("impair jitter", n, TEST_PKTS);
+  testit("impair jitter reorders", misordered > 0, 1);
+
+  n = test_run(&imp, "delay=2000,reorder=10,seed=6", &misordered);
+  testit("impair reorder", (imp.reordered > TEST_PKTS * 0.09) &&
+         (imp.reordered < TEST_PKTS * 0.11) && (misordered > 0), 1);
+
+  return 0;
+}
+
+#endif /* IMPAIR_TEST */
+
+/*C
+**/
@@ -0,0 +1,109 @@
+/*C
+  (c) 2005 bl0rg.net
+**/
+
+#ifndef IMPAIR_H__
+#define IMPAIR_H__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "network.h"
+
+/*H
+  \subsection{Network impairment}
+
+  To test the streaming protocols on bad networks, the servers and
+  clients can impair the packets they send and receive. Packets are
+  lost following a Gilbert-Elliott model, which produces the loss
+  bursts of real networks, and can be duplicated, delayed with a
+  jitter and reordered. The random number generator is seeded, so
+  that a loss pattern can be reproduced.
+
+  The impairment is given as a comma separated list of
+  \verb|key=value| settings, on the command line or in the
+  \verb|POC_IMPAIR| environment variable. Probabilities are in
+  percent, times in microseconds:
+
+  \begin{description}
+  \item[loss] Loss probability in the good state (default 0). A
+    specification without a key, such as \verb|20|, gives this loss
+    probability.
+  \item[p] Probability to change from the good state to the bad state
+    (default 0, no bad state).
+  \item[r] Probability to change from the bad state to the good state
+    (default 100).
+  \item[bloss] Loss probability in the bad state (default 100).
+  \item[dup] Probability to duplicate a packet.
+  \item[delay] Delay of each packet.
+  \item[jitter] Maximal deviation from the delay, packets can then be
+    reordered.
+  \item[reorder] Probability to send a packet without the delay, so
+    that it overtakes the delayed packets.
+  \item[seed] Seed of the random number generator (default: chosen
+    from the time).
+  \end{description}
+**/
+
+#define IMPAIR_ENV "POC_IMPAIR"
+
+/*M
+  \emph{Packet held back by the impairment.}
+**/
+typedef struct impair_pkt_s {
+  /*M
+    Time at which the packet is delivered, in usecs.
+  **/
+  unsigned long long due;
+  unsigned int len;
+  struct impair_pkt_s *next;
+  unsigned char data[];
+} impair_pkt_t;
+
+/*M
+  \emph{Network impairment state.}
+**/
+typedef struct impair_s {
+  int enabled;
+
+  /*M
+    Gilbert-Elliott loss model, probabilities in percent.
+  **/
+  double loss, bad_loss, p_bad, p_good;
+  int bad;
+
+  double dup, reorder;
+  unsigned long delay, jitter;
+
+  unsigned long long seed, rng;
+
+  /*M
+    Held back packets, sorted by delivery time.
+  **/
+  impair_pkt_t *queue;
+
+  /*M
+    Accounting information.
+  **/
+  unsigned long pkts, dropped, duplicated, reordered;
+} impair_t;
+
+int impair_init(impair_t *imp, const char *spec);
+void impair_seed(impair_t *imp, unsigned long long seed);
+void impair_destroy(impair_t *imp);
+
+void impair_add(impair_t *imp, unsigned char *buf, unsigned int len,
+                unsigned long long now);
+impair_pkt_t *impair_get(impair_t *imp, unsigned long long now);
+int impair_pending(impair_t *imp);
+
+int impair_sendto(impair_t *imp, int fd, unsigned char *buf,
+                  unsigned int len, struct sockaddr *to, socklen_t tolen);
+void impair_flush(impair_t *imp, int fd,
+                  struct sockaddr *to, socklen_t tolen);
+int impair_batch(impair_t *imp, net_batch_t *batch);
+
+/*C
+**/
+
+#endif /* IMPAIR_H__ */
@@ -54,6 +54,8 @@ void libfec_close(void) {
     file_close(&outfile);
     outfile_open = 0;
   }
+
+  fec_cache_destroy();
   
   initialized = 0;
 }
@@ -63,20 +65,21 @@ int libfec_read_adu(unsigned char *dst, unsigned int len) {
   assert(initialized);
   assert(infile_open);
   
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
   while (mp3_next_frame(&infile, &frame) > 0) {
     if (aq_add_frame(&qin, &frame)) {
       adu_t *adu = aq_get_adu(&qin);
       assert(adu != NULL);
 
       if (adu->adu_size == 0) {
-        free(adu);
+        aq_release(&qin, adu);
         continue;
       }
       unsigned int retlen = min(len, mp3_frame_size(adu));
       memcpy(dst, adu->raw, retlen);
 
-      free(adu);
+      aq_release(&qin, adu);
 
       return retlen;
     }
@@ -90,10 +93,9 @@ void libfec_write_adu(unsigned char *buf, unsigned int len) {
   assert(initialized);
   assert(outfile_open);
 
-  adu_t adu;
-  memcpy(adu.raw, buf, len);
+  adu_t adu = { .raw = buf };
   int ret = mp3_unpack(&adu);
-  assert(ret);
+  assert(ret && (mp3_frame_size(&adu) <= len));
 
   if (aq_add_adu(&qout, &adu)) {
     mp3_frame_t *frame = aq_get_frame(&qout);
@@ -104,7 +106,7 @@ void libfec_write_adu(unsigned char *buf, unsigned int len) {
         !mp3_write_frame(&outfile, frame))
       assert(NULL);
 
-    free(frame);
+    aq_release(&qout, frame);
   }
 }
 
@@ -114,7 +116,7 @@ fec_decode_t *libfec_new_group(unsigned char fec_k,
   fec_decode_t *group = malloc(sizeof(fec_decode_t));
   if (group == NULL)
     return NULL;
-  fec_group_init(group, fec_k, fec_n, 0, 0, fec_len);
+  fec_group_init(group, fec_k, fec_n, FEC_SCHEME_VANDERMONDE, 0, 0, fec_len);
   return group;
 }
 
@@ -127,18 +129,57 @@ void libfec_add_pkt(fec_decode_t *group,
   assert(len <= group->fec_len);
   assert(pkt_seq <= group->fec_n);
   
-  fec_pkt_t pkt;
-  fec_pkt_init(&pkt);
-  pkt.hdr.fec_k = group->fec_k;
-  pkt.hdr.fec_n = group->fec_n;
-  pkt.hdr.group_seq = group->seq;
-  pkt.hdr.packet_seq = pkt_seq;
-  pkt.hdr.len = len;
-  pkt.hdr.fec_len = group->fec_len;
-  pkt.hdr.group_tstamp = group->tstamp;
-  memcpy(pkt.payload, data, len);
-
-  fec_group_insert_pkt(group, &pkt);
+  fec_pkt_hdr_t hdr;
+  hdr.group_seq = group->seq;
+  hdr.packet_seq = pkt_seq;
+  hdr.len = len;
+  hdr.group_tstamp = group->tstamp;
+
+  unsigned char *dst = fec_group_pkt_buf(group, &hdr);
+  if (dst != NULL)
+    memcpy(dst, data, len);
+  fec_group_add_pkt(group, &hdr);
+}
+
+int libfec_recv_pkt(fec_decode_t *group, int fd) {
+  assert(group != NULL);
+
+  fec_pkt_hdr_t hdr;
+  int ret = fec_pkt_peek_hdr(&hdr, fd);
+  if (ret <= 0)
+    return -1;
+
+  /* drop packets the group can not hold */
+  if ((FEC_PKT_GET_SCHEME(hdr.version) != group->scheme) ||
+      !FEC_PKT_VERSION_VALID(hdr.version) ||
+      (hdr.fec_k != group->fec_k) ||
+      (hdr.fec_n != group->fec_n) ||
+      (hdr.packet_seq >= group->fec_n) ||
+      (hdr.len > group->fec_len)) {
+    fec_pkt_recv_payload(&hdr, fd, NULL);
+    return -1;
+  }
+
+  /* the first packet sets the group, the packets of the next group
+     stay in the socket buffer */
+  if (group->rcvd_pkts == 0) {
+    group->hdr_version = FEC_PKT_GET_HDR_VERSION(hdr.version);
+    group->stream_id = hdr.stream_id;
+    group->seq = hdr.group_seq;
+    group->tstamp = hdr.group_tstamp;
+  } else if ((hdr.group_seq != group->seq) ||
+             (hdr.group_tstamp != group->tstamp) ||
+             (hdr.stream_id != group->stream_id) ||
+             (FEC_PKT_GET_HDR_VERSION(hdr.version) != group->hdr_version)) {
+    return 0;
+  }
+
+  unsigned char *dst = fec_group_pkt_buf(group, &hdr);
+  if (fec_pkt_recv_payload(&hdr, fd, dst) <= 0)
+    return -1;
+  fec_group_add_pkt(group, &hdr);
+
+  return 1;
 }
 
 unsigned int libfec_decode(fec_decode_t *group,
@@ -190,6 +231,9 @@ struct fec_encode_s {
   
   unsigned char count;
   unsigned int  max_length;
+
+  /* redundant packets, computed by the first libfec_encode call */
+  unsigned char *fec_pkts;
 };
 
 fec_encode_t *libfec_new_encode(unsigned char fec_k,
@@ -208,8 +252,10 @@ fec_encode_t *libfec_new_encode(unsigned char fec_k,
   encode->lengths      = NULL;
   encode->count        = 0;
   encode->max_length   = 0;
+  encode->fec_pkts     = NULL;
   
-  encode->fec = fec_new(encode->fec_k, encode->fec_n);
+  encode->fec = fec_cache_get(encode->fec_k, encode->fec_n,
+                              FEC_SCHEME_VANDERMONDE);
   if (encode->fec == NULL)
     goto exit;
   
@@ -245,8 +291,8 @@ void libfec_delete_encode(fec_encode_t *encode) {
     free(encode->lengths);
   if (encode->adu_ptrs)
     free(encode->adu_ptrs);
-  if (encode->fec)
-    fec_free(encode->fec);
+  if (encode->fec_pkts)
+    free(encode->fec_pkts);
   free(encode);
 }
 
@@ -287,11 +333,35 @@ unsigned int libfec_encode(fec_encode_t *encode,
   assert(encode->adu_ptrs != NULL);
   assert(encode->fec != NULL);
   assert(dst != NULL);
-  fec_encode(encode->fec, encode->adu_ptrs,
-             dst, idx, len);
 
-  if (idx < encode->fec_k)
+  if (idx < encode->fec_k) {
+    memcpy(dst, encode->adu_ptrs[idx], len);
     return encode->lengths[idx];
-  else
-    return encode->max_length;
+  }
+
+  if (idx >= encode->fec_n)
+    return 0;
+
+  /* encode all redundant packets at once on first request */
+  unsigned int max_length = encode->max_length;
+  if (encode->fec_pkts == NULL) {
+    unsigned int cnt = encode->fec_n - encode->fec_k;
+    encode->fec_pkts = malloc(cnt * max_length + 1);
+    if (encode->fec_pkts == NULL)
+      return 0;
+
+    unsigned char *fec_ptrs[cnt];
+    int i;
+    for (i = 0; i < cnt; i++)
+      fec_ptrs[i] = encode->fec_pkts + i * max_length;
+    fec_encode_all(encode->fec, encode->adu_ptrs, fec_ptrs, max_length);
+  }
+
+  /* the zero padded sources encode to zeros beyond max_length */
+  memcpy(dst, encode->fec_pkts + (idx - encode->fec_k) * max_length,
+         max_length);
+  if (len > max_length)
+    memset(dst + max_length, 0, len - max_length);
+
+  return max_length;
 }
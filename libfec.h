@@ -45,6 +45,17 @@ void libfec_add_pkt(fec_decode_t *group,
                     unsigned char pkt_seq,
                     unsigned long len,
                     unsigned char *data);
+/*
+ * Receive the next FEC packet from the datagram socket fd into the
+ * FEC group. The payload is received directly into the group
+ * buffer. The first packet sets the group sequence number and
+ * timestamp. A packet of another group is left in the socket
+ * buffer, so that it can be received into a new group.
+ *
+ * Return 1 if the packet was added, 0 if it belongs to another
+ * group, -1 on error or if the packet was dropped.
+ */
+int libfec_recv_pkt(fec_decode_t *group, int fd);
 /*
  * Decode the FEC group and extract the packet with seq idx. Note
  * that the original length information can not be recovered from the
@@ -611,6 +611,10 @@ int mp3_read_hdr(mp3_frame_t *frame) {
   **/
   frame->bitrate_index = bv_get_bits(&bv, 4);
 
+  /* free format and the "bad" index are not handled */
+  if ((frame->bitrate_index == 0) || (frame->bitrate_index == 15))
+    return 0;
+
   /*M
     \emph{Sampling frequency information.}
 
@@ -632,6 +636,9 @@ int mp3_read_hdr(mp3_frame_t *frame) {
   **/
   frame->samplerfindex = bv_get_bits(&bv, 2);
 
+  if (frame->samplerfindex == 3)
+    return 0;
+
   /*M
     \emph{Padding flag.}
 
@@ -762,37 +769,144 @@ int mp3_skip_id3v2(file_t *mp3, mp3_frame_t *frame) {
   return 1;
 }
 
+/*M
+  \emph{Check the raw bytes of a frame header candidate.}
+
+  Checks the sync bits, the MPEG version, the layer, the bitrate index
+  and the sampling frequency like \verb|mp3_read_hdr|, with a few
+  masks on the bytes instead of the bit-vector reader.
+**/
+int mp3_hdr_check(unsigned char *hdr) {
+  assert(hdr != NULL);
+
+  return (hdr[0] == 0xFF) &
+    /* sync, Layer III */
+    ((hdr[1] & 0xE6) == 0xE2) &
+    ((hdr[1] & 0x18) != (MPEG_VERSION_RESERVED << 3)) &
+    ((hdr[2] & 0xF0) != 0x00) &
+    ((hdr[2] & 0xF0) != 0xF0) &
+    ((hdr[2] & 0x0C) != 0x0C);
+}
+
+/*M
+  \emph{Find the next frame header or ID3v2 tag in a buffer.}
+
+  The 0xFF sync bytes are searched with \verb|memchr|, and only these
+  candidates are checked with \verb|mp3_hdr_check|. If
+  \verb|confirm| is set, a header is only accepted if the header of
+  the following frame lies where its size predicts, with the same
+  version and sampling frequency, or lies behind the buffer.
+
+  Returns the offset of the header or tag. If there is none, returns
+  the offset of the first of the last three bytes, from which a
+  header could still start.
+**/
+size_t mp3_sync_scan(unsigned char *buf, size_t len, int confirm) {
+  assert(buf != NULL);
+
+  if (len < MP3_HDR_SIZE)
+    return 0;
+
+  unsigned char *end = buf + len - (MP3_HDR_SIZE - 1);
+  unsigned char *id3 = buf;
+  while ((id3 = memchr(id3, 'I', end - id3)) != NULL) {
+    if ((id3[1] == 'D') && (id3[2] == '3')) {
+      end = id3;
+      break;
+    }
+    id3++;
+  }
+
+  unsigned char *ptr = buf;
+  while ((ptr = memchr(ptr, 0xFF, end - ptr)) != NULL) {
+    if (mp3_hdr_check(ptr)) {
+      if (!confirm || (ptr + MP3_HDR_SIZE + 2 > buf + len))
+        return ptr - buf;
+
+      mp3_frame_t frame = { .raw = ptr };
+      if (mp3_read_hdr(&frame)) {
+        unsigned char *next = ptr + frame.frame_size;
+        if ((frame.frame_size <= MP3_RAW_SIZE) &&
+            ((next + MP3_HDR_SIZE > buf + len) ||
+             (mp3_hdr_check(next) &&
+              ((next[1] & 0x18) == (ptr[1] & 0x18)) &&
+              ((next[2] & 0x0C) == (ptr[2] & 0x0C)))))
+          return ptr - buf;
+      }
+    }
+
+    ptr++;
+  }
+
+  if (id3 != NULL)
+    return id3 - buf;
+  return len - (MP3_HDR_SIZE - 1);
+}
+
 /*M
   \emph{Read the next MP3 frame in the MP3 file.}
+
+  The frame is read into \verb|frame->raw|, which has to hold
+  \verb|MP3_RAW_SIZE| bytes. If the file is mapped, the frame is not
+  copied and \verb|frame->raw| points into the mapping instead.
+
+  The header and side information are parsed in place, in the mapping
+  or in the read-ahead buffer of the file. When the stream is out of
+  sync, the bytes available in place are scanned for the next
+  confirmed header with \verb|mp3_sync_scan|, instead of moving the
+  header one byte at a time. Every skipped byte still counts against
+  \verb|MP3_MAX_SYNC|.
 **/
 int mp3_next_frame(file_t *mp3, mp3_frame_t *frame) {
   assert(mp3 != NULL);
   assert(frame != NULL);
 
+  unsigned char *raw = NULL;
+  if (mp3->map == NULL) {
+    assert(frame->raw != NULL);
+    raw = frame->raw;
+  }
+
+  int ret = 1;
   unsigned int resync = 0;
   again:
   if (resync != 0) {
-    /* read the next byte and build the new header */
-    frame->raw[0] = frame->raw[1];
-    frame->raw[1] = frame->raw[2];
-    frame->raw[2] = frame->raw[3];
+    file_seek_fwd(mp3, 1);
+
+    /* enough bytes to confirm a header found within the sync limit */
+    unsigned char *ptr = file_peek(mp3, MP3_MAX_SYNC + MP3_RAW_SIZE);
+    if (ptr == NULL)
+      ptr = file_peek(mp3, 1);
+    if (ptr != NULL) {
+      size_t skip = mp3_sync_scan(ptr, file_avail(mp3), 1);
+      file_seek_fwd(mp3, skip);
+      frame->syncskip += skip;
+      resync += skip;
+      if (resync > MP3_MAX_SYNC) {
+        fprintf(stderr, "Max sync exceeded: %d\n", resync);
+        ret = ESYNC;
+        goto out;
+      }
+    }
+  }
 
-    if (file_read(mp3, frame->raw + 3, 1) <= 0)
-      return EEOF;
-  } else {
-    if (file_read(mp3, frame->raw, MP3_HDR_SIZE) <= 0)
-      return EEOF;
+  /* room for the CRC, which is read with the header */
+  frame->raw = file_peek(mp3, MP3_HDR_SIZE + 2);
+  if (frame->raw == NULL) {
+    ret = EEOF;
+    goto out;
   }
 
   if ((frame->raw[0] == 0xFF) &&
       (((unsigned char) (frame->raw[1] >> 5) & 0x7u) == 0x7)) {
-    if (!mp3_read_hdr(frame))
+    if (!mp3_hdr_check(frame->raw) || !mp3_read_hdr(frame))
       goto resync;
     else
       resync = 0;
   } else if ((frame->raw[0] == 'I') &&
              (frame->raw[1] == 'D') &&
              (frame->raw[2] == '3')) {
+    file_seek_fwd(mp3, MP3_HDR_SIZE);
     if (!mp3_skip_id3v2(mp3, frame)) {
       goto resync;
     } else {
@@ -806,19 +920,32 @@ int mp3_next_frame(file_t *mp3, mp3_frame_t *frame) {
   if (frame->frame_size > MP3_RAW_SIZE)
     goto resync;
 
-  if (file_read(mp3, frame->raw + 4, frame->frame_size - 4) <= 0)
-    return EEOF;
+  /* peeking may move the buffered header */
+  frame->raw = file_peek(mp3, frame->frame_size);
+  if (frame->raw == NULL) {
+    ret = EEOF;
+    goto out;
+  }
+  file_seek_fwd(mp3, frame->frame_size);
 
   if (!mp3_read_si(frame))
     goto again;
 
-  return 1;
+  if (raw != NULL)
+    memcpy(raw, frame->raw, frame->frame_size);
+
+  out:
+  if (raw != NULL)
+    frame->raw = raw;
+  frame->mapped = (raw == NULL);
+  return ret;
 
   resync:
   frame->syncskip++;
   if (resync++ > MP3_MAX_SYNC) {
     fprintf(stderr, "Max sync exceeded: %d\n", resync);
-    return ESYNC;
+    ret = ESYNC;
+    goto out;
   } else
     goto again;
 }
@@ -841,7 +968,8 @@ int mp3_unpack(mp3_frame_t *frame) {
 #ifdef MP3_TEST
 int main(int argc, char *argv[]) {
   mp3_file_t  file;
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
 
   char *f;
   if (!(f = *++argv)) {
@@ -14,8 +14,9 @@
 /*M
   \emph{Read scalefactor information.}
 **/
-int mp3_read_sf(mp3_frame_t *frame) {
+int mp3_read_sf(mp3_frame_t *frame, mp3_sf_t sf_info[2][2]) {
   assert(frame != NULL);
+  assert(sf_info != NULL);
 
   unsigned int granule_offset = 0;
   
@@ -26,7 +27,7 @@ int mp3_read_sf(mp3_frame_t *frame) {
     unsigned int j;
     for (j = 0; j < nch; j++) {
       mp3_granule_t *gr = &frame->si.channel[j].granule[i];
-      mp3_sf_t *sf = &gr->sf;
+      mp3_sf_t *sf = &sf_info[j][i];
 
       unsigned int bit0 = granule_offset & 7;
       bv_t bv;
@@ -99,7 +100,7 @@ int mp3_read_sf(mp3_frame_t *frame) {
           /* second granule, check scalefactor selection information
              */
           mp3_channel_t *channel = &frame->si.channel[j];
-          mp3_sf_t *sf1 = &channel->granule[0].sf;
+          mp3_sf_t *sf1 = &sf_info[j][0];
           unsigned int sfb;
 
           if (gr->slen0 > 0) {
@@ -150,8 +151,9 @@ int mp3_read_sf(mp3_frame_t *frame) {
 /*M
   \emph{Fill MPEG frame with scalefactor information.}
 **/
-int mp3_fill_sf(mp3_frame_t *frame) {
+int mp3_fill_sf(mp3_frame_t *frame, mp3_sf_t sf_info[2][2]) {
   assert(frame != NULL);
+  assert(sf_info != NULL);
 
   unsigned int granule_offset = 0;
 
@@ -162,7 +164,7 @@ int mp3_fill_sf(mp3_frame_t *frame) {
     unsigned int j;
     for (j = 0; j < nch; j++) {
       mp3_granule_t *gr = &frame->si.channel[j].granule[i];
-      mp3_sf_t *sf = &gr->sf;
+      mp3_sf_t *sf = &sf_info[j][i];
 
       unsigned int bit0 = granule_offset & 7;
       bv_t bv;
@@ -312,7 +314,9 @@ int main(int argc, char *argv[]) {
   aq_init(&qin);
   aq_init(&qout);
 
-  mp3_frame_t frame = {0};
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
+  mp3_sf_t sf[2][2];
   while (mp3_next_frame(&in, &frame) > 0) {
     static int cin = 0;
     printf("%d in, cksum %ld\n", cin++,
@@ -323,7 +327,7 @@ int main(int argc, char *argv[]) {
       assert(adu != NULL);
 
       static int cadu = 0;
-      mp3_read_sf(adu);
+      mp3_read_sf(adu, sf);
       printf("frame %d\n", cadu);
       unsigned int i;
       for (i = 0; i < 2; i++) {
@@ -332,23 +336,23 @@ int main(int argc, char *argv[]) {
           unsigned int l;
           printf("ch %d, gr %d: ", j, i);
           for (l = 0; l < 22; l++)
-            printf("%d, ", adu->si.channel[j].granule[i].sf.l[l]);
+            printf("%d, ", sf[j][i].l[l]);
           printf("\n");
         }
       }
-      unsigned oldck = cksum(adu->raw, MP3_RAW_SIZE);
-      mp3_fill_sf(adu);
-      unsigned newck = cksum(adu->raw, MP3_RAW_SIZE);
+      unsigned oldck = cksum(adu->raw, mp3_frame_size(adu));
+      mp3_fill_sf(adu, sf);
+      unsigned newck = cksum(adu->raw, mp3_frame_size(adu));
       if (newck != oldck)
         printf("corruption on frame %d\n", cadu);
-      mp3_read_sf(adu);
+      mp3_read_sf(adu, sf);
       for (i = 0; i < 2; i++) {
         unsigned int j;
         for (j = 0; j < 2; j++) {
           unsigned int l;
           printf("ch %d, gr %d: ", j, i);          
           for (l = 0; l < 22; l++)
-            printf("%d, ", adu->si.channel[j].granule[i].sf.l[l]);
+            printf("%d, ", sf[j][i].l[l]);
           printf("\n");
         }
       }
@@ -375,10 +379,10 @@ int main(int argc, char *argv[]) {
                cksum(frame_out->raw,
                      frame_out->frame_size));
         
-        free(frame_out);
+        aq_release(&qout, frame_out);
       }
 
-      free(adu);
+      aq_release(&qin, adu);
     }
 
     /*    fgetc(stdin); */
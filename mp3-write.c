@@ -168,7 +168,8 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
   while (mp3_next_frame(&in, &frame) > 0) {
     memset(frame.raw, 0, 4 + frame.si_size);
     if (!mp3_fill_hdr(&frame) ||
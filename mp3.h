@@ -6,9 +6,10 @@
 #define MP3_H__
 
 /*M
-  \emph{Size allocated for the ''raw'' content of an MP3 frame.}
+  \emph{Size of the buffers MP3 frames are read into.}
 
-  This is an arbitrary size.
+  This is an arbitrary size. Frames and ADUs held in an ADU queue only
+  take the room of the payload they use.
 **/
 #define MP3_RAW_SIZE 4000
 /*M
@@ -28,17 +29,15 @@
 
 /*M
   \emph{Scalefactor information contained in a single granule.}
+
+  Only needed to decode the audio data, it is kept out of the frame
+  and indexed by channel and granule.
 **/
 typedef struct {
   unsigned int l[23];     /* long window */
   unsigned int s[3][13];  /* short window */
 } mp3_sf_t;
 
-typedef struct {
-  int   s;
-  float x;
-} mp3_sample_t;
-
 /*M
   \emph{MP3 granule.}
 **/
@@ -69,11 +68,6 @@ typedef struct mp3_granule_s {
   unsigned int preflag;
   unsigned int scale_scale;
   unsigned int cnt1tbl_sel;
-  float        *full_gain[3];
-  float        *pow2gain;
-
-  mp3_sf_t     sf; /* scale factor */
-  mp3_sample_t samples[576];
 } mp3_granule_t;
 
 /*M
@@ -98,6 +92,21 @@ typedef struct mp3_si_s {
 
 /*M
   \emph{Single MP3 frame.}
+
+  The frame descriptor holds the header, the side information and the
+  sizes of the frame. The payload, beginning with the raw header and
+  side information, is referenced by \verb|raw|. It holds
+  \verb|frame_size| bytes for an MP3 frame, and
+  \verb|mp3_frame_size| bytes for an ADU. Frames are read into a
+  buffer of \verb|MP3_RAW_SIZE| bytes:
+
+\begin{verbatim}
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
+\end{verbatim}
+
+  Frames of a mapped file are not copied, \verb|raw| then points into
+  the mapping, and the frame can only be used with this file.
 **/
 typedef struct mp3_frame_s {
   unsigned char id;
@@ -130,21 +139,30 @@ typedef struct mp3_frame_s {
   unsigned long  frame_data_size;
   unsigned long  usec;
   
-  /* XXX add length counter for overflow checking */
-  unsigned char  raw[MP3_RAW_SIZE];
+  unsigned char  *raw;
+  /*M
+    Set when \verb|raw| points into the mapping of the file the frame
+    was read from, it stays valid until the file is closed.
+  **/
+  unsigned char  mapped;
 } mp3_frame_t;
 
 /*M
   \emph{Prototypes and macros.}
 **/
+#define mp3_frame_hdr_size(f) \
+  (4 + ((f)->protected ? 0 : 2) + (f)->si_size)
 #define mp3_frame_data_begin(f) \
-  ((f)->raw + 4 + ((f)->protected ? 0 : 2) + (f)->si_size)
+  ((f)->raw + mp3_frame_hdr_size(f))
 
 #include "file.h"
 
 int mp3_read_si(mp3_frame_t *frame);
 int mp3_read_hdr(mp3_frame_t *frame);
-int mp3_read_sf(mp3_frame_t *frame);
+int mp3_hdr_check(unsigned char *hdr);
+size_t mp3_sync_scan(unsigned char *buf, size_t len, int confirm);
+int mp3_read_sf(mp3_frame_t *frame, mp3_sf_t sf[2][2]);
+int mp3_fill_sf(mp3_frame_t *frame, mp3_sf_t sf[2][2]);
 int mp3_next_frame(file_t *mp3, mp3_frame_t *frame);
 int mp3_unpack(mp3_frame_t *frame);
 
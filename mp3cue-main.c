@@ -190,7 +190,8 @@ int main(int argc, char *argv[]) {
           Read while current < end or till the end of the file if it's the last track.
         **/
         while ((current < end) || (i == (cuefile.track_number - 1))) {
-            mp3_frame_t frame;
+            unsigned char raw[MP3_RAW_SIZE];
+            mp3_frame_t frame = { .raw = raw };
             if (mp3_next_frame(&mp3file, &frame) > 0) {
                 if (aq_add_frame(&qin, &frame)) {
                     adu_t *adu = aq_get_adu(&qin);
@@ -211,10 +212,10 @@ int main(int argc, char *argv[]) {
                             goto exit;
                         }
 
-                        free(frame_out);
+                        aq_release(&qout, frame_out);
                     }
 
-                    free(adu);
+                    aq_release(&qin, adu);
                 }
 
                 current += frame.usec / 1000;
@@ -283,7 +283,8 @@ int main(int argc, char *argv[]) {
         break;
       }
 
-      mp3_frame_t frame;
+      unsigned char raw[MP3_RAW_SIZE];
+      mp3_frame_t frame = { .raw = raw };
       int ret;
       if ((ret = mp3_next_frame(&mp3file, &frame)) > 0) {
         if (aq_add_frame(&qin, &frame)) { 
@@ -309,12 +310,12 @@ int main(int argc, char *argv[]) {
                 goto exit;
               }
               
-              free(frame_out);
+              aq_release(&qout, frame_out);
             }
           }
 
           current += adu->usec;
-          free(adu);
+          aq_release(&qin, adu);
           
         } else {
           /* ignore error */
@@ -33,7 +33,8 @@ int main(int argc, char *argv[]) {
   aq_t qin;
   aq_init(&qin);
   
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
   int ret;
   unsigned long long time = 0;
   while ((ret = mp3_next_frame(&mp3file, &frame)) > 0) {
@@ -42,7 +43,7 @@ int main(int argc, char *argv[]) {
       assert(adu != NULL);
       
       time += adu->usec;
-      free(adu);
+      aq_release(&qin, adu);
     }
   }
           
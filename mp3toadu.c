@@ -32,7 +32,8 @@ int main(int argc, char *argv[]) {
     goto exit;
   }
 
-  mp3_frame_t frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t frame = { .raw = raw };
   int ret;
   while (mp3_next_frame(&infile, &frame) > 0) {
     if (aq_add_frame(&qin, &frame)) {
@@ -47,7 +48,7 @@ int main(int argc, char *argv[]) {
       ret = write(STDOUT_FILENO, adu->raw, adu->adu_size);
       assert(ret == adu->adu_size);
 
-      free(adu);
+      aq_release(&qin, adu);
     }
   }
   file_close(&infile);
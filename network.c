@@ -2,8 +2,27 @@
   (c) 2005 bl0rg.net
 **/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* recvmmsg, sendmmsg */
+#endif
+
 #include "conf.h"
 
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#ifdef HAVE_SO_TXTIME
+#include <linux/net_tstamp.h>
+#endif /* HAVE_SO_TXTIME */
+
+#include "network.h"
+
 int net_seqnum_diff(unsigned long seq1, unsigned long seq2,
                     unsigned long maxseq) {
   if (seq2 >= seq1) {
@@ -20,6 +39,263 @@ int net_seqnum_diff(unsigned long seq1, unsigned long seq2,
   }
 }
 
+/*M
+  \emph{Initialize a receive batch of \verb|size| datagrams.}
+
+  The buffers have to be set with \verb|net_batch_set_buf| before
+  receiving.
+**/
+void net_batch_init(net_batch_t *batch, unsigned int size) {
+  assert(batch != NULL);
+  assert(size > 0);
+
+  batch->size = size;
+  batch->cnt = 0;
+  batch->ctrl = NULL;
+  batch->iovs = calloc(size, sizeof(struct iovec));
+  batch->lengths = calloc(size, sizeof(unsigned int));
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+  batch->msgs = calloc(size, sizeof(struct mmsghdr));
+#else
+  batch->msgs = NULL;
+#endif /* HAVE_RECVMMSG || HAVE_SENDMMSG */
+  assert((batch->iovs != NULL) && (batch->lengths != NULL));
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+  assert(batch->msgs != NULL);
+  struct mmsghdr *msgs = batch->msgs;
+  unsigned int i;
+  for (i = 0; i < size; i++) {
+    msgs[i].msg_hdr.msg_iov = batch->iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif /* HAVE_RECVMMSG || HAVE_SENDMMSG */
+}
+
+/*M
+  \emph{Destroy a receive batch.}
+
+  The datagram buffers belong to the application.
+**/
+void net_batch_destroy(net_batch_t *batch) {
+  assert(batch != NULL);
+
+  free(batch->iovs);
+  free(batch->lengths);
+  if (batch->msgs != NULL)
+    free(batch->msgs);
+  if (batch->ctrl != NULL)
+    free(batch->ctrl);
+
+  batch->iovs = NULL;
+  batch->lengths = NULL;
+  batch->msgs = NULL;
+  batch->ctrl = NULL;
+  batch->size = batch->cnt = 0;
+}
+
+/*M
+  \emph{Set the buffer for datagram \verb|i| of a receive batch.}
+**/
+void net_batch_set_buf(net_batch_t *batch, unsigned int i,
+                       unsigned char *buf, unsigned int size) {
+  assert(batch != NULL);
+  assert(i < batch->size);
+  assert(buf != NULL);
+
+  batch->iovs[i].iov_base = buf;
+  batch->iovs[i].iov_len = size;
+}
+
+/*M
+  \emph{Receive the datagrams waiting on a socket.}
+
+  Does not block. Receives at most \verb|size| datagrams into the
+  batch buffers, with a single \verb|recvmmsg| call where available,
+  else with one \verb|recvmsg| per datagram. Returns the number of
+  received datagrams, 0 if none was waiting, -1 on error.
+**/
+int net_batch_recv(net_batch_t *batch, int fd) {
+  assert(batch != NULL);
+
+  batch->cnt = 0;
+
+#ifdef HAVE_RECVMMSG
+  struct mmsghdr *msgs = batch->msgs;
+  unsigned int i;
+  for (i = 0; i < batch->size; i++) {
+    msgs[i].msg_hdr.msg_name = NULL;
+    msgs[i].msg_hdr.msg_namelen = 0;
+    msgs[i].msg_hdr.msg_control = NULL;
+    msgs[i].msg_hdr.msg_controllen = 0;
+    msgs[i].msg_hdr.msg_flags = 0;
+  }
+
+  int ret = recvmmsg(fd, msgs, batch->size, MSG_DONTWAIT, NULL);
+  if (ret < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return 0;
+    return -1;
+  }
+
+  for (i = 0; i < ret; i++) {
+    if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      batch->lengths[i] = 0;
+    else
+      batch->lengths[i] = msgs[i].msg_len;
+  }
+  batch->cnt = ret;
+#else
+  while (batch->cnt < batch->size) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = batch->iovs + batch->cnt;
+    msg.msg_iovlen = 1;
+
+    ssize_t len = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (len < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        break;
+      if (batch->cnt == 0)
+        return -1;
+      break;
+    }
+
+    if (msg.msg_flags & MSG_TRUNC)
+      batch->lengths[batch->cnt] = 0;
+    else
+      batch->lengths[batch->cnt] = len;
+    batch->cnt++;
+  }
+#endif /* HAVE_RECVMMSG */
+
+  return batch->cnt;
+}
+
+/*M
+  \emph{Size of the control message carrying a send timestamp.}
+**/
+#ifdef HAVE_SO_TXTIME
+#define NET_TXTIME_CTRL_SIZE CMSG_SPACE(sizeof(unsigned long long))
+#endif /* HAVE_SO_TXTIME */
+
+/*M
+  \emph{Fill the message header for datagram \verb|i| of a batch.}
+
+  If \verb|txtime| is not $0$, the datagram carries its send time (in
+  nanoseconds, see \verb|net_txtime_now|).
+**/
+static void net_batch_msg(net_batch_t *batch, struct msghdr *msg,
+                          unsigned int i,
+                          struct sockaddr *to, socklen_t tolen,
+                          unsigned long long txtime) {
+  memset(msg, 0, sizeof(*msg));
+  msg->msg_name = to;
+  msg->msg_namelen = tolen;
+  msg->msg_iov = batch->iovs + i;
+  msg->msg_iovlen = 1;
+
+#ifdef HAVE_SO_TXTIME
+  if (txtime != 0) {
+    if (batch->ctrl == NULL) {
+      batch->ctrl = calloc(batch->size, NET_TXTIME_CTRL_SIZE);
+      assert(batch->ctrl != NULL);
+    }
+
+    msg->msg_control = batch->ctrl + i * NET_TXTIME_CTRL_SIZE;
+    msg->msg_controllen = NET_TXTIME_CTRL_SIZE;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned long long));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+  }
+#endif /* HAVE_SO_TXTIME */
+}
+
+/*M
+  \emph{Send a run of datagrams of a batch.}
+
+  Sends the \verb|cnt| datagrams starting at \verb|first| to
+  \verb|to|, with a single \verb|sendmmsg| call where available, else
+  with one \verb|sendmsg| per datagram. If \verb|txtimes| is not
+  \verb|NULL|, it holds the send time of each datagram (the socket
+  has to be set up with \verb|net_udp_set_txtime|). Returns the
+  number of sent datagrams, which can be less than \verb|cnt|, or -1
+  if the first datagram could not be sent.
+**/
+int net_batch_send(net_batch_t *batch, int fd,
+                   struct sockaddr *to, socklen_t tolen,
+                   unsigned int first, unsigned int cnt,
+                   unsigned long long *txtimes) {
+  assert(batch != NULL);
+  assert(first + cnt <= batch->size);
+
+  if (cnt == 0)
+    return 0;
+
+  unsigned int i;
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr *msgs = batch->msgs;
+  for (i = first; i < first + cnt; i++) {
+    net_batch_msg(batch, &msgs[i].msg_hdr, i, to, tolen,
+                  txtimes ? txtimes[i - first] : 0);
+    msgs[i].msg_len = 0;
+  }
+
+  return sendmmsg(fd, msgs + first, cnt, 0);
+#else
+  for (i = first; i < first + cnt; i++) {
+    struct msghdr msg;
+    net_batch_msg(batch, &msg, i, to, tolen,
+                  txtimes ? txtimes[i - first] : 0);
+
+    if (sendmsg(fd, &msg, 0) < 0) {
+      if (i == first)
+        return -1;
+      break;
+    }
+  }
+
+  return i - first;
+#endif /* HAVE_SENDMMSG */
+}
+
+/*M
+  \emph{Enable per datagram send times on a socket.}
+
+  The send times are given in nanoseconds of the monotonic clock (see
+  \verb|net_txtime_now|), and are only honoured by the \verb|fq|
+  queueing discipline. \verb|etf| works on \verb|CLOCK_TAI| and drops
+  these packets. Returns 1 on success, 0 if not supported.
+**/
+int net_udp_set_txtime(int fd) {
+#ifdef HAVE_SO_TXTIME
+  struct sock_txtime txtime;
+  memset(&txtime, 0, sizeof(txtime));
+  txtime.clockid = CLOCK_MONOTONIC;
+  txtime.flags = 0;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0)
+    return 0;
+
+  return 1;
+#else
+  return 0;
+#endif /* HAVE_SO_TXTIME */
+}
+
+/*M
+  \emph{Get the current time for datagram send times.}
+
+  In nanoseconds.
+**/
+unsigned long long net_txtime_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
 /*C
 **/
@@ -6,6 +6,9 @@
 #define NET_H__
 
 #include "netinet/in.h"
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 int net_ip4_resolve_hostname(const char *hostname,
                              unsigned short port,
@@ -54,6 +57,54 @@ int net_tcp6_accept_socket(int s, unsigned char ip[16], unsigned short *port);
 int net_seqnum_diff(unsigned long seq1, unsigned long seq2,
                     unsigned long maxseq);
 
+/*M
+  \emph{Batch of datagrams.}
+
+  Drains a datagram socket with as few system calls as possible
+  (\verb|recvmmsg| where available), or sends a run of datagrams
+  (\verb|sendmmsg|). The datagram buffers are provided by the
+  application, so that packets can be received directly into packet
+  structures.
+**/
+typedef struct net_batch_s {
+  unsigned int size;
+  struct iovec *iovs;
+  /*M
+    Lengths of the received datagrams, $0$ for truncated datagrams.
+  **/
+  unsigned int *lengths;
+  /*M
+    Number of datagrams received by the last \verb|net_batch_recv|.
+  **/
+  unsigned int cnt;
+  /*M
+    System specific message headers.
+  **/
+  void *msgs;
+  /*M
+    Control message buffers for send timestamps.
+  **/
+  unsigned char *ctrl;
+} net_batch_t;
+
+/*M
+  \emph{Default number of datagrams in a receive batch.}
+**/
+#define NET_BATCH_SIZE 32
+
+void net_batch_init(net_batch_t *batch, unsigned int size);
+void net_batch_destroy(net_batch_t *batch);
+void net_batch_set_buf(net_batch_t *batch, unsigned int i,
+                       unsigned char *buf, unsigned int size);
+int net_batch_recv(net_batch_t *batch, int fd);
+int net_batch_send(net_batch_t *batch, int fd,
+                   struct sockaddr *to, socklen_t tolen,
+                   unsigned int first, unsigned int cnt,
+                   unsigned long long *txtimes);
+
+int net_udp_set_txtime(int fd);
+unsigned long long net_txtime_now(void);
+
 /*C
 **/
 
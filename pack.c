@@ -30,6 +30,14 @@ unsigned int uint32_unpack__(/*@out@*/ unsigned char **ptr) {
    return (i |=  *((*ptr)++) & 0xFF);
 }
 
+/*M
+  \emph{Unpack a big endian 64 bit integer.}
+**/
+unsigned long long uint64_unpack__(/*@out@*/ unsigned char **ptr) {
+  unsigned long long i = uint32_unpack__(ptr);
+  return (i << 32) | uint32_unpack__(ptr);
+}
+
 /*M
   \emph{Unpack a little endian 16 bit integer.}
 
@@ -70,7 +78,8 @@ void testit(char *name, int result, int should) {
 int main(void) {
   int i16 = 0x1234,
       i32 = 0x12345678;
-  unsigned char test[4], *ptr;
+  unsigned long long i64 = 0x123456789abcdef0ULL;
+  unsigned char test[8], *ptr;
 
   ptr = test;
   UINT16_PACK(ptr, i16);
@@ -92,6 +101,13 @@ int main(void) {
   testit("Big Endianness 32 3/4", test[2], 0x56);
   testit("Big Endianness 32 4/4", test[3], 0x78);
 
+  ptr = test;
+  UINT64_PACK(ptr, i64);
+  testit("Big Endianness 64 1/8", test[0], 0x12);
+  testit("Big Endianness 64 8/8", test[7], 0xf0);
+  ptr = test;
+  testit("UNPACK after PACK 64", UINT64_UNPACK(ptr) == i64, 1);
+
   return 0;
 }
 #endif
@@ -47,6 +47,17 @@
     *(ptr++) = (unsigned char)(((i) >> 8)  & 0xFF); \
     *(ptr++) = (unsigned char)((i)         & 0xFF); }
 
+/*M
+  \emph{64 bits value packing macro.}
+
+  This macro advances the buffer pointer it is given as first
+  argument, and fills the buffer with the big endian packed value
+  given as second argument.
+**/
+#define UINT64_PACK(ptr, i)                                  \
+  { UINT32_PACK(ptr, (unsigned long long)(i) >> 32);         \
+    UINT32_PACK(ptr, (unsigned long long)(i) & 0xFFFFFFFFULL); }
+
 /*M
   \emph{24 bits value packing macro.}
 **/
@@ -74,6 +85,16 @@ unsigned int uint16_unpack__(/*@out@*/ unsigned char **ptr);
 #define UINT32_UNPACK(ptr) uint32_unpack__(&ptr)
 unsigned int uint32_unpack__(/*@out@*/ unsigned char **ptr);
 
+/*M
+  \emph{64 bits value unpacking macro.}
+
+  This macro advances the buffer pointer it is given as first
+  argument, and returns the unpacked big endian value in the
+  buffer.
+**/
+#define UINT64_UNPACK(ptr) uint64_unpack__(&ptr)
+unsigned long long uint64_unpack__(/*@out@*/ unsigned char **ptr);
+
 /*M
   \emph{16 bits value packing macro.}
 
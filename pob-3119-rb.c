@@ -28,6 +28,7 @@
 #include "rtp-rb.h"
 #include "aq.h"
 #include "network.h"
+#include "impair.h"
 
 #ifdef WITH_OPENSSL
 RSA *rsa = NULL;
@@ -35,6 +36,21 @@ RSA *rsa = NULL;
 
 #define RTP_MINSLEEP 20000 /* 200 ms */
 
+/*M
+  \emph{Maximal number of packets received with one system call.}
+**/
+static unsigned int batch_size = NET_BATCH_SIZE;
+
+/*M
+  \emph{Packet ring buffer.}
+**/
+static rtp_rb_t rtp_rb;
+
+/*M
+  \emph{Impairment of the received packets (\verb|-P|).}
+**/
+static impair_t impair;
+
 /*M
   \emph{Structure to hold client accounting information.}
 
@@ -111,29 +127,41 @@ int pob_insert_pkt(rtp_pkt_t *pkt) {
 
   int num = 0;
   /* insert packet into ringbuffer */
-  if (rtp_rb_length() > 0) {
+  if (rtp_rb_length(&rtp_rb) > 0) {
     /* get index of first packet */
-    rtp_pkt_t *firstpkt = rtp_rb_first();
+    rtp_pkt_t *firstpkt = rtp_rb_first(&rtp_rb);
     assert(firstpkt != NULL);
     assert(firstpkt->length != 0);
     
     num = net_seqnum_diff(firstpkt->b.seq, pkt->b.seq, 1 << 16);
   }
 
-  if (!rtp_rb_insert_pkt(pkt, num)) {
+  int ret = rtp_rb_insert_pkt(&rtp_rb, pkt, num);
+  if (ret == 0) {
 #ifdef DEBUG
     fprintf(stderr, "ring buffer full\n");
 #endif
     
-    rtp_rb_clear();
+    rtp_rb_clear(&rtp_rb);
     tstamp_last = pkt->timestamp;
     return pob_insert_pkt(pkt);
   } else {
+    if (ret < 0)
+      pob_stats.dup_pkts++;
     return 1;
   }
 }
 
-int pob_recv_pkt(int sock, rtp_pkt_t *pkt) {
+/*M
+  \emph{Receive the waiting packets into a batch.}
+
+  Waits for network input, then drains the socket into the packets
+  of the batch with as few system calls as possible. The batch is
+  passed through the impairment, held back packets are delivered
+  even if none was received. Returns the number of received packets,
+  0 on timeout, -1 on error.
+**/
+int pob_recv_pkts(int sock, net_batch_t *batch, rtp_pkt_t *pkts) {
   struct timeval t_out;
   t_out.tv_sec  = 0;
   t_out.tv_usec = RTP_MINSLEEP;
@@ -160,16 +188,17 @@ int pob_recv_pkt(int sock, rtp_pkt_t *pkt) {
   }
   
   /*M
-    If there is network input, read incoming packet.
+    If there is network input, read the incoming packets.
   **/
-  if (FD_ISSET(sock, &fds)) {
-    rtp_rfc3119_pkt_init(pkt);
-    
-    if (rtp_pkt_read(pkt, sock) <= 0) {
+  if (FD_ISSET(sock, &fds) || impair_pending(&impair)) {
+    unsigned int i;
+    for (i = 0; i < batch->size; i++)
+      rtp_rfc3119_pkt_init(pkts + i);
+
+    batch->cnt = 0;
+    if (FD_ISSET(sock, &fds) && (net_batch_recv(batch, sock) < 0))
       return -1;
-    } else {
-      return 1;
-    }
+    return impair_batch(&impair, batch);
   }
 
   return 0;
@@ -199,20 +228,30 @@ int pob_mainloop(int sock, int quiet) {
   aq_t frame_queue;
   aq_init(&frame_queue);
   
+  /*M
+    Initialize the receive batch.
+  **/
+  rtp_pkt_t *pkts = malloc(sizeof(rtp_pkt_t) * batch_size);
+  assert(pkts != NULL);
+  net_batch_t batch;
+  net_batch_init(&batch, batch_size);
+  unsigned int i;
+  for (i = 0; i < batch_size; i++)
+    net_batch_set_buf(&batch, i, pkts[i].data, RTP_PKT_SIZE);
+
   int finished = 0;
   while (!finished) {
     static int prebuffering = 0;
-    
-    rtp_pkt_t pkt;
 
-    if (rtp_rb_cnt == 0) {
+    if (rtp_rb.cnt == 0) {
       prebuffering = 1;
     }
     
     /*M
-      Receive next packet.
+      Receive the next packets.
     */
-    switch (pob_recv_pkt(sock, &pkt)) {
+    int cnt;
+    switch (cnt = pob_recv_pkts(sock, &batch, pkts)) {
     case 0:
       break;
 
@@ -222,11 +261,19 @@ int pob_mainloop(int sock, int quiet) {
 
     default:
       /*M
-        Insert new packet into the buffering list.
+        Insert the new packets into the buffering list, dropping
+        truncated and invalid packets.
       **/
-      if (!pob_insert_pkt(&pkt)) {
-        retval = 0;
-        goto exit;
+      for (i = 0; i < (unsigned int)cnt; i++) {
+        rtp_pkt_t *pkt = pkts + i;
+        if ((batch.lengths[i] == 0) ||
+            (rtp_pkt_parse(pkt, batch.lengths[i]) <= 0))
+          continue;
+
+        if (!pob_insert_pkt(pkt)) {
+          retval = 0;
+          goto exit;
+        }
       }
     }
 
@@ -239,8 +286,8 @@ int pob_mainloop(int sock, int quiet) {
       (unsigned long)(tv.tv_usec / 11.111);
     
     if (prebuffering == 1) {
-      if (rtp_rb_cnt >= (rtp_rb_size / 2)) {
-        rtp_pkt_t *firstpkt = rtp_rb_first();
+      if (rtp_rb.cnt >= (rtp_rb.size / 2)) {
+        rtp_pkt_t *firstpkt = rtp_rb_first(&rtp_rb);
         assert(firstpkt != NULL);
         assert(firstpkt->length != 0);
         
@@ -256,7 +303,7 @@ int pob_mainloop(int sock, int quiet) {
         **/
         if (!quiet)
           fprintf(stderr, "Prebuffering: %.2f%%\r",
-                  (float)rtp_rb_cnt / (rtp_rb_size / 2.0) * 100.0);
+                  (float)rtp_rb.cnt / (rtp_rb.size / 2.0) * 100.0);
 
         continue;
       }
@@ -272,19 +319,19 @@ int pob_mainloop(int sock, int quiet) {
                 pob_stats.rcvd_pkts,
                 pob_stats.dup_pkts,
                 pob_stats.ooo_pkts,
-                rtp_rb_cnt,
-                rtp_rb_length());
+                rtp_rb.cnt,
+                rtp_rb_length(&rtp_rb));
       }
     }
 
 #ifdef DEBUG
-    rtp_rb_print();
+    rtp_rb_print(&rtp_rb);
 #endif
 
     unsigned long tstamp_now = tstamp_last + (time_now - time_last);
 
-    while (rtp_rb_length() > 0) {
-      rtp_pkt_t *pkt = rtp_rb_first();
+    while (rtp_rb_length(&rtp_rb) > 0) {
+      rtp_pkt_t *pkt = rtp_rb_first(&rtp_rb);
       assert(pkt != NULL);
 
       if (pkt->length != 0) {
@@ -299,13 +346,13 @@ int pob_mainloop(int sock, int quiet) {
         if (pkt->length > ((1 << 6) - 1))
           ptr++;
         
-        adu_t adu;
-        memcpy(adu.raw, ptr, pkt->length);
-        if (!mp3_unpack(&adu)) {
+        adu_t adu = { .raw = ptr };
+        if (!mp3_unpack(&adu) ||
+            (mp3_frame_size(&adu) > pkt->length)) {
           fprintf(stderr, "Error unpacking the mp3 adu\n");
           
           pkt->length = 0;
-          rtp_rb_cnt--;
+          rtp_rb.cnt--;
           
           retval = 0;
           goto exit;
@@ -328,10 +375,10 @@ int pob_mainloop(int sock, int quiet) {
                      frame->raw,
                      frame->frame_size) < (int)frame->frame_size)) {
             fprintf(stderr, "Error writing to stdout\n");
-            free(frame);
+            aq_release(&frame_queue, frame);
             
             pkt->length = 0;
-            rtp_rb_cnt--;
+            rtp_rb.cnt--;
             
             retval = 0;
             goto exit;
@@ -340,15 +387,18 @@ int pob_mainloop(int sock, int quiet) {
           time_last = time_now;
           tstamp_last = tstamp_now;
           
-          free(frame);
+          aq_release(&frame_queue, frame);
         }
       }
       
-      rtp_rb_pop();
+      rtp_rb_pop(&rtp_rb);
     }
   }
   
  exit:
+  net_batch_destroy(&batch);
+  free(pkts);
+
   /*M
     Destroy the ADU queue.
   **/
@@ -361,7 +411,7 @@ int pob_mainloop(int sock, int quiet) {
   \emph{Print RFC3119 RTP client usage.}
 **/
 static void usage(void) {
-  fprintf(stderr, "Usage: ./pob [-s address] [-p port] [-b size] [-t time] [-q]");
+  fprintf(stderr, "Usage: ./pob [-s address] [-p port] [-b size] [-r batch] [-P spec] [-t time] [-q]");
 #ifdef WITH_OPENSSL
   fprintf(stderr, "[-c cert]");
 #endif
@@ -369,6 +419,9 @@ static void usage(void) {
   fprintf(stderr, "\t-s address : destination address (default 0.0.0.0 or ff02::4)\n");
   fprintf(stderr, "\t-p port    : destination port (default 1500)\n");
   fprintf(stderr, "\t-b size    : maximal number of packets in buffer (default 128)\n");
+  fprintf(stderr, "\t-r batch   : maximal number of packets per receive call (default 32)\n");
+  fprintf(stderr, "\t-P spec    : impair the received packets, for example loss=5,p=1,r=20\n");
+  fprintf(stderr, "\t             (default $" IMPAIR_ENV ")\n");
   fprintf(stderr, "\t-q         : quiet\n");
 
 #ifdef WITH_OPENSSL
@@ -384,6 +437,7 @@ int main(int argc, char *argv[]) {
   unsigned short port = 1500;
   unsigned int buffer_size = 128;
   int            retval = EXIT_SUCCESS, quiet = 0;
+  char           *impair_spec = NULL;
 #ifdef WITH_OPENSSL
   X509     *x509 = NULL;
   EVP_PKEY *pkey = NULL;
@@ -393,7 +447,7 @@ int main(int argc, char *argv[]) {
     Process the command line arguments.
   **/
   int c;
-  while ((c = getopt(argc, argv, "hs:p:b:t:q"
+  while ((c = getopt(argc, argv, "hs:p:b:r:P:t:q"
 #ifdef WITH_OPENSSL
     "c:"
 #endif
@@ -414,6 +468,12 @@ int main(int argc, char *argv[]) {
       buffer_size = (unsigned short)atoi(optarg);
       break;
 
+    case 'r':
+      batch_size = (unsigned int)atoi(optarg);
+      if (batch_size == 0)
+        batch_size = 1;
+      break;
+
     case 'q':
       quiet = 1;
       break;
@@ -462,6 +522,10 @@ int main(int argc, char *argv[]) {
       }
 #endif
       
+    case 'P':
+      impair_spec = optarg;
+      break;
+
     case 'h':
     default:
       usage();
@@ -470,10 +534,19 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (!impair_init(&impair, impair_spec)) {
+    fprintf(stderr, "Invalid impairment specification\n");
+    retval = EXIT_FAILURE;
+    goto exit;
+  }
+  if (impair.enabled && !quiet)
+    fprintf(stderr, "Impairing the received packets, seed %llu\n",
+            impair.seed);
+
   /*M
     Initialize the ring buffer.
   **/
-  rtp_rb_init(buffer_size);
+  rtp_rb_init(&rtp_rb, buffer_size);
 
   if (address == NULL) {
 #ifdef WITH_IPV6
@@ -505,7 +578,8 @@ int main(int argc, char *argv[]) {
     perror("close");
   
  exit:
-  rtp_rb_destroy();
+  rtp_rb_destroy(&rtp_rb);
+  impair_destroy(&impair);
   
 #ifdef WITH_OPENSSL
   if (pkey)
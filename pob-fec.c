@@ -12,6 +12,8 @@
 #include <sys/time.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 
 #ifdef NEED_GETOPT_H__
 #include <getopt.h>
@@ -21,6 +23,7 @@
 #include "aq.h"
 #include "fec.h"
 #include "network.h"
+#include "impair.h"
 
 #include "fec-group.h"
 #include "fec-rb.h"
@@ -28,6 +31,23 @@
 
 #define FEC_MINSLEEP 20000 /* 200 ms */
 
+/*M
+  \emph{Largest ADU group accepted from the network.}
+
+  The GF(2^16) scheme lets the packet header ask for groups of up to
+  65535 packets of 65535 bytes. Groups larger than
+  \verb|POB_MAX_GROUP_LEN| bytes, or with more than \verb|POB_MAX_K|
+  ADUs, whose decoding matrix would be too large to invert, are
+  dropped before memory is reserved for them.
+**/
+#define POB_MAX_GROUP_LEN (64 * 1024 * 1024)
+#define POB_MAX_K         1024
+
+/*M
+  \emph{Maximal number of packets received with one system call.}
+**/
+static unsigned int batch_size = NET_BATCH_SIZE;
+
 /*M
   \emph{Structure to hold client accounting information.}
 
@@ -53,15 +73,20 @@ typedef struct pob_stat_s {
   unsigned int incomplete_groups;
 } pob_stat_t;
 
-static pob_stat_t pob_stats = {
-  0, 0, 0, 0
-};
-
 /*M
   \emph{Maximal buffer queue size (in packets).}
 **/
 static unsigned short buffer_size = 16;
 
+/*M
+  \emph{Loss reports (\verb|-F|, \verb|-W|).}
+
+  When \verb|fb_sock| is open, each channel sends a loss report to
+  the server after every \verb|report_window| played groups.
+**/
+static int fb_sock = -1;
+static unsigned int report_window = 16;
+
 /*
   - Receive FEC packets, sort them into current group structure
   - when group complete, decode group into adus and throw them into
@@ -72,43 +97,245 @@ static unsigned short buffer_size = 16;
  */
 
 /*M
-  \emph{Timestamp of last played group.}
+  \emph{Structure holding a received FEC stream.}
+
+  Each stream is received on its own socket, buffered in its own ring
+  buffer and written to its own output file descriptor.
 **/
-static unsigned long tstamp_last = 0;
+typedef struct pob_channel_s {
+  /*M
+    Receiving socket.
+  **/
+  int sock;
+  /*M
+    Output file descriptor.
+  **/
+  int out;
+  /*M
+    Output name, for messages.
+  **/
+  char *name;
 
-int pob_insert_pkt(fec_pkt_t *pkt) {
-  assert(pkt != NULL);
+  /*M
+    Ring buffer of FEC groups.
+  **/
+  fec_rb_t rb;
+  /*M
+    Queue of decoded frames.
+  **/
+  aq_t frame_queue;
+  /*M
+    Accounting information.
+  **/
+  pob_stat_t stats;
+  /*M
+    Loss accounting of the played groups not reported yet.
+  **/
+  fec_report_t report;
+  /*M
+    Impairment of the received packets.
+  **/
+  impair_t impair;
+
+  /*M
+    Timestamp of last played group.
+  **/
+  unsigned long long tstamp_last;
+  /*M
+    Local time at which the last group was played.
+  **/
+  unsigned long time_last;
+  /*M
+    Set while the ring buffer is being filled.
+  **/
+  int prebuffering;
+  /*M
+    Set when the output could not be written.
+  **/
+  int finished;
+} pob_channel_t;
+
+/*M
+  \emph{Initialize a channel.}
+**/
+void pob_channel_init(pob_channel_t *ch, int sock, int out, char *name) {
+  assert(ch != NULL);
+  assert(name != NULL);
+
+  ch->sock = sock;
+  ch->out = out;
+  ch->name = strdup(name);
+  assert(ch->name != NULL);
+
+  fec_rb_init(&ch->rb, buffer_size);
+  aq_init(&ch->frame_queue);
+  memset(&ch->stats, 0, sizeof(ch->stats));
+  memset(&ch->report, 0, sizeof(ch->report));
+  memset(&ch->impair, 0, sizeof(ch->impair));
+
+  ch->tstamp_last = ch->time_last = 0;
+  ch->prebuffering = 0;
+  ch->finished = 0;
+}
+
+/*M
+  \emph{Destroy a channel.}
+
+  Closes the socket, and the output if it is not standard out.
+**/
+void pob_channel_destroy(pob_channel_t *ch) {
+  assert(ch != NULL);
+
+  if ((ch->sock >= 0) && (close(ch->sock) < 0))
+    perror("close");
+  if ((ch->out >= 0) && (ch->out != STDOUT_FILENO) && (close(ch->out) < 0))
+    perror("close");
+  ch->sock = ch->out = -1;
+
+  fec_rb_destroy(&ch->rb);
+  aq_destroy(&ch->frame_queue);
+  impair_destroy(&ch->impair);
+
+  free(ch->name);
+  ch->name = NULL;
+}
+
+/*M
+  \emph{Get the group of a received FEC packet.}
+
+  Returns the group in the ring buffer the packet belongs to, or
+  \verb|NULL| if the packet has to be dropped.
+**/
+static fec_group_t *pob_pkt_group(pob_channel_t *ch, fec_pkt_hdr_t *hdr) {
+  assert(ch != NULL);
+  assert(hdr != NULL);
 
   /*M
     We have received a packet.
   **/
-  pob_stats.rcvd_pkts++;
+  ch->stats.rcvd_pkts++;
+
+  /*M
+    Drop packets with an unknown FEC scheme, a header version not
+    matching the scheme, FEC parameters the scheme cannot decode, or
+    groups larger than the receiver accepts.
+  **/
+  unsigned int scheme = FEC_PKT_GET_SCHEME(hdr->version);
+  if ((scheme > FEC_SCHEME_MAX) ||
+      !FEC_PKT_VERSION_VALID(hdr->version) ||
+      (hdr->fec_k == 0) || (hdr->fec_k > hdr->fec_n) ||
+      (hdr->packet_seq >= hdr->fec_n) ||
+      (hdr->fec_n > fec_max_n(scheme)) ||
+      (hdr->fec_k > POB_MAX_K) ||
+      ((unsigned long)hdr->fec_n * hdr->fec_len > POB_MAX_GROUP_LEN) ||
+      (hdr->len > hdr->fec_len)) {
+    ch->stats.bad_pkts++;
+    return NULL;
+  }
 
-  int num = 0;
+  fec_group_t *group = NULL;
   /* insert packet into ringbuffer */
-  if (fec_rb_length() > 0) {
+  if (fec_rb_length(&ch->rb) > 0) {
     /* get index of first packet */
-    fec_group_t *first_group = fec_rb_first();
+    fec_group_t *first_group = fec_rb_first(&ch->rb);
     assert(first_group != NULL);
     assert(first_group->buf != NULL);
 
-    num = net_seqnum_diff(first_group->seq, pkt->hdr.group_seq, 1 << 8);
+    /*M
+      A packet with another stream id or header version than the
+      buffered groups comes from a restarted sender, the ring buffer
+      is cleared below.
+    **/
+    if ((first_group->stream_id == hdr->stream_id) &&
+        (first_group->hdr_version == FEC_PKT_GET_HDR_VERSION(hdr->version))) {
+      int num = fec_pkt_seq_diff(hdr->version,
+                                 first_group->seq, hdr->group_seq);
+      group = fec_rb_group(&ch->rb, hdr, num);
+    }
+  } else {
+    group = fec_rb_group(&ch->rb, hdr, 0);
   }
 
-  if (!fec_rb_insert_pkt(pkt, num)) {
+  if (group == NULL) {
 #ifdef DEBUG
-    fprintf(stderr, "ring buffer full\n");
+    fprintf(stderr, "ring buffer full or stream restarted\n");
 #endif
 
-    fec_rb_clear();
-    tstamp_last = pkt->hdr.group_tstamp;
-    return pob_insert_pkt(pkt);
-  } else {
+    fec_rb_clear(&ch->rb);
+    ch->tstamp_last = hdr->group_tstamp;
+    group = fec_rb_group(&ch->rb, hdr, 0);
+    assert(group != NULL);
+  }
+
+  return group;
+}
+
+/*M
+  \emph{Receive a FEC packet into the ring buffer.}
+
+  The header of the packet has been peeked at, the payload is
+  received directly into its slot in the FEC group buffer.
+**/
+int pob_insert_pkt(pob_channel_t *ch, fec_pkt_hdr_t *hdr) {
+  assert(ch != NULL);
+  assert(hdr != NULL);
+
+  fec_group_t *group = pob_pkt_group(ch, hdr);
+  unsigned char *dst = NULL;
+  if (group != NULL)
+    dst = fec_group_pkt_buf(group, hdr);
+
+  /*M
+    Receive the payload into the group buffer. A packet whose length
+    does not match its header is dropped.
+  **/
+  if (fec_pkt_recv_payload(hdr, ch->sock, dst) <= 0) {
+    ch->stats.bad_pkts++;
     return 1;
   }
+
+  if (group != NULL)
+    fec_group_add_pkt(group, hdr);
+
+  return 1;
 }
 
-int pob_fec_recv_pkt(int sock, fec_pkt_t *pkt) {
+/*M
+  \emph{Insert a FEC packet received in a batch into the ring buffer.}
+**/
+int pob_insert_buf(pob_channel_t *ch, unsigned char *buf, unsigned int len) {
+  assert(ch != NULL);
+  assert(buf != NULL);
+
+  fec_pkt_hdr_t hdr;
+  unsigned char *payload = fec_pkt_parse(&hdr, buf, len);
+  if (payload == NULL) {
+    ch->stats.rcvd_pkts++;
+    ch->stats.bad_pkts++;
+    return 1;
+  }
+
+  fec_group_t *group = pob_pkt_group(ch, &hdr);
+  if (group != NULL) {
+    unsigned char *dst = fec_group_pkt_buf(group, &hdr);
+    if (dst != NULL)
+      memcpy(dst, payload, hdr.len);
+    fec_group_add_pkt(group, &hdr);
+  }
+
+  return 1;
+}
+
+/*M
+  \emph{Wait for network input on the channels.}
+
+  The sockets with waiting packets are stored in \verb|fds|. Returns
+  the number of those sockets, 0 on timeout, -1 on error.
+**/
+int pob_fec_wait(pob_channel_t *chs, unsigned int num, fd_set *fds) {
+  assert(chs != NULL);
+  assert(fds != NULL);
+
   /*M
     Timeout in order to flush next frame to player.
   **/
@@ -117,21 +344,29 @@ int pob_fec_recv_pkt(int sock, fec_pkt_t *pkt) {
   t_out.tv_usec = FEC_MINSLEEP;
 
   /*M
-    Listen on receiving socket.
+    Listen on the receiving sockets.
   **/
-  fd_set fds;
-  FD_ZERO(&fds);
-  FD_SET(sock, &fds);
+  FD_ZERO(fds);
+  int max_fd = -1;
+  unsigned int i;
+  for (i = 0; i < num; i++) {
+    if (chs[i].finished)
+      continue;
+    FD_SET(chs[i].sock, fds);
+    if (chs[i].sock > max_fd)
+      max_fd = chs[i].sock;
+  }
 
   /*M
     Wait for network input or for timeout.
   **/
-  int ret = select(sock + 1, &fds, NULL, NULL, &t_out);
+  int ret = select(max_fd + 1, fds, NULL, NULL, &t_out);
   
   /*M
     Check for interrupted system call.
   **/
   if (ret == -1) {
+    FD_ZERO(fds);
     if ((errno == EINTR) || (errno == EAGAIN)) {
       return 0; /* timeout */
     } else {
@@ -139,179 +374,285 @@ int pob_fec_recv_pkt(int sock, fec_pkt_t *pkt) {
     }
   }
   
-  /*M
-    If there is network input, read incoming packet.
-  **/
-  if (FD_ISSET(sock, &fds)) {
-    fec_pkt_init(pkt);
-    
-    if (fec_pkt_read(pkt, sock) <= 0) {
+  return ret;
+}
+
+/*M
+  \emph{Receive the waiting FEC packets of a channel into its ring
+  buffer.}
+
+  With a batch, the socket is drained with as few system calls as
+  possible and the payloads are copied into their groups. Without a
+  batch, a single packet is received directly into its group. The
+  batch is passed through the impairment of the channel, which can
+  deliver held back packets even if none was received. Returns the
+  number of received packets, -1 on error.
+**/
+int pob_fec_recv_pkts(pob_channel_t *ch, net_batch_t *batch) {
+  assert(ch != NULL);
+
+  if (batch == NULL) {
+    fec_pkt_hdr_t hdr;
+    int ret = fec_pkt_peek_hdr(&hdr, ch->sock);
+    if (ret < 0)
+      return ((errno == EINTR) || (errno == EAGAIN)) ? 0 : -1;
+    if (ret == 0) {
+      /* empty datagram or invalid header, dropped */
+      ch->stats.rcvd_pkts++;
+      ch->stats.bad_pkts++;
+      return 0;
+    }
+    if (!pob_insert_pkt(ch, &hdr))
       return -1;
-    } else {
-      return 1;
+    return 1;
+  }
+
+  int ret;
+  if ((ret = net_batch_recv(batch, ch->sock)) < 0)
+    return -1;
+  ret = impair_batch(&ch->impair, batch);
+
+  unsigned int i;
+  for (i = 0; i < (unsigned int)ret; i++) {
+    if (batch->lengths[i] == 0) {
+      ch->stats.rcvd_pkts++;
+      ch->stats.bad_pkts++;
+      continue;
     }
+    if (!pob_insert_buf(ch, batch->iovs[i].iov_base, batch->lengths[i]))
+      return -1;
   }
 
-  return 0;
+  return ret;
 }
 
 /*M
-  \emph{Simple FEC streaming client main loop.}
+  \emph{Send the loss report of a channel, and start a new window.}
 
-  The mainloop calls the prebuffering routine each time the frame
-  queue is empty, then receives the packets, sorts them into groups,
-  decodes the groups and converts the ADUs into frames.
+  The report carries the stream id of the last played group, so that
+  the server can ignore reports about a previous stream. Reports are
+  only a hint, a report which cannot be sent is dropped.
 **/
-int pob_mainloop(int sock, int quiet) {
-  int retval = 0;
-  
-  /*M
-    Initialize the ADU queue;
-  **/
-  aq_t frame_queue;
-  aq_init(&frame_queue);
+static void pob_channel_report(pob_channel_t *ch) {
+  assert(ch != NULL);
 
-  fec_pkt_t pkt;
-  int finished = 0;
+  unsigned char buf[FEC_REPORT_SIZE];
+  unsigned int len = fec_report_pack(&ch->report, buf);
+  send(fb_sock, buf, len, 0);
 
-  while (!finished) {
-    static int prebuffering = 0;
+  ch->report.groups = 0;
+  ch->report.rcvd_pkts = ch->report.lost_pkts = 0;
+  ch->report.lost_groups = 0;
+}
 
-    if (fec_rb_cnt == 0) {
-      prebuffering = 1;
-    }
-      
-    switch (pob_fec_recv_pkt(sock, &pkt)) {
-    case -1:
-      finished = 1;
-      retval = -1;
-      continue;
-      
-    case 0:
-      break;
-      
-    default:
+/*M
+  \emph{Play the groups of a channel which are due.}
+
+  Decodes the due groups at the head of the ring buffer and writes
+  their frames to the channel output. Returns 0 if the output could
+  not be written, 1 otherwise.
+**/
+int pob_channel_play(pob_channel_t *ch, unsigned long time_now, int quiet) {
+  assert(ch != NULL);
+
+  if (ch->prebuffering == 1) {
+    if (ch->rb.cnt >= (ch->rb.size / 2)) {
+      fec_group_t *first_group = fec_rb_first(&ch->rb);
+      assert(first_group != NULL);
+      assert(first_group->buf != NULL);
+
+      ch->tstamp_last = first_group->tstamp;
+      ch->time_last = time_now;
+
+      ch->prebuffering = 0;
+      if (!quiet)
+        fprintf(stderr, "\n");
+    } else {
       /*M
-        Insert the packet into the FEC buffer.
+        Print prebuffering information.
       **/
-      if (!pob_insert_pkt(&pkt)) {
-        finished = 1;
-        retval = -1;
-        goto exit;
-      }
+      if (!quiet)
+        fprintf(stderr, "Prebuffering: %.2f%%\r",
+                (float)ch->rb.cnt / (ch->rb.size / 2.0) * 100.0);
+        
+      return 1;
+    }        
+  }
+
+  /*M
+    Print client information.
+  **/
+  if (!quiet) {
+    static int count = 0;
+    if ((count++ % 10) == 0) {
+      fprintf(stderr, "pkts: %.8u\tdrop: %.6u\tincomplete: %.6u\tbuf: %.6u len:%.4u\t\r",
+              ch->stats.rcvd_pkts,
+              ch->stats.lost_pkts,
+              ch->stats.incomplete_groups,
+              ch->rb.cnt,
+              fec_rb_length(&ch->rb));
     }
+  }
+
+#ifdef DEBUG
+  fec_rb_print(&ch->rb);
+#endif
 
-    static unsigned long time_last;
+  unsigned long long tstamp_now = ch->tstamp_last + (time_now - ch->time_last);
 
-    unsigned long time_now;
-    /*M
-      Get the current time to see which packets have to be written to
-      standard out.
-    **/
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    time_now = tv.tv_sec * 1000000 + tv.tv_usec;
+  while (fec_rb_length(&ch->rb) > 0) {
+    fec_group_t *group = fec_rb_first(&ch->rb);
+    assert(group != NULL);
+
+    if (group->buf != NULL) {
+      /* boeser hack XXX */
+      if (group->tstamp > (tstamp_now + 3000))
+        break;
 
-    if (prebuffering == 1) {
-      if (fec_rb_cnt >= (fec_rb_size / 2)) {
-        fec_group_t *first_group = fec_rb_first();
-        assert(first_group != NULL);
-        assert(first_group->buf != NULL);
+      /* groups are decoded as soon as k packets arrived, only
+         convert the ADUs here */
+      if (!fec_group_decode_to_adus(group, &ch->frame_queue)) {
+        fprintf(stderr, "Could not decode group\n");
+        /* XXX really continue? */
+      }
+
+      ch->stats.lost_pkts += group->fec_n - group->rcvd_pkts;
+      if (group->rcvd_pkts < group->fec_k)
+        ch->stats.incomplete_groups++;
 
-        tstamp_last = first_group->tstamp;
-        time_last = time_now;
+      ch->report.stream_id = group->stream_id;
+      ch->report.rcvd_pkts += group->rcvd_pkts;
+      ch->report.lost_pkts += group->fec_n - group->rcvd_pkts;
+      if (group->rcvd_pkts < group->fec_k)
+        ch->report.lost_groups++;
 
-        prebuffering = 0;
-        if (!quiet)
-          fprintf(stderr, "\n");
-      } else {
+      mp3_frame_t *frame;
+      while ((frame = aq_get_frame(&ch->frame_queue)) != NULL) {
+        memset(frame->raw, 0, 4 + frame->si_size);
+          
         /*M
-          Print prebuffering information.
+          Write packet payload.
         **/
-        if (!quiet)
-          fprintf(stderr, "Prebuffering: %.2f%%\r",
-                  (float)fec_rb_cnt / (fec_rb_size / 2.0) * 100.0);
-        
-        continue;
-      }        
-    }
+        if (!mp3_fill_hdr(frame) ||
+            !mp3_fill_si(frame) ||
+            (write(ch->out,
+                   frame->raw,
+                   frame->frame_size) < (int)frame->frame_size)) {
+          fprintf(stderr, "Error writing to %s\n", ch->name);
+          aq_release(&ch->frame_queue, frame);
+            
+          return 0;
+        }
 
-    /*M
-      Print client information.
-    **/
-    if (!quiet) {
-      static int count = 0;
-      if ((count++ % 10) == 0) {
-        fprintf(stderr, "pkts: %.8u\tdrop: %.6u\tincomplete: %.6u\tbuf: %.6u len:%.4u\t\r",
-                pob_stats.rcvd_pkts,
-                pob_stats.lost_pkts,
-                pob_stats.incomplete_groups,
-                fec_rb_cnt,
-                fec_rb_length());
+        aq_release(&ch->frame_queue, frame);
       }
+
+      ch->tstamp_last = tstamp_now;
+      ch->time_last = time_now;
+    } else {
+      /*M
+        No packet of the group has been received.
+      **/
+      ch->report.lost_groups++;
     }
 
-#ifdef DEBUG
-    fec_rb_print();
-#endif
+    fec_rb_pop(&ch->rb);
 
-    unsigned long tstamp_now = tstamp_last + (time_now - time_last);
+    if ((fb_sock >= 0) && (++ch->report.groups >= report_window))
+      pob_channel_report(ch);
+  }
 
-    while (fec_rb_length() > 0) {
-      fec_group_t *group = fec_rb_first();
-      assert(group != NULL);
+  return 1;
+}
 
-      if (group->buf != NULL) {
-        /* boeser hack XXX */
-        if (group->tstamp > (tstamp_now + 3000))
-          break;
+/*M
+  \emph{Simple FEC streaming client main loop.}
 
-        /* decode group into adu queue */
-        if (!fec_group_decode_to_adus(group, &frame_queue)) {
-          fprintf(stderr, "Could not decode group\n");
-          /* XXX really continue? */
-        }
+  The mainloop waits for packets on all channels, receives them and
+  sorts them into the groups of their channel. Then the due groups of
+  each channel are decoded and their ADUs converted into frames. A
+  channel is prebuffered each time its ring buffer is empty. A channel
+  whose output cannot be written is closed, the mainloop returns when
+  no channel is left.
+**/
+int pob_mainloop(pob_channel_t *chs, unsigned int num, int quiet) {
+  assert(chs != NULL);
 
-        pob_stats.lost_pkts += group->fec_n - group->rcvd_pkts;
-        if (group->rcvd_pkts < group->fec_k)
-          pob_stats.incomplete_groups++;
+  int retval = 0;
+  
+  /*M
+    Initialize the receive batch. With a batch size of $1$, packets
+    are received directly into their FEC groups.
+  **/
+  net_batch_t batch, *batch_ptr = NULL;
+  unsigned char *batch_buf = NULL;
+  if ((batch_size > 1) || chs[0].impair.enabled) {
+    unsigned int buf_size = FEC_PKT_MAX_HDR_SIZE + FEC_PKT_PAYLOAD_SIZE;
+    batch_buf = malloc(batch_size * buf_size);
+    assert(batch_buf != NULL);
+
+    net_batch_init(&batch, batch_size);
+    unsigned int i;
+    for (i = 0; i < batch_size; i++)
+      net_batch_set_buf(&batch, i, batch_buf + i * buf_size, buf_size);
+    batch_ptr = &batch;
+  }
 
-        mp3_frame_t *frame;
-        while ((frame = aq_get_frame(&frame_queue)) != NULL) {
-          memset(frame->raw, 0, 4 + frame->si_size);
-          
-          /*M
-            Write packet payload.
-          **/
-          if (!mp3_fill_hdr(frame) ||
-              !mp3_fill_si(frame) ||
-              (write(STDOUT_FILENO,
-                     frame->raw,
-                     frame->frame_size) < (int)frame->frame_size)) {
-            fprintf(stderr, "Error writing to stdout\n");
-            free(frame);
-            
-            retval = 0;
-            goto exit;
-          }
+  /*M
+    The status line is only printed for a single channel.
+  **/
+  if (num > 1)
+    quiet = 1;
+
+  unsigned int active = num;
+  while (active > 0) {
+    unsigned int i;
+    for (i = 0; i < num; i++) {
+      if (chs[i].rb.cnt == 0)
+        chs[i].prebuffering = 1;
+    }
 
-          free(frame);
-        }
+    /*M
+      Receive the packets into the FEC buffers.
+    **/
+    fd_set fds;
+    if (pob_fec_wait(chs, num, &fds) < 0) {
+      retval = -1;
+      break;
+    }
 
-        tstamp_last = tstamp_now;
-        time_last = time_now;
-      } 
+    for (i = 0; i < num; i++) {
+      if (!chs[i].finished &&
+          (FD_ISSET(chs[i].sock, &fds) || impair_pending(&chs[i].impair)) &&
+          (pob_fec_recv_pkts(chs + i, batch_ptr) < 0)) {
+        retval = -1;
+        goto exit;
+      }
+    }
 
-      fec_rb_pop();
+    unsigned long time_now;
+    /*M
+      Get the current time to see which packets have to be written to
+      the outputs.
+    **/
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    time_now = tv.tv_sec * 1000000 + tv.tv_usec;
+
+    for (i = 0; i < num; i++) {
+      if (!chs[i].finished && !pob_channel_play(chs + i, time_now, quiet)) {
+        chs[i].finished = 1;
+        active--;
+      }
     }
   }
 
  exit:
-  /*M
-    Destroy the ADU queue.
-  **/
-  aq_destroy(&frame_queue);
-  
+  if (batch_ptr != NULL) {
+    net_batch_destroy(&batch);
+    free(batch_buf);
+  }
+
   return retval;
 }
 
@@ -319,15 +660,120 @@ int pob_mainloop(int sock, int quiet) {
   \emph{Print FEC client usage.}
 **/
 static void usage(void) {
-  fprintf(stderr, "Usage: ./pob [-s address] [-p port] [-b size] [-q]\n");
+  fprintf(stderr, "Usage: ./pob [-s address] [-p port] [-b size] [-r batch] [-o [address:]port=file]... [-F address:port] [-W groups] [-P spec] [-q]\n");
   
   fprintf(stderr, "\t-s address : destination address (default 0.0.0.0)\n");
   fprintf(stderr, "\t-p port    : destination port (default 1500)\n");
   fprintf(stderr, "\t-b size    : maximal number of fec groups in buffer (default 16)\n");
+  fprintf(stderr, "\t-r batch   : maximal number of packets per receive call (default 32),\n");
+  fprintf(stderr, "\t             1 receives each packet directly into its fec group\n");
+  fprintf(stderr, "\t-o spec    : receive the stream sent to address (default -s) and port,\n");
+  fprintf(stderr, "\t             and write it to file (- for stdout), can be repeated\n");
+  fprintf(stderr, "\t-F addr    : send loss reports to address:port, for poc-fec -f\n");
+  fprintf(stderr, "\t-W groups  : number of played groups per loss report (default 16)\n");
+  fprintf(stderr, "\t-P spec    : impair the received packets, for example loss=5,p=1,r=20\n");
+  fprintf(stderr, "\t             (default $" IMPAIR_ENV ")\n");
   fprintf(stderr, "\t-q         : quiet\n");
 
 }
 
+/*M
+  \emph{Open a receiving socket.}
+**/
+static int pob_recv_socket(char *address, unsigned short port) {
+  assert(address != NULL);
+
+#ifdef WITH_IPV6
+  return net_udp6_recv_socket(address, port);
+#else
+  return net_udp4_recv_socket(address, port);  
+#endif /* WITH_IPV6 */
+}
+
+/*M
+  \emph{Open the socket sending the loss reports.}
+
+  The destination has the form \verb|address:port|, separated by the
+  last colon. Returns the socket, or -1 on error.
+**/
+static int pob_feedback_socket(char *dest) {
+  assert(dest != NULL);
+
+  char *buf = strdup(dest);
+  assert(buf != NULL);
+
+  int sock = -1;
+  char *port = strrchr(buf, ':');
+  if ((port == NULL) || (port[1] == '\0')) {
+    fprintf(stderr, "Invalid feedback address %s\n", dest);
+  } else {
+    *port++ = '\0';
+#ifdef WITH_IPV6
+    sock = net_udp6_send_socket(buf, (unsigned short)atoi(port), 1);
+#else
+    sock = net_udp4_send_socket(buf, (unsigned short)atoi(port), 1);
+#endif /* WITH_IPV6 */
+  }
+
+  free(buf);
+  return sock;
+}
+
+/*M
+  \emph{Open a channel from a channel specification.}
+
+  The specification has the form \verb|[address:]port=file|. The
+  address is separated from the port by the last colon, so that IPv6
+  addresses can be given. Outputs are opened for writing and
+  created if necessary, opening a FIFO blocks until it has a
+  reader. Returns 0 on error, 1 on success.
+**/
+static int pob_channel_open(pob_channel_t *ch, char *spec, char *address) {
+  assert(ch != NULL);
+  assert(spec != NULL);
+
+  char *buf = strdup(spec);
+  assert(buf != NULL);
+  int retval = 0;
+
+  char *file = strchr(buf, '=');
+  if ((file == NULL) || (file[1] == '\0')) {
+    fprintf(stderr, "Invalid channel %s\n", spec);
+    goto exit;
+  }
+  *file++ = '\0';
+
+  char *port = strrchr(buf, ':');
+  if (port != NULL) {
+    *port++ = '\0';
+    address = buf;
+  } else {
+    port = buf;
+  }
+
+  int sock = pob_recv_socket(address, (unsigned short)atoi(port));
+  if (sock < 0) {
+    fprintf(stderr, "Could not open socket for %s\n", spec);
+    goto exit;
+  }
+
+  int out = STDOUT_FILENO;
+  if (strcmp(file, "-") &&
+      ((out = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)) {
+    perror(file);
+    if (close(sock) < 0)
+      perror("close");
+    goto exit;
+  }
+
+  pob_channel_init(ch, sock, out, strcmp(file, "-") ? file : "stdout");
+  retval = 1;
+
+ exit:
+  free(buf);
+  return retval;
+}
+
 /*M
   \emph{FEC RTP client entry routine.}
 **/
@@ -336,11 +782,22 @@ int main(int argc, char *argv[]) {
   unsigned short port = 1500;
   int            retval = EXIT_SUCCESS, quiet = 0;
 
+  /*M
+    Channel specifications given with \verb|-o|.
+  **/
+  char **specs = NULL;
+  unsigned int num_specs = 0;
+  char *fb_dest = NULL;
+  char *impair_spec = NULL;
+
+  pob_channel_t *chs = NULL;
+  unsigned int num_chs = 0;
+
   /*M
     Process the command line arguments.
   **/
   int c;
-  while ((c = getopt(argc, argv, "hs:p:b:t:q")) >= 0) {
+  while ((c = getopt(argc, argv, "hs:p:b:r:o:F:W:P:t:q")) >= 0) {
     switch (c) {
     case 's':
       if (address != NULL)
@@ -357,6 +814,30 @@ int main(int argc, char *argv[]) {
       buffer_size = (unsigned short)atoi(optarg);
       break;
 
+    case 'r':
+      batch_size = (unsigned int)atoi(optarg);
+      if (batch_size == 0)
+        batch_size = 1;
+      break;
+
+    case 'o':
+      specs = realloc(specs, sizeof(char *) * (num_specs + 1));
+      assert(specs != NULL);
+      specs[num_specs++] = optarg;
+      break;
+
+    case 'F':
+      fb_dest = optarg;
+      break;
+
+    case 'W':
+      report_window = (unsigned int)atoi(optarg);
+      break;
+
+    case 'P':
+      impair_spec = optarg;
+      break;
+
     case 'q':
       quiet = 1;
       break;
@@ -369,10 +850,11 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  /*M
-    Initialize the ring buffer.
-  **/
-  fec_rb_init(buffer_size);
+  if ((buffer_size < 2) || (report_window < 1)) {
+    usage();
+    retval = EXIT_FAILURE;
+    goto exit;
+  }
 
   if (address == NULL) {
 #ifdef WITH_IPV6
@@ -382,29 +864,76 @@ int main(int argc, char *argv[]) {
 #endif /* WITH_IPV6 */
   }
   
-  /*M
-    Create the receiving socket.
-  **/
-  int sock;
-#ifdef WITH_IPV6
-  sock = net_udp6_recv_socket(address, port);
-#else
-  sock = net_udp4_recv_socket(address, port);  
-#endif /* WITH_IPV6 */
-  if (sock < 0) {
-    fprintf(stderr, "Could not open socket\n");
+  if ((fb_dest != NULL) && ((fb_sock = pob_feedback_socket(fb_dest)) < 0)) {
+    fprintf(stderr, "Could not open the feedback socket\n");
     retval = EXIT_FAILURE;
     goto exit;
   }
 
-  if (!pob_mainloop(sock, quiet))
+  /*M
+    Create the channels. Without channel specifications, the stream
+    sent to \verb|address| and \verb|port| is written to standard out.
+  **/
+  chs = malloc(sizeof(pob_channel_t) * (num_specs > 0 ? num_specs : 1));
+  assert(chs != NULL);
+
+  if (num_specs == 0) {
+    int sock = pob_recv_socket(address, port);
+    if (sock < 0) {
+      fprintf(stderr, "Could not open socket\n");
+      retval = EXIT_FAILURE;
+      goto exit;
+    }
+    pob_channel_init(chs, sock, STDOUT_FILENO, "stdout");
+    num_chs = 1;
+  } else {
+    /*M
+      A reader going away must only end its own channel.
+    **/
+    signal(SIGPIPE, SIG_IGN);
+
+    for (num_chs = 0; num_chs < num_specs; num_chs++) {
+      if (!pob_channel_open(chs + num_chs, specs[num_chs], address)) {
+        retval = EXIT_FAILURE;
+        goto exit;
+      }
+    }
+  }
+
+  /*M
+    Each channel has its own impairment, the channels after the first
+    one get the following seeds.
+  **/
+  unsigned int i;
+  for (i = 0; i < num_chs; i++) {
+    if (!impair_init(&chs[i].impair, impair_spec)) {
+      fprintf(stderr, "Invalid impairment specification\n");
+      retval = EXIT_FAILURE;
+      goto exit;
+    }
+    if (i > 0)
+      impair_seed(&chs[i].impair, chs[0].impair.seed + i);
+  }
+  if (chs[0].impair.enabled && !quiet)
+    fprintf(stderr, "Impairing the received packets, seed %llu\n",
+            chs[0].impair.seed);
+
+  if (!pob_mainloop(chs, num_chs, quiet))
     retval = EXIT_FAILURE;
 
-  if (close(sock) < 0)
-    perror("close");
-  
  exit:
-  fec_rb_destroy();
+  if (chs != NULL) {
+    unsigned int i;
+    for (i = 0; i < num_chs; i++)
+      pob_channel_destroy(chs + i);
+    free(chs);
+  }
+  if (specs != NULL)
+    free(specs);
+  if ((fb_sock >= 0) && (close(fb_sock) < 0))
+    perror("close");
+
+  fec_cache_destroy();
   
   if (address != NULL)
     free(address);
@@ -26,6 +26,7 @@
 #include "network.h"
 #include "rtp.h"
 #include "sig_set_handler.h"
+#include "impair.h"
 #include "file.h"
 
 #ifdef WITH_IPV6
@@ -38,9 +39,10 @@ static int use_ipv6 = 0;
 RSA *rsa = NULL;
 #endif /* WITH_OPENSSL */
 
-#ifdef DEBUG_PLOSS
-int ploss_rate = 20;
-#endif /* DEBUG_PLOSS */
+/*M
+  \emph{Impairment of the sent packets (\verb|-P|).}
+**/
+static impair_t impair;
 
 static int finished = 0;
 
@@ -97,7 +99,8 @@ int poc_mainloop(int sock, char *filename, int quiet) {
   /*M
     Cycle through the frames and send them using RTP.
   **/
-  mp3_frame_t mp3_frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t mp3_frame = { .raw = raw };
   while ((mp3_next_frame(&mp3_file, &mp3_frame) > 0) && !finished) {
     /*M
       Fill rtp packet.
@@ -120,23 +123,17 @@ int poc_mainloop(int sock, char *filename, int quiet) {
 #endif
 
     /*M
-      Simulate packet loss.
+      Send the packet through the impairment.
     **/
-#ifdef DEBUG_PLOSS
-    if (((random() % 100) >= ploss_rate) != 0) {
-#endif /* DEBUG_PLOSS */
-      /* send rtp packet */
-      if (rtp_pkt_send(&pkt, sock) < 0) {
-	if (errno == ENOBUFS) {
-	  fprintf(stderr, "Output buffers full, waiting...\n");
-	} else {
-	  perror("Error while sending packet");
-	  return 0;
-	}
+    if (impair_sendto(&impair, sock, pkt.data, rtp_pkt_prepare(&pkt),
+                      NULL, 0) < 0) {
+      if (errno == ENOBUFS) {
+        fprintf(stderr, "Output buffers full, waiting...\n");
+      } else {
+        perror("Error while sending packet");
+        return 0;
       }
-#ifdef DEBUG_PLOSS
     }
-#endif /* DEBUG_PLOSS */
     
     /*M
       Set M-bit to $0$ after sending the first frame (receiver
@@ -206,6 +203,8 @@ int poc_mainloop(int sock, char *filename, int quiet) {
     start_usec = tv.tv_usec;
   }
 
+  impair_flush(&impair, sock, NULL, 0);
+
   /*M
     Close the MPEG file.
   **/
@@ -223,10 +222,10 @@ int poc_mainloop(int sock, char *filename, int quiet) {
 static void usage(void) {
 #ifdef WITH_OPENSSL
   fprintf(stderr,
-          "Usage: ./poc [-s address] [-p port] [-q] [-t ttl] [-c pem] files...\n");
+          "Usage: ./poc [-s address] [-p port] [-q] [-t ttl] [-c pem] [-P spec] files...\n");
 #else
   fprintf(stderr,
-          "Usage: ./poc [-s address] [-p port] [-q] [-t ttl] files...\n");
+          "Usage: ./poc [-s address] [-p port] [-q] [-t ttl] [-P spec] files...\n");
 #endif
   
   fprintf(stderr, "\t-s address : destination address (default 224.0.1.23)\n");
@@ -236,9 +235,8 @@ static void usage(void) {
 #ifdef WITH_OPENSSL
   fprintf(stderr, "\t-c pem     : sign with private RSA key\n");
 #endif /* WITH_OPENSSL */
-#ifdef DEBUG_PLOSS
-  fprintf(stderr, "\t-P ploss   : packet loss interval\n");
-#endif /* DEBUG_PLOSS */  
+  fprintf(stderr, "\t-P spec    : impair the sent packets, for example loss=5,p=1,r=20\n");
+  fprintf(stderr, "\t             (default $" IMPAIR_ENV ")\n");  
 }
 
 /*M
@@ -253,6 +251,7 @@ int main(int argc, char *argv[]) {
   unsigned short port     = 1500;
   unsigned int   ttl      = 1;
   int            quiet    = 0;
+  char           *impair_spec = NULL;
 
   /*M
     Process the command line arguments.
@@ -319,16 +318,9 @@ int main(int argc, char *argv[]) {
       }
 #endif /* WITH_OPENSSL */
 
-#ifdef DEBUG_PLOSS
     case 'P':
-      {
-        static struct timeval tv;
-        gettimeofday(&tv, NULL);
-        srandom(tv.tv_sec);
-        ploss_rate = atoi(optarg);
-        break;
-      }
-#endif /* DEBUG_PLOSS */
+      impair_spec = optarg;
+      break;
 
     case 'h':
     default:
@@ -338,6 +330,14 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (!impair_init(&impair, impair_spec)) {
+    fprintf(stderr, "Invalid impairment specification\n");
+    retval = EXIT_FAILURE;
+    goto exit;
+  }
+  if (impair.enabled && !quiet)
+    fprintf(stderr, "Impairing the sent packets, seed %llu\n", impair.seed);
+
   if (optind == argc) {
     usage();
     retval = EXIT_FAILURE;
@@ -397,6 +397,8 @@ int main(int argc, char *argv[]) {
   }
 
  exit:
+  impair_destroy(&impair);
+
 #ifdef WITH_OPENSSL
   if (rsa != NULL)
     RSA_free(rsa);
@@ -27,6 +27,7 @@
 #include "network.h"
 #include "rtp.h"
 #include "sig_set_handler.h"
+#include "impair.h"
 #include "file.h"
 
 #ifdef WITH_IPV6
@@ -39,9 +40,10 @@ static int use_ipv6 = 0;
 RSA *rsa = NULL;
 #endif
 
-#ifdef DEBUG_PLOSS
-int ploss_rate = 20;
-#endif /* DEBUG_PLOSS */
+/*M
+  \emph{Impairment of the sent packets (\verb|-P|).}
+**/
+static impair_t impair;
 
 static int finished = 0;
 
@@ -109,7 +111,8 @@ int poc_mainloop(int sock, char *filename, int quiet) {
   /*M
     Cycle through the frames, convert them to ADUs and send them using RTP.
   **/
-  mp3_frame_t mp3_frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t mp3_frame = { .raw = raw };
   while ((mp3_next_frame(&mp3_file, &mp3_frame) > 0) && !finished) {
     /*M
       Add the MPEG frame to the adu queue.
@@ -141,7 +144,7 @@ int poc_mainloop(int sock, char *filename, int quiet) {
       if (rsa != NULL) {
         if (!rtp_pkt_sign(&pkt, rsa)) {
           fprintf(stderr, "\nCould not sign packet\n");
-          free(adu);
+          aq_release(&adu_queue, adu);
           aq_destroy(&adu_queue);
           
           return 0;
@@ -151,26 +154,20 @@ int poc_mainloop(int sock, char *filename, int quiet) {
 #endif
 
       /*M
-        Simulate packet loss.
+        Send the packet through the impairment.
       **/
-#ifdef DEBUG_PLOSS
-      if ((random() % 100) >= ploss_rate ) {
-#endif /* DEBUG_PLOSS */
-        /* send rtp packet */
-        if (rtp_pkt_send(&pkt, sock) < 0) {
-	  if (errno == ENOBUFS) {
-	    fprintf(stderr, "Output buffers full, waiting...\n");
-	  } else {
-	    perror("Error while sending packet");
-	    free(adu);
-	    aq_destroy(&adu_queue);
-          
-	    return 0;
-	  }
+      if (impair_sendto(&impair, sock, pkt.data, rtp_pkt_prepare(&pkt),
+                        NULL, 0) < 0) {
+        if (errno == ENOBUFS) {
+          fprintf(stderr, "Output buffers full, waiting...\n");
+        } else {
+          perror("Error while sending packet");
+          aq_release(&adu_queue, adu);
+          aq_destroy(&adu_queue);
+
+          return 0;
         }
-#ifdef DEBUG_PLOSS
       }
-#endif /* DEBUG_PLOSS */
 
       /*M
         Update the MPEG timestamp.
@@ -223,7 +220,7 @@ int poc_mainloop(int sock, char *filename, int quiet) {
         fflush(stdout);
       }
 
-      free(adu);
+      aq_release(&adu_queue, adu);
     }
 
     /*M
@@ -241,6 +238,8 @@ int poc_mainloop(int sock, char *filename, int quiet) {
     start_usec = tv.tv_usec;
   }
 
+  impair_flush(&impair, sock, NULL, 0);
+
   /*M
     Destroy the ADU queue and close the MPEG file.
   **/
@@ -259,7 +258,7 @@ int poc_mainloop(int sock, char *filename, int quiet) {
 **/
 static void usage(void) {
   fprintf(stderr,
-          "Usage: ./poc [-s address] [-p port] [-q] [-t ttl]");
+          "Usage: ./poc [-s address] [-p port] [-q] [-t ttl] [-P spec]");
 #ifdef WITH_OPENSSL
   fprintf(stderr, " [-c pem]");
 #endif /* WITH_OPENSSL */
@@ -274,9 +273,8 @@ static void usage(void) {
 #ifdef WITH_OPENSSL
   fprintf(stderr, "\t-c pem     : sign with private RSA key\n");
 #endif /* WITH_OPENSSL */
-#ifdef DEBUG_PLOSS
-  fprintf(stderr, "\t-P ploss   : packet loss interval\n");
-#endif /* DEBUG_PLOSS */
+  fprintf(stderr, "\t-P spec    : impair the sent packets, for example loss=5,p=1,r=20\n");
+  fprintf(stderr, "\t             (default $" IMPAIR_ENV ")\n");
 #ifdef WITH_IPV6
   fprintf(stderr, "\t-6         : use ipv6\n");
 #endif /* WITH_IPV6 */
@@ -294,6 +292,7 @@ int main(int argc, char *argv[]) {
   unsigned short port     = 1500;
   unsigned int   ttl      = 1;
   int            quiet    = 0;
+  char           *impair_spec = NULL;
 
   /*M
     Process the command line arguments.
@@ -369,16 +368,9 @@ int main(int argc, char *argv[]) {
       }
 #endif /* WITH_OPENSSL */
 
-#ifdef DEBUG_PLOSS
     case 'P':
-      {
-        static struct timeval tv;
-        gettimeofday(&tv, NULL);
-        srandom(tv.tv_sec);
-        ploss_rate = atoi(optarg);
-        break;
-      }
-#endif /* DEBUG_PLOSS */
+      impair_spec = optarg;
+      break;
 
     case 'h':
     default:
@@ -388,6 +380,14 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (!impair_init(&impair, impair_spec)) {
+    fprintf(stderr, "Invalid impairment specification\n");
+    retval = EXIT_FAILURE;
+    goto exit;
+  }
+  if (impair.enabled && !quiet)
+    fprintf(stderr, "Impairing the sent packets, seed %llu\n", impair.seed);
+
   if (optind == argc) {
     usage();
     retval = EXIT_FAILURE;
@@ -451,6 +451,8 @@ int main(int argc, char *argv[]) {
   }
 
  exit:
+  impair_destroy(&impair);
+
 #ifdef WITH_OPENSSL
   if (rsa != NULL)
     RSA_free(rsa);
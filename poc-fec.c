@@ -15,15 +15,18 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <string.h>
 
 #include "mp3.h"
 #include "network.h"
 #include "fec-pkt.h"
 #include "fec.h"
+#include "fec-pool.h"
 #include "pack.h"
 #include "aq.h"
 #include "sig_set_handler.h"
+#include "impair.h"
 
 #ifdef WITH_IPV6
 static int use_ipv6 = 0;
@@ -31,9 +34,12 @@ static int use_ipv6 = 0;
 
 #define MAX_FILENAME 256
 
-#ifdef DEBUG_PLOSS
-int ploss_rate = 20;
-#endif /* DEBUG_PLOSS */
+/*M
+  \emph{Impairment of the sent packets (\verb|-P|).}
+
+  Impaired packets are sent one by one.
+**/
+static impair_t impair;
 
 /*M
   \emph{Maximal synchronization latency for sending packets.}
@@ -46,8 +52,9 @@ static int finished = 0;
 
 int quiet = 0;
 
-unsigned char fec_k = 20;
-unsigned char fec_n = 25;
+unsigned int fec_k = 20;
+unsigned int fec_n = 25;
+unsigned char fec_scheme = FEC_SCHEME_VANDERMONDE;
 
 fec_pkt_t pkt;
 
@@ -55,6 +62,579 @@ static void sig_int(int signo) {
   finished = 1;
 }
 
+/*M
+  \emph{Number of encoding threads.}
+
+  With $0$ threads, groups are encoded inline. Otherwise, complete
+  groups are encoded by a thread pool while the previous groups are
+  being sent.
+**/
+unsigned int num_threads = 0;
+
+/*M
+  \emph{A FEC group ready to be encoded and sent.}
+**/
+typedef struct poc_group_s {
+  /*M
+    Encoding job, only used with encoding threads.
+  **/
+  fec_job_t job;
+
+  /*M
+    The source ADUs, and the redundant packets. The ADUs are released
+    to their queue when the group is freed.
+  **/
+  aq_t *aq;
+  adu_t **adus;
+  unsigned char **fec_ptrs;
+
+  unsigned int max_len, fec_len;
+  unsigned long duration, bitrate, tstamp;
+
+  /*M
+    Number of packets the group is encoded to.
+  **/
+  unsigned int fec_n;
+
+  /*M
+    Group sequence number, set when the group is sent.
+  **/
+  unsigned long seq;
+
+  /*M
+    Buffers owned by the group (encoding threads only).
+  **/
+  unsigned char *buf;
+  unsigned char **ptrs;
+} poc_group_t;
+
+/*M
+  \emph{Sender synchronisation state.}
+
+  Kept across files.
+**/
+static long wait_time = 0;
+static unsigned long fec_time2 = 0;
+static unsigned long start_sec, start_usec;
+
+/*M
+  \emph{Packets sent in one system call.}
+
+  The packets of a group are sent in micro-batches spanning about
+  \verb|tx_quantum| usecs (\verb|-B|). By default, MP3 streams are
+  still sent packet by packet, and only fast streams need less system
+  calls. When the kernel paces the packets using their send times
+  (\verb|-T|), larger batches do not make the stream burstier, and
+  \verb|TX_TXTIME_QUANTUM| is used by default.
+**/
+#define TX_QUANTUM        (20 * 1000)
+#define TX_TXTIME_QUANTUM (500 * 1000)
+#define TX_MAX_BATCH      64
+
+static unsigned long tx_quantum = 0;
+
+static net_batch_t tx_batch;
+static unsigned char *tx_buf = NULL;
+static unsigned int tx_buf_size = 0;
+
+/*M
+  \emph{Send times of the packets (with \verb|-T|).}
+
+  \verb|tx_next| is the send time of the next packet, in nanoseconds.
+**/
+static int use_txtime = 0;
+static unsigned long long tx_next = 0;
+
+/*M
+  \emph{Use UDP segmentation offload (\verb|-G|).}
+**/
+static int use_gso = 0;
+
+/*M
+  \emph{Send the stream header (\verb|-x|).}
+
+  The stream id is chosen at random unless given with \verb|-i|, so
+  that receivers notice when the server is restarted.
+**/
+static int use_stream_hdr = 0;
+static unsigned long stream_id = 0;
+
+/*M
+  \emph{Interleaving depth (\verb|-I|).}
+
+  The packets of \verb|interleave| consecutive groups are sent
+  interleaved, so that a burst of up to \verb|interleave * (fec_n -
+  fec_k)| lost packets can be recovered. The encoded groups wait in
+  \verb|il_groups| until enough of them are available.
+**/
+static unsigned int interleave = 1;
+static poc_group_t **il_groups = NULL;
+static unsigned int il_cnt = 0;
+
+/*M
+  \emph{Adaptive FEC strength (\verb|-f|, \verb|-N|).}
+
+  The receivers send loss reports to the feedback socket
+  \verb|fb_sock|. After each group, the pending reports are read and
+  $n$ is chosen for the next group between \verb|adapt_min_n| and
+  \verb|adapt_max_n|. Without feedback, both bounds are
+  \verb|fec_n|.
+**/
+static int fb_sock = -1;
+static unsigned int adapt_min_n = 0, adapt_max_n = 0;
+
+/*M
+  \emph{Send packets \verb|first| to \verb|first + cnt - 1| of the
+  transmit batch.}
+
+  A packet which does not fit into the output buffers is dropped.
+  Returns 0 on error, 1 on success.
+**/
+static int poc_send_batch(int sock, struct sockaddr_in *saddr,
+                          unsigned int first, unsigned int cnt,
+                          unsigned long long *txtimes) {
+  unsigned int sent = 0;
+  while (sent < cnt) {
+    int ret = net_batch_send(&tx_batch, sock,
+                             (struct sockaddr *)saddr, sizeof(*saddr),
+                             first + sent, cnt - sent,
+                             txtimes ? txtimes + sent : NULL);
+    if (ret < 0) {
+      if (errno == ENOBUFS) {
+        fprintf(stderr, "Output buffers full, waiting...\n");
+        sent++;
+      } else {
+        perror("Error while sending packet");
+        return 0;
+      }
+    } else {
+      sent += ret;
+    }
+  }
+
+  return 1;
+}
+
+/*M
+  \emph{Get the run of packets starting at packet \verb|j| of the
+  transmit batch that can be sent with segmentation offload.}
+
+  A run consists of packets of the same size, and can end with one
+  shorter packet. Stores the length of the run in bytes in
+  \verb|len| and returns the number of packets in the run.
+**/
+static unsigned int poc_gso_run(unsigned int j, unsigned int cnt,
+                                unsigned int *len) {
+  unsigned int seg_size = tx_batch.iovs[j].iov_len;
+  unsigned int run = 1;
+  *len = seg_size;
+
+  while ((j + run < cnt) && (run < FEC_PKT_GSO_MAX_SEGS) &&
+         (*len + seg_size <= FEC_PKT_GSO_MAX_SIZE) &&
+         (tx_batch.iovs[j + run].iov_len == seg_size)) {
+    *len += seg_size;
+    run++;
+  }
+
+  if ((j + run < cnt) && (run < FEC_PKT_GSO_MAX_SEGS) &&
+      (tx_batch.iovs[j + run].iov_len < seg_size) &&
+      (*len + tx_batch.iovs[j + run].iov_len <= FEC_PKT_GSO_MAX_SIZE)) {
+    *len += tx_batch.iovs[j + run].iov_len;
+    run++;
+  }
+
+  return run;
+}
+
+/*M
+  \emph{Send the packets of encoded FEC groups.}
+
+  The packets of the \verb|num| consecutive groups are interleaved:
+  packet $i$ of every group is sent before packet $i + 1$ of any
+  group, so that a burst loss is spread over the groups. The packets
+  are spread over the duration of all groups. All packets of a
+  micro-batch are packed back to back and sent with one system
+  call. Returns 0 on error, 1 on success.
+**/
+static int poc_send_groups(int sock, struct sockaddr_in *saddr,
+                           file_t *mp3_file, poc_group_t **groups,
+                           unsigned int num) {
+  assert(num > 0);
+
+  unsigned long duration = 0;
+  unsigned int max_len = 0, max_n = 0, total = 0;
+  unsigned int g;
+  for (g = 0; g < num; g++) {
+    groups[g]->seq = pkt.hdr.group_seq + g;
+    duration += groups[g]->duration;
+    total += groups[g]->fec_n;
+    if (groups[g]->max_len > max_len)
+      max_len = groups[g]->max_len;
+    if (groups[g]->fec_n > max_n)
+      max_n = groups[g]->fec_n;
+  }
+  poc_group_t *group = groups[num - 1];
+
+  unsigned long interval = duration / total;
+
+  unsigned int batch_cnt = tx_quantum / (interval + 1);
+  if (batch_cnt < 1)
+    batch_cnt = 1;
+  if (batch_cnt > TX_MAX_BATCH)
+    batch_cnt = TX_MAX_BATCH;
+
+  unsigned int slot_size = FEC_PKT_MAX_HDR_SIZE + max_len;
+  if (tx_buf_size < batch_cnt * slot_size) {
+    tx_buf_size = batch_cnt * slot_size;
+    tx_buf = realloc(tx_buf, tx_buf_size);
+    assert(tx_buf != NULL);
+  }
+
+  unsigned long long txtimes[TX_MAX_BATCH];
+
+  /*M
+    The groups can be encoded to different numbers of packets, the
+    slots past the end of a shorter group are skipped.
+  **/
+  unsigned int slots = num * max_n;
+  unsigned int p = 0;
+  while (p < slots) {
+    /*M
+      Pack the next micro-batch.
+    **/
+    unsigned int cnt = 0, pkts = 0, off = 0;
+    for (; (p < slots) && (pkts < batch_cnt); p++) {
+      unsigned int i = p / num;
+      poc_group_t *src = groups[p % num];
+      if (i >= src->fec_n)
+        continue;
+      pkts++;
+
+      pkt.hdr.group_seq = src->seq;
+      pkt.hdr.packet_seq = i;
+      pkt.hdr.fec_k = fec_k;
+      pkt.hdr.fec_n = src->fec_n;
+      pkt.hdr.fec_len = src->fec_len;
+      pkt.hdr.group_tstamp = src->tstamp;
+
+      unsigned char *payload;
+      if (i < fec_k) {
+        pkt.hdr.len = mp3_frame_size(src->adus[i]);
+        payload = src->adus[i]->raw;
+      } else {
+        pkt.hdr.len = src->max_len;
+        payload = src->fec_ptrs[i - fec_k];
+      }
+
+      if (use_txtime)
+        txtimes[cnt] = tx_next;
+      tx_next += interval * 1000;
+
+#ifdef DEBUG
+      fprintf(stderr,
+              "sending fec packet group stamp %llu, gseq %lu, pseq %d, size %d\n",
+              pkt.hdr.group_tstamp, pkt.hdr.group_seq, pkt.hdr.packet_seq, pkt.hdr.len);
+#endif
+
+      unsigned char *ptr = tx_buf + off;
+      unsigned int hdr_size = fec_pkt_pack_hdr(&pkt.hdr, ptr);
+      memcpy(ptr + hdr_size, payload, pkt.hdr.len);
+      net_batch_set_buf(&tx_batch, cnt, ptr, hdr_size + pkt.hdr.len);
+      off += hdr_size + pkt.hdr.len;
+      cnt++;
+    }
+
+    /*M
+      Send the micro-batch. With segmentation offload, runs of equal
+      sized packets are sent with one call each.
+    **/
+    if (impair.enabled) {
+      unsigned int j;
+      for (j = 0; j < cnt; j++) {
+        if ((impair_sendto(&impair, sock, tx_batch.iovs[j].iov_base,
+                           tx_batch.iovs[j].iov_len,
+                           (struct sockaddr *)saddr, sizeof(*saddr)) < 0) &&
+            (errno != ENOBUFS)) {
+          perror("Error while sending packet");
+          return 0;
+        }
+      }
+    } else if (use_gso) {
+      unsigned int j = 0, first = 0;
+      while (j < cnt) {
+        unsigned int len, run = poc_gso_run(j, cnt, &len);
+        if (run < 2) {
+          j++;
+          continue;
+        }
+
+        if (!poc_send_batch(sock, saddr, first, j - first, NULL))
+          return 0;
+
+        int ret = fec_pkt_sendto_run(sock, tx_batch.iovs[j].iov_base, len,
+                                     tx_batch.iovs[j].iov_len,
+                                     (struct sockaddr *)saddr, sizeof(*saddr));
+        if (ret < (int)run) {
+          if ((ret >= 0) || (errno == ENOBUFS)) {
+            fprintf(stderr, "Output buffers full, waiting...\n");
+          } else {
+            perror("Error while sending packet");
+            return 0;
+          }
+        }
+
+        j += run;
+        first = j;
+      }
+
+      if (!poc_send_batch(sock, saddr, first, cnt - first, NULL))
+        return 0;
+    } else if (!poc_send_batch(sock, saddr, 0, cnt,
+                               use_txtime ? txtimes : NULL)) {
+      return 0;
+    }
+
+    /*M
+      Update the time we have to wait.
+    **/
+    wait_time += pkts * interval;
+    fec_time2 += pkts * interval;
+
+    /*M
+      Sender synchronisation (\verb|sleep| until the next
+      micro-batch has to be sent.
+    **/
+    if (wait_time > 1000)
+      usleep(wait_time);
+
+    if (!quiet) {        
+      static unsigned int count = 0;
+      if ((count += pkts) >= 10) {
+        count = 0;
+        unsigned long fec_time = group->tstamp;
+        if (mp3_file->size > 0) {
+          fprintf(stdout,
+                  "\r%02ld:%02ld/%02ld:%02ld %7ld/%7ld %3ldkbit/s (%3ld%%) ",
+                  (fec_time2/1000000) / 60,
+                  (fec_time2/1000000) % 60,
+                  
+                  (long)((float)(fec_time/1000) / 
+                   ((float)mp3_file->offset+1) * (float)mp3_file->size) / 
+                  60000,
+                  (long)((float)(fec_time/1000) / 
+                   ((float)mp3_file->offset+1) * (float)mp3_file->size) / 
+                  1000 % 60,
+                  
+                  mp3_file->offset,
+                  mp3_file->size,
+
+                  group->bitrate,
+                  
+                  (long)(100*(float)mp3_file->offset/(float)mp3_file->size));
+        } else {
+          fprintf(stdout, "\r%02ld:%02ld %ld %3ldkbit/s ",
+                  (fec_time2/1000000) / 60,
+                  (fec_time2/1000000) % 60,
+                  mp3_file->offset,
+                  group->bitrate);
+        }
+        fflush(stdout);
+      }
+    }
+    
+    /*M
+      Get length of iteration.
+    **/
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    unsigned long len =
+      (tv.tv_sec - start_sec) * 1000000 + (tv.tv_usec - start_usec);
+    
+    wait_time -= len;
+    if (abs(wait_time) > MAX_WAIT_TIME) {
+      wait_time = 0;
+      tx_next = net_txtime_now();
+    }
+
+    start_sec = tv.tv_sec;
+    start_usec = tv.tv_usec;
+  }
+
+  pkt.hdr.group_seq = groups[num - 1]->seq + 1;
+
+  return 1;
+}
+
+/*M
+  \emph{Create a group to be encoded by the encoding threads.}
+
+  Takes over the ADUs, which are released to \verb|aq| when the group
+  is freed, and copies them zero padded into a buffer followed by the
+  redundant packets.
+**/
+static poc_group_t *poc_group_new(fec_t *fec, aq_t *aq, adu_t *adus[],
+                                  unsigned int max_len) {
+  poc_group_t *group = malloc(sizeof(poc_group_t));
+  assert(group != NULL);
+
+  group->aq = aq;
+  group->adus = malloc(sizeof(adu_t *) * fec_k);
+  group->ptrs = malloc(sizeof(unsigned char *) * fec_n);
+  group->buf = malloc(fec_n * max_len);
+  group->fec_n = fec_n;
+  assert((group->adus != NULL) && (group->ptrs != NULL) &&
+         (group->buf != NULL));
+
+  unsigned int i;
+  for (i = 0; i < fec_n; i++)
+    group->ptrs[i] = group->buf + i * max_len;
+
+  for (i = 0; i < fec_k; i++) {
+    unsigned int adu_len = mp3_frame_size(adus[i]);
+
+    group->adus[i] = adus[i];
+    memcpy(group->ptrs[i], adus[i]->raw, adu_len);
+    memset(group->ptrs[i] + adu_len, 0, max_len - adu_len);
+  }
+
+  group->fec_ptrs = group->ptrs + fec_k;
+  group->max_len = max_len;
+  assert(fec->n == fec_n);
+
+  group->job.fec = fec;
+  group->job.src = group->ptrs;
+  group->job.dst = group->fec_ptrs;
+  group->job.len = max_len;
+  group->job.data = group;
+
+  return group;
+}
+
+/*M
+  \emph{Free a group created by \verb|poc_group_new|.}
+**/
+static void poc_group_free(poc_group_t *group) {
+  unsigned int i;
+  for (i = 0; i < fec_k; i++)
+    aq_release(group->aq, group->adus[i]);
+
+  free(group->adus);
+  free(group->ptrs);
+  free(group->buf);
+  free(group);
+}
+
+/*M
+  \emph{Send and free the groups waiting to be interleaved.}
+
+  Returns 0 on error, 1 on success.
+**/
+static int poc_flush_groups(int sock, struct sockaddr_in *saddr,
+                            file_t *mp3_file) {
+  int ret = 1;
+  if (il_cnt > 0)
+    ret = poc_send_groups(sock, saddr, mp3_file, il_groups, il_cnt);
+
+  unsigned int i;
+  for (i = 0; i < il_cnt; i++)
+    poc_group_free(il_groups[i]);
+  il_cnt = 0;
+
+  return ret;
+}
+
+/*M
+  \emph{Send the encoded groups.}
+
+  Collects the groups handed back by the encoding pool (in order),
+  and sends them as soon as \verb|interleave| groups are
+  available. If \verb|block| is set, waits for the oldest group.
+  Returns 0 on error, 1 on success.
+**/
+static int poc_send_encoded(int sock, struct sockaddr_in *saddr,
+                            file_t *mp3_file, fec_pool_t *pool,
+                            int block) {
+  fec_job_t *job;
+  while ((job = fec_pool_get(pool, block)) != NULL) {
+    il_groups[il_cnt++] = job->data;
+    if ((il_cnt == interleave) &&
+        !poc_flush_groups(sock, saddr, mp3_file))
+      return 0;
+  }
+
+  return 1;
+}
+
+/*M
+  \emph{Choose $n$ for the next group from the loss reports.}
+
+  Reads the pending reports without blocking and keeps the worst
+  packet loss rate $p$. The group is then encoded with enough
+  redundancy for a loss rate of $2p$, and with at least one more
+  packet when a receiver could not decode a group. $n$ is increased
+  at once, but decreased by one packet per round of reports, so that
+  a single clean window does not remove the protection. Returns the
+  FEC parameters for the next group.
+**/
+static fec_t *poc_adapt_fec(fec_t *fec) {
+  double loss = -1.0;
+  int unrecoverable = 0;
+
+  /* one more byte, so that longer datagrams are not taken for reports */
+  unsigned char buf[FEC_REPORT_SIZE + 1];
+  int len;
+  while ((len = recv(fb_sock, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+    fec_report_t report;
+    if (!fec_report_parse(&report, buf, len))
+      continue;
+
+    /*M
+      Ignore the reports about a previous run of the server.
+    **/
+    if (use_stream_hdr && (report.stream_id != stream_id))
+      continue;
+
+    unsigned long pkts = report.rcvd_pkts + report.lost_pkts;
+    if (pkts == 0)
+      continue;
+
+    double rate = (double)report.lost_pkts / (double)pkts;
+    if (rate > loss)
+      loss = rate;
+    if (report.lost_groups > 0)
+      unrecoverable = 1;
+  }
+
+  if (loss < 0)
+    return fec;
+
+  unsigned int n;
+  if (2 * loss >= 0.9)
+    n = adapt_max_n;
+  else
+    n = (unsigned int)((double)fec_k / (1.0 - 2 * loss) + 0.999);
+
+  if (unrecoverable && (n <= fec_n))
+    n = fec_n + 1;
+  else if (n < fec_n)
+    n = fec_n - 1;
+
+  if (n < adapt_min_n)
+    n = adapt_min_n;
+  if (n > adapt_max_n)
+    n = adapt_max_n;
+
+  if (n != fec_n) {
+    if (!quiet)
+      fprintf(stderr, "\nLoss rate %.1f%%, sending %u packets per group\n",
+              loss * 100, n);
+    fec_n = n;
+    fec = fec_cache_get(fec_k, fec_n, fec_scheme);
+  }
+
+  return fec;
+}
+
 /*M
 **/
 int poc_encoder(int sock, struct sockaddr_in *saddr, char *filename) {
@@ -70,9 +650,9 @@ int poc_encoder(int sock, struct sockaddr_in *saddr, char *filename) {
   }
 
   /*M
-    Initialize the FEC parameters.
+    Get the FEC parameters (built once in \verb|main|).
   **/
-  fec_t *fec = fec_new(fec_k, fec_n);
+  fec_t *fec = fec_cache_get(fec_k, fec_n, fec_scheme);
 
   aq_t adu_queue;
   aq_init(&adu_queue);
@@ -80,35 +660,83 @@ int poc_encoder(int sock, struct sockaddr_in *saddr, char *filename) {
   adu_t *in_adus[fec_k];
   unsigned int cnt = 0;
 
-  static long wait_time = 0;
+  /*M
+    Buffers for the redundant packets. Without encoding threads and
+    with the Vandermonde and \gf{2^16} schemes, each ADU is added to
+    them as soon as it is produced, so the encoding work is spread
+    over the group.
+  **/
+  int incremental = (fec_scheme != FEC_SCHEME_CAUCHY) &&
+    (num_threads == 0) && (interleave == 1);
+  unsigned char *fec_ptrs[adapt_max_n - fec_k];
+  unsigned char *fec_buf = calloc(adapt_max_n - fec_k, MP3_RAW_SIZE);
+  assert(fec_buf != NULL);
+  int i;
+  for (i = 0; i < adapt_max_n - fec_k; i++)
+    fec_ptrs[i] = fec_buf + i * MP3_RAW_SIZE;
+
+  /*M
+    With encoding threads, up to two groups per thread are in flight,
+    so that the threads are busy while a group is being sent.
+  **/
+  fec_pool_t pool;
+  if (!fec_pool_init(&pool, num_threads)) {
+    fprintf(stderr, "Could not start the encoding threads\n");
+    free(fec_buf);
+    aq_destroy(&adu_queue);
+    file_close(&mp3_file);
+    return 0;
+  }
+  unsigned int max_inflight = 2 * num_threads;
+
   unsigned long fec_time = 0;
-  unsigned long fec_time2 = 0;
+  fec_time2 = 0;
 
   /*M
     Get start time.
   **/
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  unsigned long start_sec, start_usec;
   start_sec = tv.tv_sec;
   start_usec = tv.tv_usec;
+  tx_next = net_txtime_now();
   
   /*M
     Get next MP3 frame and queue it into the ADU queue.
   **/
-  mp3_frame_t mp3_frame;
+  unsigned char raw[MP3_RAW_SIZE];
+  mp3_frame_t mp3_frame = { .raw = raw };
   while ((mp3_next_frame(&mp3_file, &mp3_frame) > 0) && !finished) {
     if (aq_add_frame(&adu_queue, &mp3_frame) > 0) {
       /* a new ADU has been produced */
       in_adus[cnt] = aq_get_adu(&adu_queue);
       assert(in_adus[cnt] != NULL);
 
+      if (incremental) {
+        /*M
+          The ADU only holds its own bytes, copy it to zero the padding
+          up to the length the scheme works on.
+        **/
+        unsigned int adu_len = mp3_frame_size(in_adus[cnt]);
+        unsigned int pad_len = fec_pad_len(fec, adu_len);
+        assert(pad_len <= MP3_RAW_SIZE);
+        unsigned char pad_buf[MP3_RAW_SIZE];
+        unsigned char *src = in_adus[cnt]->raw;
+        if (pad_len > adu_len) {
+          memcpy(pad_buf, src, adu_len);
+          memset(pad_buf + adu_len, 0, pad_len - adu_len);
+          src = pad_buf;
+        }
+
+        fec_encode_add(fec, src, fec_ptrs, cnt, pad_len);
+      }
+
       /* check if the FEC group is complete */
       if (++cnt == fec_k) {
         unsigned int max_len = 0;
         unsigned long group_duration = 0;
+        unsigned long bitrate = 0;
 
-        int i;
         for (i = 0; i < fec_k; i++) {
           unsigned int adu_len = mp3_frame_size(in_adus[i]);
 
@@ -116,150 +744,134 @@ int poc_encoder(int sock, struct sockaddr_in *saddr, char *filename) {
             max_len = adu_len;
 
           group_duration += in_adus[i]->usec;
+          bitrate += in_adus[i]->bitrate;
         }
+        bitrate /= fec_k;
 
         fec_time += group_duration;
 
-        assert(max_len < FEC_PKT_PAYLOAD_SIZE);
-
-        /* Encode the FEC group */
-        unsigned char *in_ptrs[fec_k];
-        unsigned char buf[fec_k * max_len];
-        unsigned char *ptr = buf;
-        unsigned long bitrate = 0;
-        for (i = 0; i < fec_k; i++) {
-          unsigned int adu_len = mp3_frame_size(in_adus[i]);
+        /*M
+          The Cauchy and \gf{2^16} schemes need aligned packet
+          lengths, and the receiver has to decode with exactly the
+          encoded length.
+        **/
+        unsigned int fec_len = max_len + 2;
+        if (fec_scheme != FEC_SCHEME_VANDERMONDE)
+          fec_len = max_len = fec_pad_len(fec, max_len);
 
-          in_ptrs[i] = ptr;
-          memcpy(ptr, in_adus[i]->raw, adu_len);
-          if (adu_len < max_len)
-            memset(ptr + adu_len, 0, max_len - adu_len);
-          ptr += max_len;
-          bitrate += in_adus[i]->bitrate;
-        }
-        bitrate /= fec_k;
-
-        for (i = 0; i < fec_n; i++) {
-          pkt.hdr.packet_seq = i;
-          pkt.hdr.fec_k = fec_k;
-          pkt.hdr.fec_n = fec_n;
-          pkt.hdr.fec_len = max_len + 2;
-          pkt.hdr.group_tstamp = fec_time;
-          
-          fec_encode(fec, in_ptrs, pkt.payload, i, max_len);
-
-          if (i < fec_k) {
-            pkt.hdr.len = mp3_frame_size(in_adus[i]);
-          } else {
-            pkt.hdr.len = max_len;
-          }
+        assert(max_len <= MP3_RAW_SIZE);
 
+        if ((num_threads > 0) || (interleave > 1)) {
           /*M
-            Simulate packet loss.
+            Hand the group to the encoding threads, and send the
+            groups encoded so far. Block when enough groups are in
+            flight. Groups to be interleaved are kept in their own
+            buffers, without threads they are encoded right away.
           **/
-#ifdef DEBUG_PLOSS
-          if ((random() % 100) >= ploss_rate ) {
-#endif /* DEBUG_PLOSS */
+          poc_group_t *group = poc_group_new(fec, &adu_queue, in_adus, max_len);
+          group->fec_len = fec_len;
+          group->duration = group_duration;
+          group->bitrate = bitrate;
+          group->tstamp = fec_time;
+          fec_pool_submit(&pool, &group->job);
+          cnt = 0;
 
-#ifdef DEBUG
-            fprintf(stderr,
-                    "sending fec packet group stamp %ld, gseq %d, pseq %d, size %d\n",
-                    pkt.hdr.group_tstamp, pkt.hdr.group_seq, pkt.hdr.packet_seq, pkt.hdr.len);
-#endif
-            
-            /* send rtp packet */
-            if (fec_pkt_sendto(&pkt, sock, (struct sockaddr *)saddr, sizeof(*saddr)) < 0) {
-              if (errno == ENOBUFS) {
-		fprintf(stderr, "Output buffers full, waiting...\n");
-	      } else {
-                perror("Error while sending packet");
-                
-                retval = 0;
-                goto exit;
-              }
-            }
-#ifdef DEBUG_PLOSS
+          if (!poc_send_encoded(sock, saddr, &mp3_file, &pool,
+                                fec_pool_length(&pool) >= max_inflight)) {
+            retval = 0;
+            goto exit;
           }
-#endif /* DEBUG_PLOSS */
 
-          /*M
-            Update the time we have to wait.
-          **/
-          wait_time += (group_duration / fec_n);
-          fec_time2 += (group_duration / fec_n);
+          if (fb_sock >= 0)
+            fec = poc_adapt_fec(fec);
+          continue;
+        }
 
+        if (!incremental) {
           /*M
-            Sender synchronisation (\verb|sleep| until the next
-            packet has to be sent.
+            Copy the zero padded ADUs and compute all redundant
+            packets in one pass over them.
           **/
-          if (wait_time > 1000)
-            usleep(wait_time);
-
-          if (!quiet) {        
-            static unsigned int count = 0;
-            if ((count++ % 10) == 0) {
-              if (mp3_file.size > 0) {
-                fprintf(stdout,
-                        "\r%02ld:%02ld/%02ld:%02ld %7ld/%7ld %3ldkbit/s (%3ld%%) ",
-                        (fec_time2/1000000) / 60,
-                        (fec_time2/1000000) % 60,
-                        
-                        (long)((float)(fec_time/1000) / 
-                         ((float)mp3_file.offset+1) * (float)mp3_file.size) / 
-                        60000,
-                        (long)((float)(fec_time/1000) / 
-                         ((float)mp3_file.offset+1) * (float)mp3_file.size) / 
-                        1000 % 60,
-                        
-                        mp3_file.offset,
-                        mp3_file.size,
-
-                        bitrate,
-                        
-                        (long)(100*(float)mp3_file.offset/(float)mp3_file.size));
-              } else {
-                fprintf(stdout, "\r%02ld:%02ld %ld %3ldkbit/s ",
-                        (fec_time2/1000000) / 60,
-                        (fec_time2/1000000) % 60,
-                        mp3_file.offset,
-                        bitrate);
-              }
-              fflush(stdout);
-            }
+          unsigned char *in_ptrs[fec_k];
+          unsigned char buf[fec_k * max_len];
+          unsigned char *ptr = buf;
+          for (i = 0; i < fec_k; i++) {
+            unsigned int adu_len = mp3_frame_size(in_adus[i]);
+
+            in_ptrs[i] = ptr;
+            memcpy(ptr, in_adus[i]->raw, adu_len);
+            if (adu_len < max_len)
+              memset(ptr + adu_len, 0, max_len - adu_len);
+            ptr += max_len;
           }
-          
-          /*M
-            Get length of iteration.
-          **/
-          gettimeofday(&tv, NULL);
-          unsigned long len =
-            (tv.tv_sec - start_sec) * 1000000 + (tv.tv_usec - start_usec);
-          
-          wait_time -= len;
-          if (abs(wait_time) > MAX_WAIT_TIME)
-            wait_time = 0;
-
-          start_sec = tv.tv_sec;
-          start_usec = tv.tv_usec;
+
+          fec_encode_all(fec, in_ptrs, fec_ptrs, max_len);
         }
 
-        pkt.hdr.group_seq++;
+        poc_group_t group;
+        group.aq = &adu_queue;
+        group.adus = in_adus;
+        group.fec_ptrs = fec_ptrs;
+        group.max_len = max_len;
+        group.fec_len = fec_len;
+        group.duration = group_duration;
+        group.bitrate = bitrate;
+        group.tstamp = fec_time;
+        group.fec_n = fec_n;
+
+        poc_group_t *group_ptr = &group;
+        if (!poc_send_groups(sock, saddr, &mp3_file, &group_ptr, 1)) {
+          retval = 0;
+          goto exit;
+        }
 
         for (i = 0; i < fec_k; i++)
-          free(in_adus[i]);
+          aq_release(&adu_queue, in_adus[i]);
+
+        /*M
+          Clear the redundant packets for the next group.
+        **/
+        if (incremental)
+          for (i = 0; i < fec_n - fec_k; i++)
+            memset(fec_ptrs[i], 0, max_len);
+
+        if (fb_sock >= 0)
+          fec = poc_adapt_fec(fec);
 
         cnt = 0;
       }
     }
   }
 
-  int i;
+  /*M
+    Send the groups still being encoded, and the last, possibly
+    incomplete, set of interleaved groups.
+  **/
+  if (!finished && (!poc_send_encoded(sock, saddr, &mp3_file, &pool, 1) ||
+                    !poc_flush_groups(sock, saddr, &mp3_file)))
+    retval = 0;
+
  exit:
+  /*M
+    Free the groups which have not been sent.
+  **/
+  {
+    fec_job_t *job;
+    while ((job = fec_pool_get(&pool, 1)) != NULL)
+      poc_group_free(job->data);
+    for (i = 0; i < il_cnt; i++)
+      poc_group_free(il_groups[i]);
+    il_cnt = 0;
+  }
+  fec_pool_destroy(&pool);
+
+  impair_flush(&impair, sock, (struct sockaddr *)saddr, sizeof(*saddr));
+
   for (i = 0; i < cnt; i++)
-    free(in_adus[i]);
+    aq_release(&adu_queue, in_adus[i]);
   
+  free(fec_buf);
   aq_destroy(&adu_queue);
-  fec_free(fec);
 
   file_close(&mp3_file);
 
@@ -271,7 +883,7 @@ int poc_encoder(int sock, struct sockaddr_in *saddr, char *filename) {
 **/
 static void usage(void) {
   fprintf(stderr,
-          "Usage: ./poc-fec [-s address] [-p port] [-k fec_k] [-n fec_n] [-q] [-t ttl]");
+          "Usage: ./poc-fec [-s address] [-p port] [-k fec_k] [-n fec_n] [-c] [-w] [-j threads] [-T] [-B usecs] [-G] [-x] [-i id] [-I depth] [-f port] [-N min_n:max_n] [-P spec] [-q] [-t ttl]");
 #ifdef WITH_IPV6
   fprintf(stderr, " [-6]");
 #endif /* WITH_IPV6 */
@@ -282,6 +894,20 @@ static void usage(void) {
   fprintf(stderr, "\t-t ttl     : multicast ttl (default 1)\n");
   fprintf(stderr, "\t-k fec_k   : FEC k parameter (default 20)\n");
   fprintf(stderr, "\t-n fec_n   : FEC n parameter (default 25)\n");
+  fprintf(stderr, "\t-c         : use the XOR based Cauchy FEC scheme\n");
+  fprintf(stderr, "\t-w         : use the GF(2^16) FEC scheme (fec_n up to 65535)\n");
+  fprintf(stderr, "\t-j threads : number of FEC encoding threads (default 0)\n");
+  fprintf(stderr, "\t-T         : let the kernel pace the packets (SO_TXTIME)\n");
+  fprintf(stderr, "\t-B usecs   : send packets in batches spanning usecs (default 20000,\n");
+  fprintf(stderr, "\t             500000 with -T)\n");
+  fprintf(stderr, "\t-G         : send runs of equal sized packets with UDP segmentation offload\n");
+  fprintf(stderr, "\t-x         : send the stream header (32 bits group sequence numbers)\n");
+  fprintf(stderr, "\t-i id      : stream id sent in the stream header (default random, implies -x)\n");
+  fprintf(stderr, "\t-I depth   : interleave the packets of depth groups (default 1)\n");
+  fprintf(stderr, "\t-f port    : adapt fec_n to the loss reports received on port\n");
+  fprintf(stderr, "\t-N min:max : bounds of the adapted fec_n (default fec_k+1:2*fec_n)\n");
+  fprintf(stderr, "\t-P spec    : impair the sent packets, for example loss=5,p=1,r=20\n");
+  fprintf(stderr, "\t             (default $" IMPAIR_ENV ")\n");
 #ifdef WITH_IPV6
   fprintf(stderr, "\t-6         : use ipv6\n");
 #endif /* WITH_IPV6 */
@@ -298,12 +924,14 @@ int main(int argc, char *argv[]) {
   char           *address = NULL;
   unsigned short port     = 1500;
   unsigned int   ttl      = 1;
+  unsigned short fb_port  = 0;
+  char           *impair_spec = NULL;
 
   /*M
     Process the command line arguments.
   **/
   int c;
-  while ((c = getopt(argc, argv, "hs:p:t:qP:k:n:"
+  while ((c = getopt(argc, argv, "hs:p:t:qP:k:n:cwj:TB:Gxi:I:f:N:"
 #ifdef WITH_IPV6
                      "6"
 #endif /* WITH_IPV6 */
@@ -341,17 +969,60 @@ int main(int argc, char *argv[]) {
     case 'n':
       fec_n = (unsigned int)atoi(optarg);
       break;
-      
-#ifdef DEBUG_PLOSS
-    case 'P':
+
+    case 'c':
+      fec_scheme = FEC_SCHEME_CAUCHY;
+      break;
+
+    case 'w':
+      fec_scheme = FEC_SCHEME_GF16;
+      break;
+
+    case 'j':
+      num_threads = (unsigned int)atoi(optarg);
+      break;
+
+    case 'T':
+      use_txtime = 1;
+      break;
+
+    case 'B':
+      tx_quantum = (unsigned long)atol(optarg);
+      break;
+
+    case 'G':
+      use_gso = 1;
+      break;
+
+    case 'x':
+      use_stream_hdr = 1;
+      break;
+
+    case 'i':
+      use_stream_hdr = 1;
+      stream_id = strtoul(optarg, NULL, 0) & 0xffffffffUL;
+      break;
+
+    case 'I':
+      interleave = (unsigned int)atoi(optarg);
+      break;
+
+    case 'f':
+      fb_port = (unsigned short)atoi(optarg);
+      break;
+
+    case 'N':
       {
-        static struct timeval tv;
-        gettimeofday(&tv, NULL);
-        srandom(tv.tv_sec);
-        ploss_rate = atoi(optarg);
+        char *sep = strchr(optarg, ':');
+        adapt_min_n = (unsigned int)atoi(optarg);
+        if (sep != NULL)
+          adapt_max_n = (unsigned int)atoi(sep + 1);
         break;
       }
-#endif /* DEBUG_PLOSS */
+      
+    case 'P':
+      impair_spec = optarg;
+      break;
 
     case 'h':
     default:
@@ -367,6 +1038,57 @@ int main(int argc, char *argv[]) {
     goto exit;
   }
 
+  unsigned char version = use_stream_hdr ?
+    FEC_PKT_STREAM_VERSION(fec_scheme) : FEC_PKT_VERSION(fec_scheme);
+  unsigned int max_n = FEC_PKT_MAX_FEC_N(version);
+  if (max_n > fec_max_n(fec_scheme))
+    max_n = fec_max_n(fec_scheme);
+  if (fec_n > max_n) {
+    fprintf(stderr, "fec_n must not be bigger than %u for this FEC scheme\n",
+            max_n);
+    retval = EXIT_FAILURE;
+    goto exit;
+  }
+
+  /*M
+    Check the bounds of the adapted $n$, and start within them.
+  **/
+  if (fb_port != 0) {
+    if (adapt_min_n == 0)
+      adapt_min_n = fec_k + 1;
+    if (adapt_max_n == 0)
+      adapt_max_n = (2 * fec_n < max_n) ? 2 * fec_n : max_n;
+    if ((adapt_min_n <= fec_k) || (adapt_max_n < adapt_min_n) ||
+        (adapt_max_n > max_n)) {
+      fprintf(stderr, "The bounds of fec_n must be between %u and %u\n",
+              fec_k + 1, max_n);
+      retval = EXIT_FAILURE;
+      goto exit;
+    }
+    if (fec_n < adapt_min_n)
+      fec_n = adapt_min_n;
+    if (fec_n > adapt_max_n)
+      fec_n = adapt_max_n;
+  } else {
+    adapt_min_n = adapt_max_n = fec_n;
+  }
+
+  if (!impair_init(&impair, impair_spec)) {
+    fprintf(stderr, "Invalid impairment specification\n");
+    retval = EXIT_FAILURE;
+    goto exit;
+  }
+  if (impair.enabled && !quiet)
+    fprintf(stderr, "Impairing the sent packets, seed %llu\n", impair.seed);
+
+  if (interleave < 1) {
+    fprintf(stderr, "The interleaving depth must be at least 1\n");
+    retval = EXIT_FAILURE;
+    goto exit;
+  }
+  il_groups = malloc(sizeof(poc_group_t *) * interleave);
+  assert(il_groups != NULL);
+
   if (optind == argc) {
     usage();
     retval = EXIT_FAILURE;
@@ -407,7 +1129,60 @@ int main(int argc, char *argv[]) {
     goto exit;
   }
 
+  if (impair.enabled && (use_gso || use_txtime)) {
+    fprintf(stderr, "Impaired packets are sent without send times or offload\n");
+    use_gso = use_txtime = 0;
+  }
+
+  /*M
+    Let the kernel pace the packets if requested.
+  **/
+  if (use_txtime && !net_udp_set_txtime(sock)) {
+    fprintf(stderr, "Could not set SO_TXTIME, pacing without send times\n");
+    use_txtime = 0;
+  }
+  if (tx_quantum == 0)
+    tx_quantum = use_txtime ? TX_TXTIME_QUANTUM : TX_QUANTUM;
+
+  /*M
+    The segments of an offloaded run share one send time.
+  **/
+  if (use_gso && use_txtime) {
+    fprintf(stderr, "Segmentation offload is not used with send times\n");
+    use_gso = 0;
+  }
+  net_batch_init(&tx_batch, TX_MAX_BATCH);
+
+  /*M
+    Open the socket receiving the loss reports.
+  **/
+  if (fb_port != 0) {
+    fb_sock = net_udp4_recv_socket("0.0.0.0", fb_port);
+    if (fb_sock < 0) {
+      fprintf(stderr, "Could not open the feedback socket\n");
+      retval = EXIT_FAILURE;
+      goto exit;
+    }
+  }
+
   fec_pkt_init(&pkt);
+  pkt.hdr.version = version;
+  if (use_stream_hdr) {
+    if (stream_id == 0) {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      stream_id = (tv.tv_sec ^ (tv.tv_usec << 12) ^
+                   ((unsigned long)getpid() << 16)) & 0xffffffffUL;
+      if (stream_id == 0)
+        stream_id = 1;
+    }
+    pkt.hdr.stream_id = stream_id;
+  }
+
+  /*M
+    Build the generator matrix once for all files.
+  **/
+  fec_cache_get(fec_k, fec_n, fec_scheme);
   
   /*M
     Go through all files given on command line and stream them.
@@ -424,6 +1199,18 @@ int main(int argc, char *argv[]) {
   }
   
  exit:
+  fec_cache_destroy();
+  impair_destroy(&impair);
+
+  if (tx_batch.size > 0)
+    net_batch_destroy(&tx_batch);
+  if (tx_buf != NULL)
+    free(tx_buf);
+  if (il_groups != NULL)
+    free(il_groups);
+  if (fb_sock >= 0)
+    close(fb_sock);
+
   if (address != NULL)
     free(address);
   
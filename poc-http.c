@@ -68,7 +68,8 @@ int poc_mainloop(http_server_t *server, char *filename, int quiet) {
   static long wait_time = 0;
   unsigned long frame_time = 0;
   
-  mp3_frame_t    frame;
+  unsigned char  raw[MP3_RAW_SIZE];
+  mp3_frame_t    frame = { .raw = raw };
 
   /*M
     Cycle through the frames and send them using HTTP.
@@ -10,87 +10,70 @@
 #include <string.h>
 
 #include "rtp.h"
+#include "rtp-rb.h"
 
-/*M
-  \emph{Maximal number of elements in the ring buffer.}
-**/
-unsigned int rtp_rb_size  = 0;
-
-/*M
-  \emph{Index of first valid element in ring buffer.}
-**/
-static unsigned int rtp_rb_start = 0;
-
-/*M
-  \emph{Index of first invalid element in ring buffer.}
+void rtp_rb_clear(rtp_rb_t *rb) {
+  assert(rb != NULL);
 
-**/
-static unsigned int rtp_rb_end  = 0;
-
-/*M
-  \emph{Number of elements in the ring buffer.}
-**/
-unsigned int rtp_rb_cnt   = 0;
+  rb->start = 0;
+  rb->end   = 0;
+  rb->cnt   = 0;
 
-/*M
-  \emph{Ring buffer array.}
-**/
-rtp_pkt_t *rtp_rb = NULL;
-
-void rtp_rb_clear(void) {
-  rtp_rb_start = 0;
-  rtp_rb_end   = 0;
-  rtp_rb_cnt   = 0;
-
-  int i;
-  for (i = 0; i < rtp_rb_size; i++) {
-    rtp_pkt_init(rtp_rb + i);
-    rtp_rb[i].length = 0;
+  unsigned int i;
+  for (i = 0; i < rb->size; i++) {
+    rtp_pkt_init(rb->pkts + i);
+    rb->pkts[i].length = 0;
   }
 }
 
-void rtp_rb_destroy(void) {
-  if (rtp_rb != NULL) {
-    free(rtp_rb);
-    rtp_rb = NULL;
+void rtp_rb_destroy(rtp_rb_t *rb) {
+  assert(rb != NULL);
+
+  if (rb->pkts != NULL) {
+    free(rb->pkts);
+    rb->pkts = NULL;
   }
 
-  rtp_rb_size = 0;
-  rtp_rb_clear();
+  rb->size = 0;
+  rtp_rb_clear(rb);
 }
 
-void rtp_rb_init(unsigned int size) {
-  rtp_rb_destroy();
+void rtp_rb_init(rtp_rb_t *rb, unsigned int size) {
+  assert(rb != NULL);
+  assert(size > 1);
 
-  rtp_rb = malloc(sizeof(rtp_pkt_t) * size);
-  assert(rtp_rb != NULL);
+  rb->pkts = malloc(sizeof(rtp_pkt_t) * size);
+  assert(rb->pkts != NULL);
 
-  rtp_rb_size = size;
-  rtp_rb_clear();
+  rb->size = size;
+  rtp_rb_clear(rb);
 }
   
-unsigned int rtp_rb_length(void) {
-  assert(rtp_rb != NULL);
+unsigned int rtp_rb_length(rtp_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->pkts != NULL);
   
-  if (rtp_rb_end >= rtp_rb_start)
-    return rtp_rb_end - rtp_rb_start;
+  if (rb->end >= rb->start)
+    return rb->end - rb->start;
   else
-    return rtp_rb_end + (rtp_rb_size - rtp_rb_start);
+    return rb->end + (rb->size - rb->start);
 }
 
-void rtp_rb_pop(void) {
-  assert(rtp_rb != NULL);
-  assert(rtp_rb_end != rtp_rb_start);
+void rtp_rb_pop(rtp_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->pkts != NULL);
+  assert(rb->end != rb->start);
 
-  rtp_rb[rtp_rb_start].length = 0;
-  rtp_rb_start = (rtp_rb_start + 1) % rtp_rb_size;
+  rb->pkts[rb->start].length = 0;
+  rb->start = (rb->start + 1) % rb->size;
 
-  rtp_rb_cnt--;
+  rb->cnt--;
 }
 
-int rtp_rb_insert_pkt(rtp_pkt_t *pkt, int idx) {
+int rtp_rb_insert_pkt(rtp_rb_t *rb, rtp_pkt_t *pkt, int idx) {
+  assert(rb != NULL);
   assert(pkt != NULL);
-  assert(rtp_rb != NULL);
+  assert(rb->pkts != NULL);
 
 #ifdef DEBUG
   fprintf(stderr, "insert packet at idx %d\n", idx);
@@ -98,60 +81,65 @@ int rtp_rb_insert_pkt(rtp_pkt_t *pkt, int idx) {
   
   if (idx < 0) {
     /* try to grow the buffer downwards */
-    if ((rtp_rb_length() - idx) <= rtp_rb_size) {
-      rtp_rb_start = (rtp_rb_start + idx) % rtp_rb_size;
+    if ((rtp_rb_length(rb) - idx) <= rb->size) {
+      rb->start = (rb->start + rb->size + idx) % rb->size;
       idx = 0;
     } else
       /* drop the packet silently */
       return 0;
-  } else if (idx >= rtp_rb_size - 1) {
+  } else if (idx >= (int)rb->size - 1) {
     /* not enough place left in ring buffer */
     return 0;
   }
 
 
-  rtp_pkt_t *dstpkt = rtp_rb + ((idx + rtp_rb_start) % rtp_rb_size);
-  assert(dstpkt->length == 0);
+  rtp_pkt_t *dstpkt = rb->pkts + ((idx + rb->start) % rb->size);
+  if (dstpkt->length != 0)
+    /* duplicate packet, drop it */
+    return -1;
   memcpy(dstpkt, pkt, sizeof(rtp_pkt_t));
-  rtp_rb_cnt++;
+  rb->cnt++;
 
 #ifdef DEBUG
   fprintf(stderr, "packet inserted at %d, end: %d\n",
-          (idx + rtp_rb_start) % rtp_rb_size,
-          rtp_rb_end);
+          (idx + rb->start) % rb->size, rb->end);
 #endif
   
   /* adjust the end pointer */
-  if (idx >= rtp_rb_length()) 
-    rtp_rb_end = ((idx + rtp_rb_start + 1)% rtp_rb_size);
+  if (idx >= (int)rtp_rb_length(rb))
+    rb->end = ((idx + rb->start + 1) % rb->size);
 
-  assert(rtp_rb_start != rtp_rb_end);
-  assert(rtp_rb[rtp_rb_end].length == 0);
+  assert(rb->start != rb->end);
+  assert(rb->pkts[rb->end].length == 0);
 
   return 1;
 }
 
-void rtp_rb_print(void) {
-  assert(rtp_rb != NULL);
+void rtp_rb_print(rtp_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->pkts != NULL);
 
   fprintf(stderr, "start: %.3u, end: %.3u, len: %.3u\n",
-          rtp_rb_start, rtp_rb_end, rtp_rb_length());
+          rb->start, rb->end, rtp_rb_length(rb));
 }
 
-void rtp_rb_print_rb(void) {
+void rtp_rb_print_rb(rtp_rb_t *rb) {
+  assert(rb != NULL);
+
   unsigned int i;
-  for (i = rtp_rb_start; i != rtp_rb_end; i = (i + 1) % rtp_rb_size) {
-    if (rtp_rb[i].length != 0)
-      fprintf(stderr, "%.3u: seq %.3u\n", i, rtp_rb[i].b.seq);
+  for (i = rb->start; i != rb->end; i = (i + 1) % rb->size) {
+    if (rb->pkts[i].length != 0)
+      fprintf(stderr, "%.3u: seq %.3u\n", i, rb->pkts[i].b.seq);
   }
 }
 
-rtp_pkt_t *rtp_rb_first(void) {
-  assert(rtp_rb != NULL);
+rtp_pkt_t *rtp_rb_first(rtp_rb_t *rb) {
+  assert(rb != NULL);
+  assert(rb->pkts != NULL);
 
-  if (rtp_rb_start == rtp_rb_end)
+  if (rb->start == rb->end)
     return NULL;
 
   /* first should always be the first in buffer */
-  return rtp_rb + rtp_rb_start;
+  return rb->pkts + rb->start;
 }
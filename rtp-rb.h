@@ -5,16 +5,39 @@
 #ifndef RTP_RB_H__
 #define RTP_RB_H__
 
-extern unsigned int rtp_rb_cnt;
-extern unsigned int rtp_rb_size;
+/*M
+  \emph{Ring buffer of RTP packets.}
+**/
+typedef struct rtp_rb_s {
+  /*M
+    Maximal number of elements in the ring buffer.
+  **/
+  unsigned int size;
+  /*M
+    Index of first valid element in ring buffer.
+  **/
+  unsigned int start;
+  /*M
+    Index of first invalid element in ring buffer.
+  **/
+  unsigned int end;
+  /*M
+    Number of elements in the ring buffer.
+  **/
+  unsigned int cnt;
+  /*M
+    Ring buffer array.
+  **/
+  rtp_pkt_t *pkts;
+} rtp_rb_t;
 
-void rtp_rb_clear(void);
-void rtp_rb_destroy(void);
-void rtp_rb_init(unsigned int size);
-unsigned int rtp_rb_length(void);
-void rtp_rb_pop(void);
-void rtp_rb_print(void);
-int rtp_rb_insert_pkt(rtp_pkt_t *pkt, int idx);
-rtp_pkt_t *rtp_rb_first(void);
+void rtp_rb_clear(rtp_rb_t *rb);
+void rtp_rb_destroy(rtp_rb_t *rb);
+void rtp_rb_init(rtp_rb_t *rb, unsigned int size);
+unsigned int rtp_rb_length(rtp_rb_t *rb);
+void rtp_rb_pop(rtp_rb_t *rb);
+void rtp_rb_print(rtp_rb_t *rb);
+int rtp_rb_insert_pkt(rtp_rb_t *rb, rtp_pkt_t *pkt, int idx);
+rtp_pkt_t *rtp_rb_first(rtp_rb_t *rb);
 
 #endif /* RTP_RB_H__ */
@@ -118,12 +118,13 @@ void rtp_pkt_pack(rtp_pkt_t *pkt) {
 }
 
 /*M
-  \emph{Send a RTP packet to filedescriptor using send.}
+  \emph{Prepare a RTP packet for sending.}
 
-  Fills the packet data buffer with the packed header, increments the
-  sequence number and sends it out.
+  Fills the packet data buffer with the packed header and increments
+  the sequence number. Returns the length of the packet in the data
+  buffer.
 **/
-ssize_t rtp_pkt_send(rtp_pkt_t *pkt, int fd) {
+unsigned int rtp_pkt_prepare(rtp_pkt_t *pkt) {
   assert(pkt != NULL);
   
   rtp_pkt_pack(pkt);
@@ -141,6 +142,19 @@ ssize_t rtp_pkt_send(rtp_pkt_t *pkt, int fd) {
   if (pkt->b.p)
     len += pkt->plen + 1;
 
+  return len;
+}
+
+/*M
+  \emph{Send a RTP packet to filedescriptor using send.}
+
+  Prepares the packet with \verb|rtp_pkt_prepare| and sends it out.
+**/
+ssize_t rtp_pkt_send(rtp_pkt_t *pkt, int fd) {
+  assert(pkt != NULL);
+
+  unsigned int len = rtp_pkt_prepare(pkt);
+
   /*M
     Send pack on \verb|fd|.
   **/
@@ -168,6 +182,19 @@ int rtp_pkt_read(rtp_pkt_t *pkt, int fd) {
     break;
   }
 
+  return rtp_pkt_parse(pkt, len);
+}
+
+/*M
+  \emph{Unpack a RTP packet of length \verb|len| received into the
+  data buffer.}
+
+  Used when the packet has been received by other means than
+  \verb|rtp_pkt_read|, for example in a batch.
+**/
+int rtp_pkt_parse(rtp_pkt_t *pkt, size_t len) {
+  assert(pkt != NULL);
+
   /*M
     Check if the packet is long enough.
   **/
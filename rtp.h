@@ -117,10 +117,12 @@ typedef struct rtp_pkt_s {
 void rtp_pkt_init(/*@out@*/ rtp_pkt_t *pkt);
 
 void    rtp_pkt_pack(rtp_pkt_t *pkt);
+unsigned int rtp_pkt_prepare(rtp_pkt_t *pkt);
 ssize_t rtp_pkt_send(rtp_pkt_t *pkt, int fd);
 
 int rtp_pkt_unpack(rtp_pkt_t *pkt);
 int rtp_pkt_read(rtp_pkt_t *pkt, int fd);
+int rtp_pkt_parse(rtp_pkt_t *pkt, size_t len);
 
 #ifdef WITH_OPENSSL
 #include <openssl/rsa.h>